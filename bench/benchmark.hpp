@@ -0,0 +1,216 @@
+// Benchmark harness for the Boost.Monads benchmarks
+//
+
+#ifndef BOOST_MONADS_BENCH_BENCHMARK_HPP
+#define BOOST_MONADS_BENCH_BENCHMARK_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// A benchmark is a function of the number of operations to run.  run()
+// calibrates that number so that one sample takes about sample_ms, runs
+// `warmup' samples that are thrown away and then `reps' samples, and
+// reports nanoseconds per operation: median, 10th and 90th percentile,
+// minimum and maximum.  run_fixed() is for benchmarks with a natural
+// sample size, like a pipeline over n elements.
+//
+// Command line of every benchmark program:
+//   --json         one JSON object per benchmark instead of a table
+//   --reps=N       samples per benchmark (default 25)
+//   --warmup=N     discarded samples (default 3)
+//   anything else  only run benchmarks whose name contains it
+//
+// A program that includes count_allocations.hpp also reports the heap
+// allocations per operation, averaged over the measured samples.
+
+namespace bench {
+
+struct options {
+    int warmup = 3;
+    int reps = 25;
+    double sample_ms = 2;
+    bool json = false;
+    std::vector<std::string> filters;
+};
+
+inline options parse_args(int argc, char** argv)
+{
+    options o;
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--json"))
+            o.json = true;
+        else if (!std::strncmp(argv[i], "--reps=", 7))
+            o.reps = std::atoi(argv[i] + 7);
+        else if (!std::strncmp(argv[i], "--warmup=", 9))
+            o.warmup = std::atoi(argv[i] + 9);
+        else
+            o.filters.push_back(argv[i]);
+    }
+    if (o.reps < 1)
+        o.reps = 1;
+    return o;
+}
+
+// keeps the compiler from optimizing away a result
+template <typename T>
+inline void do_not_optimize(T const& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// hides a value from the optimizer, so that what is computed from it is
+// not folded into a constant
+template <typename T>
+inline T opaque(T value)
+{
+    asm volatile("" : "+m"(value));
+    return value;
+}
+
+struct result {
+    double median, p10, p90, min, max;
+    // negative if allocations are not counted
+    double allocs;
+};
+
+namespace detail {
+typedef std::chrono::steady_clock clock;
+
+// incremented by the operator new of count_allocations.hpp
+inline std::atomic<std::size_t>& allocations()
+{
+    static std::atomic<std::size_t> n(0);
+    return n;
+}
+
+inline bool& counting_allocations()
+{
+    static bool on = false;
+    return on;
+}
+
+inline std::size_t allocations_so_far()
+{
+    return allocations().load(std::memory_order_relaxed);
+}
+
+inline bool selected(options const& o, const char* name)
+{
+    if (o.filters.empty())
+        return true;
+    for (auto const& f : o.filters)
+        if (std::strstr(name, f.c_str()))
+            return true;
+    return false;
+}
+
+// nearest rank on sorted samples
+inline double percentile(std::vector<double> const& sorted, double p)
+{
+    std::size_t i = static_cast<std::size_t>(p / 100 * sorted.size());
+    return sorted[i < sorted.size() ? i : sorted.size() - 1];
+}
+
+inline result summarize(std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    result r;
+    r.median = percentile(samples, 50);
+    r.p10 = percentile(samples, 10);
+    r.p90 = percentile(samples, 90);
+    r.min = samples.front();
+    r.max = samples.back();
+    r.allocs = -1;
+    return r;
+}
+
+// ns per operation of f(ops)
+template <typename F>
+double sample(F& f, std::size_t ops)
+{
+    const clock::time_point start = clock::now();
+    f(ops);
+    const clock::time_point end = clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / ops;
+}
+
+inline void report(options const& o, const char* name, std::size_t ops, result const& r)
+{
+    if (o.json) {
+        std::printf("{\"name\": \"%s\", \"unit\": \"ns/op\", \"ops_per_sample\": %zu, "
+                    "\"reps\": %d, \"median\": %.3f, \"p10\": %.3f, \"p90\": %.3f, "
+                    "\"min\": %.3f, \"max\": %.3f",
+                    name, ops, o.reps, r.median, r.p10, r.p90, r.min, r.max);
+        if (r.allocs >= 0)
+            std::printf(", \"allocs_per_op\": %.3f", r.allocs);
+        std::printf("}\n");
+    } else {
+        std::printf("%-44s %12.2f %12.2f %12.2f  ns/op", name, r.median, r.p10, r.p90);
+        if (r.allocs >= 0)
+            std::printf(" %10.2f allocs/op", r.allocs);
+        std::printf("\n");
+    }
+    std::fflush(stdout);
+}
+
+// samples of reps runs of f(ops), with the allocations they made
+template <typename F>
+result measure(options const& o, F& f, std::size_t ops)
+{
+    std::vector<double> samples;
+    samples.reserve(o.reps);
+    const std::size_t before = allocations_so_far();
+    for (int i = 0; i < o.reps; ++i)
+        samples.push_back(sample(f, ops));
+    const std::size_t allocs = allocations_so_far() - before;
+    result r = summarize(samples);
+    if (counting_allocations())
+        r.allocs = double(allocs) / (double(ops) * o.reps);
+    return r;
+}
+
+} // namespace detail
+
+inline void header(options const& o)
+{
+    if (!o.json)
+        std::printf("%-44s %12s %12s %12s%s\n", "benchmark", "median", "p10", "p90",
+                    detail::counting_allocations() ? "        allocs" : "");
+}
+
+// f(n) performs n operations
+template <typename F>
+void run(options const& o, const char* name, F f)
+{
+    if (!detail::selected(o, name))
+        return;
+    std::size_t ops = 1;
+    while (detail::sample(f, ops) * ops < o.sample_ms * 1e6 && ops < (std::size_t(1) << 40))
+        ops *= 2;
+    for (int i = 0; i < o.warmup; ++i)
+        detail::sample(f, ops);
+    detail::report(o, name, ops, detail::measure(o, f, ops));
+}
+
+// f() performs ops operations
+template <typename F>
+void run_fixed(options const& o, const char* name, std::size_t ops, F f)
+{
+    if (!detail::selected(o, name))
+        return;
+    auto g = [&](std::size_t) { f(); };
+    for (int i = 0; i < o.warmup; ++i)
+        detail::sample(g, ops);
+    detail::report(o, name, ops, detail::measure(o, g, ops));
+}
+
+} // namespace bench
+
+#endif // BOOST_MONADS_BENCH_BENCHMARK_HPP
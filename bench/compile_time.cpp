@@ -0,0 +1,182 @@
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Compile time and memory of chains n stages long, for n from 8 to 256:
+// continuation binds (>>=), fused pipeline maps (|), maps in stages of
+// their own (own_stage) and pipeline binds (>>).  Every chain is written
+// to a temporary file and compiled with the compiler the suite is built
+// with (BOOST_MONADS_BENCH_CXX, set by the Makefile); the wall time and
+// the peak resident memory of the compiler come from wait4().  One
+// compile per chain unless --reps says otherwise; --warmup is ignored.
+
+#ifndef BOOST_MONADS_BENCH_CXX
+#define BOOST_MONADS_BENCH_CXX "g++"
+#endif
+#ifndef BOOST_MONADS_BENCH_INCLUDE
+#define BOOST_MONADS_BENCH_INCLUDE "../include"
+#endif
+
+namespace {
+
+const char* const prelude =
+    "#include <boost/monads/monad.hpp>\n"
+    "#include <boost/monads/controlmonad.hpp>\n"
+    "#include <boost/monads/pipeline.hpp>\n"
+    "#include <boost/monads/segment.hpp>\n"
+    "#include <vector>\n"
+    "namespace mon = boost::monads;\n"
+    "struct inc {\n"
+    "  auto operator()(int i) const -> decltype(mon::mreturn<mon::cps>(i + 1))\n"
+    "  { return mon::mreturn<mon::cps>(i + 1); }\n"
+    "};\n"
+    "struct plus { int operator()(int i) const { return i + 1; } };\n"
+    "struct seg {\n"
+    "  mon::shared_blocking_queue<int> operator()(int i) const\n"
+    "  { return mon::segment_monad::mreturn(i); }\n"
+    "};\n"
+    "int main()\n"
+    "{\n"
+    "  int out = 0;\n"
+    "  std::vector<int> v(3);\n";
+
+std::string cps_chain(int n)
+{
+    std::string e = "mon::monad_pipe(mon::mreturn<mon::cps>(0))";
+    for (int i = 0; i < n; ++i)
+        e = "(" + e + " >>= inc{})";
+    return "  mon::run_cont(" + e + ".unpipe(), [&](int i) { out = i; });\n";
+}
+
+std::string pipeline_chain(int n, const char* stage)
+{
+    std::string e = "mon::pipeline<mon::segment_monad>(mon::segment_monad::from_range(v.begin(), v.end()))";
+    for (int i = 0; i < n; ++i)
+        e += stage;
+    return "  auto q = (" + e + ").get();\n"
+           "  for (int x; q->pop(x);)\n"
+           "    out += x;\n";
+}
+
+std::string fused_chain(int n) { return pipeline_chain(n, "\n    | plus{}"); }
+std::string stages_chain(int n) { return pipeline_chain(n, "\n    | mon::own_stage(plus{})"); }
+std::string binds_chain(int n) { return pipeline_chain(n, "\n    >> seg{}"); }
+
+struct compile_result {
+    bool ok;
+    double seconds;
+    long peak_kib;
+};
+
+// compiles source to nowhere
+compile_result compile(std::string const& source)
+{
+    compile_result r = {false, 0, 0};
+    char path[] = "/tmp/boost_monads_compile_time_XXXXXX.cpp";
+    int fd = mkstemps(path, 4);
+    if (fd < 0)
+        return r;
+    FILE* f = fdopen(fd, "w");
+    std::fputs(source.c_str(), f);
+    std::fclose(f);
+
+    const std::string command = std::string("exec ") + BOOST_MONADS_BENCH_CXX +
+        " -std=c++11 -O2 -I" BOOST_MONADS_BENCH_INCLUDE " -c " + path + " -o /dev/null";
+    const auto start = bench::detail::clock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        // only the verdict is of interest
+        if (!std::freopen("/dev/null", "w", stderr))
+            _exit(127);
+        execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    int status = 0;
+    struct rusage usage;
+    if (pid > 0 && wait4(pid, &status, 0, &usage) == pid) {
+        const auto end = bench::detail::clock::now();
+        r.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        r.seconds = std::chrono::duration<double>(end - start).count();
+        // the driver's own children (cc1plus) are included
+        r.peak_kib = usage.ru_maxrss;
+    }
+    std::remove(path);
+    return r;
+}
+
+void report(bench::options const& o, const char* name, int n, std::vector<compile_result> const& rs)
+{
+    std::vector<double> seconds;
+    long peak = 0;
+    for (auto const& r : rs) {
+        seconds.push_back(r.seconds);
+        peak = std::max(peak, r.peak_kib);
+    }
+    bench::result r = bench::detail::summarize(seconds);
+    if (o.json)
+        std::printf("{\"name\": \"%s\", \"unit\": \"s\", \"stages\": %d, \"reps\": %d, "
+                    "\"median\": %.3f, \"min\": %.3f, \"max\": %.3f, \"peak_rss_kib\": %ld}\n",
+                    name, n, o.reps, r.median, r.min, r.max, peak);
+    else
+        std::printf("%-44s %12.2f %12.2f %12.2f  s %10.1f MiB\n",
+                    name, r.median, r.min, r.max, peak / 1024.0);
+    std::fflush(stdout);
+}
+
+// compiles chain(n) for growing n, up to the first n that fails
+template <typename Chain>
+void compile_chains(bench::options const& o, const char* kind, Chain chain)
+{
+    for (int n = 8; n <= 256; n *= 2) {
+        const std::string name = std::string("compile/") + kind + "/" + std::to_string(n);
+        if (!bench::detail::selected(o, name.c_str()))
+            continue;
+        const std::string source = prelude + chain(n) + "  return out == 0;\n}\n";
+        std::vector<compile_result> rs;
+        for (int i = 0; i < o.reps; ++i) {
+            rs.push_back(compile(source));
+            if (!rs.back().ok)
+                break;
+        }
+        if (!rs.back().ok) {
+            if (o.json)
+                std::printf("{\"name\": \"%s\", \"unit\": \"s\", \"stages\": %d, \"failed\": true}\n",
+                            name.c_str(), n);
+            else
+                std::printf("%-44s %12s\n", name.c_str(), "failed");
+            std::fflush(stdout);
+            return;
+        }
+        report(o, name.c_str(), n, rs);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    bench::options o = bench::parse_args(argc, argv);
+    bool reps_given = false;
+    for (int i = 1; i < argc; ++i)
+        reps_given = reps_given || !std::strncmp(argv[i], "--reps=", 7);
+    if (!reps_given)
+        o.reps = 1;
+    if (!o.json)
+        std::printf("%-44s %12s %12s %12s\n", "benchmark", "median", "min", "max");
+
+    compile_chains(o, "cont/bind", cps_chain);
+    compile_chains(o, "pipeline/fused", fused_chain);
+    compile_chains(o, "pipeline/own_stage", stages_chain);
+    compile_chains(o, "pipeline/bind", binds_chain);
+}
@@ -0,0 +1,154 @@
+#include "benchmark.hpp"
+#include "count_allocations.hpp"
+
+#include <boost/monads/monad.hpp>
+#include <boost/monads/controlmonad.hpp>
+#include <boost/monads/future.hpp>
+#include <boost/monads/segment.hpp>
+#include <boost/monads/coroutine.hpp>
+
+#include <cstdio>
+#include <vector>
+
+// Coroutine do-notation against the equivalent chains of binds: a
+// co_cont awaiting continuation monads, a future coroutine awaiting
+// futures, and a stream coroutine as a pipeline stage.  Built with
+// -std=c++20 (see Makefile); without coroutine support there is nothing
+// to measure.
+
+#if defined(BOOST_MONADS_HAS_COROUTINES)
+
+namespace mon = boost::monads;
+
+struct cps_inc {
+  auto operator()(int i) const -> decltype(mon::mreturn<mon::cps>(i + 1))
+  {
+    return mon::mreturn<mon::cps>(i + 1);
+  }
+};
+
+struct future_inc {
+  mon::future<int> operator()(int i) const { return mon::make_ready_future(i + 1); }
+};
+
+struct sink {
+  int& out;
+  void operator()(int i) const { out = i; }
+};
+
+mon::co_cont<int> co_chain4(int i)
+{
+  i = co_await cps_inc{}(i);
+  i = co_await cps_inc{}(i);
+  i = co_await cps_inc{}(i);
+  i = co_await cps_inc{}(i);
+  co_return i;
+}
+
+mon::future<int> co_future_chain16(mon::future<int> f)
+{
+  int i = co_await std::move(f);
+  for (int k = 0; k < 16; ++k)
+    i = co_await future_inc{}(i);
+  co_return i;
+}
+
+struct double_it {
+  mon::shared_spsc_queue<int> operator()(int x) const { return mon::spsc_segment_monad::mreturn(2 * x); }
+};
+
+mon::shared_spsc_queue<int> doubled(mon::shared_spsc_queue<int> in)
+{
+  auto r = mon::reader(in);
+  while (auto x = co_await r.next())
+    co_yield 2 * *x;
+}
+
+template <typename Stage>
+long drain(std::vector<int> const& input, Stage stage)
+{
+  mon::queue_options options;
+  options.batch_size = 64;
+  auto out = stage(mon::spsc_segment_monad::from_range(input.begin(), input.end(), options));
+  long sum = 0;
+  for (int x; out->pop(x);)
+    sum += x;
+  return sum;
+}
+
+int main(int argc, char** argv)
+{
+  bench::options o = bench::parse_args(argc, argv);
+  bench::header(o);
+
+  // four awaits of a continuation monad vs. four binds
+  bench::run(o, "cont/chain/4/bind", [](std::size_t n) {
+      int out = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        auto m = mon::mbind(mon::mbind(mon::mbind(mon::mbind(mon::mreturn<mon::cps>(int(i)),
+                 cps_inc{}), cps_inc{}), cps_inc{}), cps_inc{});
+        mon::run_cont(m, sink{out});
+        bench::do_not_optimize(out);
+      }
+    });
+  bench::run(o, "cont/chain/4/coroutine", [](std::size_t n) {
+      int out = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        mon::run_cont(co_chain4(int(i)), sink{out});
+        bench::do_not_optimize(out);
+      }
+    });
+
+  // 16 steps on futures, ready and pending at the start
+  bench::run(o, "future/chain/16/ready/bind", [](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        mon::future<int> f = mon::make_ready_future(0);
+        for (int k = 0; k < 16; ++k)
+          f = mon::mbind(std::move(f), future_inc{});
+        bench::do_not_optimize(f.get());
+      }
+    });
+  bench::run(o, "future/chain/16/ready/coroutine", [](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::do_not_optimize(co_future_chain16(mon::make_ready_future(0)).get());
+    });
+  bench::run(o, "future/chain/16/pending/bind", [](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        mon::promise<int> p;
+        mon::future<int> f = p.get_future();
+        for (int k = 0; k < 16; ++k)
+          f = mon::mbind(std::move(f), future_inc{});
+        p.set_value(0);
+        bench::do_not_optimize(f.get());
+      }
+    });
+  bench::run(o, "future/chain/16/pending/coroutine", [](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        mon::promise<int> p;
+        mon::future<int> f = co_future_chain16(p.get_future());
+        p.set_value(0);
+        bench::do_not_optimize(f.get());
+      }
+    });
+
+  // one stage doubling 100k elements: a bind to mreturn per element vs.
+  // a stream coroutine
+  std::vector<int> input(100000);
+  for (std::size_t i = 0; i < input.size(); ++i)
+    input[i] = int(i);
+  bench::run_fixed(o, "segment/map/spsc/bind", input.size(), [&]() {
+      bench::do_not_optimize(drain(input, [](mon::shared_spsc_queue<int> q) { return mon::mbind(q, double_it{}); }));
+    });
+  bench::run_fixed(o, "segment/map/spsc/coroutine", input.size(), [&]() {
+      bench::do_not_optimize(drain(input, [](mon::shared_spsc_queue<int> q) { return doubled(q); }));
+    });
+}
+
+#else
+
+int main()
+{
+  std::printf("no coroutines\n");
+}
+
+#endif
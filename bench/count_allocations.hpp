@@ -0,0 +1,51 @@
+// Allocation counting for the Boost.Monads benchmarks
+//
+
+#ifndef BOOST_MONADS_BENCH_COUNT_ALLOCATIONS_HPP
+#define BOOST_MONADS_BENCH_COUNT_ALLOCATIONS_HPP
+
+#include "benchmark.hpp"
+
+#include <cstdlib>
+#include <new>
+
+// Replaces the global operator new and delete to count allocations, so
+// that run() and run_fixed() report them.  Include it from exactly one
+// translation unit of a benchmark program.  The array and nothrow forms
+// forward to these in libstdc++ and are counted as well.
+
+namespace bench { namespace detail {
+struct enable_allocation_counting {
+    enable_allocation_counting() { counting_allocations() = true; }
+};
+static enable_allocation_counting allocation_counting_enabled;
+}} // namespace bench::detail
+
+// kept out of line: g++ takes the malloc and free of the replacements
+// inlined into new expressions for mismatched pairs
+#if defined(__GNUC__)
+#define BOOST_MONADS_BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BOOST_MONADS_BENCH_NOINLINE
+#endif
+
+BOOST_MONADS_BENCH_NOINLINE void* operator new(std::size_t size)
+{
+    bench::detail::allocations().fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+BOOST_MONADS_BENCH_NOINLINE void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+// the sized form, used from C++14 on
+BOOST_MONADS_BENCH_NOINLINE void operator delete(void* p, std::size_t) noexcept
+{
+    ::operator delete(p);
+}
+
+#endif // BOOST_MONADS_BENCH_COUNT_ALLOCATIONS_HPP
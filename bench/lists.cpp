@@ -0,0 +1,103 @@
+#include "benchmark.hpp"
+#include "count_allocations.hpp"
+
+#include <boost/monads/monad.hpp>
+#include <boost/monads/algorithm.hpp>
+#include <boost/monads/list.hpp>
+
+#include <string>
+#include <vector>
+
+// std::vector as List monad over 1M elements (ns and allocations per
+// input element): mbind against a naive flatMap that builds a vector for
+// every element and copies it onto a result that grows as it goes.  For
+// a map, a filter (f returns list_single), an expansion into three
+// elements with and without a size hint, and a join of strings.
+
+namespace mon = boost::monads;
+
+typedef std::vector<int> ints;
+
+template <typename U, typename V, typename F>
+std::vector<U> naive_flat_map(V const& v, F f)
+{
+  std::vector<U> out;
+  for (auto const& x : v) {
+    std::vector<U> r = f(x);
+    out.insert(out.end(), r.begin(), r.end());
+  }
+  return out;
+}
+
+struct inc {
+  int operator()(int i) const { return i + 1; }
+};
+
+struct inc_list {
+  ints operator()(int i) const { return ints(1, i + 1); }
+};
+
+struct evens_list {
+  ints operator()(int i) const { return i % 2 ? ints() : ints(1, i); }
+};
+
+struct evens {
+  mon::list_single<int> operator()(int i) const
+  {
+    return i % 2 ? mon::list_monad::mempty<int>() : mon::list_monad::mreturn(i);
+  }
+};
+
+struct expand {
+  ints operator()(int i) const { return ints{i, i + 1, i + 2}; }
+};
+
+int main(int argc, char** argv)
+{
+  bench::options o = bench::parse_args(argc, argv);
+  bench::header(o);
+
+  const int size = 1000*1000;
+  ints v;
+  for (int i = 0; i < size; ++i)
+    v.push_back(i);
+
+  bench::run_fixed(o, "list/map/naive", v.size(), [&]() {
+      bench::do_not_optimize(naive_flat_map<int>(v, inc_list()).data());
+    });
+  bench::run_fixed(o, "list/map/mbind", v.size(), [&]() {
+      bench::do_not_optimize(mon::mbind(v, inc_list()).data());
+    });
+  bench::run_fixed(o, "list/map/fmap", v.size(), [&]() {
+      bench::do_not_optimize(mon::fmap<ints>(v, inc()).data());
+    });
+
+  bench::run_fixed(o, "list/filter/naive", v.size(), [&]() {
+      bench::do_not_optimize(naive_flat_map<int>(v, evens_list()).data());
+    });
+  bench::run_fixed(o, "list/filter/list_single", v.size(), [&]() {
+      bench::do_not_optimize(mon::mbind(v, evens()).data());
+    });
+
+  bench::run_fixed(o, "list/expand/3/naive", v.size(), [&]() {
+      bench::do_not_optimize(naive_flat_map<int>(v, expand()).data());
+    });
+  bench::run_fixed(o, "list/expand/3/mbind", v.size(), [&]() {
+      bench::do_not_optimize(mon::mbind(v, expand()).data());
+    });
+  bench::run_fixed(o, "list/expand/3/size_hint", v.size(), [&]() {
+      bench::do_not_optimize(mon::mbind(v, mon::with_size_hint(expand(), 3)).data());
+    });
+
+  // 250k groups of four strings, too long for the small string buffer
+  std::vector<std::vector<std::string> > nested(size / 4);
+  for (std::size_t i = 0; i < nested.size(); ++i)
+    for (int k = 0; k < 4; ++k)
+      nested[i].push_back("a string of some length, number " + std::to_string(4 * i + k));
+  bench::run_fixed(o, "list/join/strings/naive", size, [&]() {
+      bench::do_not_optimize(naive_flat_map<std::string>(nested, mon::identity()).data());
+    });
+  bench::run_fixed(o, "list/join/strings/mbind", size, [&]() {
+      bench::do_not_optimize(mon::join(nested).data());
+    });
+}
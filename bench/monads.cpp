@@ -0,0 +1,432 @@
+#include "benchmark.hpp"
+#include "count_allocations.hpp"
+
+#include <boost/monads/monad.hpp>
+#include <boost/monads/controlmonad.hpp>
+#include <boost/monads/algorithm.hpp>
+#include <boost/monads/future.hpp>
+#include <boost/monads/trampoline.hpp>
+#include <boost/monads/optional.hpp>
+#include <boost/monads/lazy.hpp>
+#include <boost/monads/writer.hpp>
+#include <boost/monads/state.hpp>
+
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Cost of the monad machinery itself: mbind dispatch per monad kind,
+// continuation chains of growing depth, type erased continuations,
+// loops of binds built at runtime, run recursively and on a trampoline,
+// Maybe chains (unique_ptr and boost::optional) and future chains.
+// Allocations per operation are counted (count_allocations.hpp): the
+// type erased continuations must not allocate once built, unlike their
+// std::function counterpart, and neither must optional Maybe chains.
+// Writer and State chains compare binding in place with copying the log
+// or the state at every step.  Inputs, and the value between two steps of
+// a chain, pass through bench::opaque, so that no chain folds into a
+// constant.
+
+namespace mon = boost::monads;
+
+namespace std { // need ADL, as in example/uniqueptr.cpp
+template <typename T, typename F>
+std::unique_ptr<T> boost_mbind(std::unique_ptr<T> const& p, F&& fun)
+{
+  if (!p) return std::unique_ptr<T>();
+  return fun(*p);
+}
+}
+
+struct maybe_inc {
+  std::unique_ptr<int> operator()(int i) const { return std::unique_ptr<int>(new int(i + 1)); }
+};
+
+struct optional_inc {
+  boost::optional<int> operator()(int i) const { return boost::optional<int>(bench::opaque(i) + 1); }
+};
+
+struct cps_inc {
+  auto operator()(int i) const -> decltype(mon::mreturn<mon::cps>(i + 1))
+  {
+    return mon::mreturn<mon::cps>(bench::opaque(i) + 1);
+  }
+};
+
+struct future_inc {
+  mon::future<int> operator()(int i) const { return mon::make_ready_future(i + 1); }
+};
+
+typedef mon::type_erased_cont_monad<void, int> erased_cont;
+
+struct erased_inc {
+  erased_cont operator()(int i) const
+  {
+    return mon::mreturn<mon::erased_cps<void, int> >(i + 1);
+  }
+};
+
+// a continuation too large for std::function's inline buffer
+struct tally {
+  int& out;
+  int& calls;
+  long offset;
+  void operator()(int i) const { out = int(i + offset); ++calls; }
+};
+
+// escapes through the continuation of call_cc for odd i
+struct erased_escape {
+  int i;
+  template <typename K>
+  erased_cont operator()(K&& k) const
+  {
+    if (i % 2)
+      return k(i);
+    return mon::mreturn<mon::erased_cps<void, int> >(i);
+  }
+};
+
+struct tramp_inc {
+  mon::trampolined_cont_monad<int> operator()(int i) const
+  {
+    return mon::mreturn<mon::trampolined_cps>(i + 1);
+  }
+};
+
+struct sink {
+  int& out;
+  void operator()(int i) const { out = i; }
+};
+
+// mbind(...mbind(m, F{})..., F{}), Depth times
+template <int Depth, typename F = cps_inc>
+struct cps_chain {
+  template <typename M>
+  static auto build(M const& m)
+    -> decltype(cps_chain<Depth - 1, F>::build(mon::mbind(m, F{})))
+  {
+    return cps_chain<Depth - 1, F>::build(mon::mbind(m, F{}));
+  }
+};
+
+template <typename F>
+struct cps_chain<0, F> {
+  template <typename M>
+  static M build(M const& m) { return m; }
+};
+
+// the same chain recorded by a lazy_piper and rewritten at unpipe()
+template <int Depth, typename F = cps_inc>
+struct lazy_chain {
+  template <typename P>
+  static auto build(P&& p)
+    -> decltype(lazy_chain<Depth - 1, F>::build(std::move(p) >>= F{}))
+  {
+    return lazy_chain<Depth - 1, F>::build(std::move(p) >>= F{});
+  }
+};
+
+template <typename F>
+struct lazy_chain<0, F> {
+  template <typename P>
+  static P build(P&& p) { return std::move(p); }
+};
+
+struct lazy_inc {
+  auto operator()(int i) const -> decltype(mon::lazy_return<mon::cps>(i + 1))
+  {
+    return mon::lazy_return<mon::cps>(bench::opaque(i) + 1);
+  }
+};
+
+typedef std::vector<int> buffer;
+typedef mon::writer<buffer, int> logged;
+
+struct log_inc {
+  logged operator()(int i) const { return logged(i + 1, buffer(1, i)); }
+};
+
+struct push {
+  int x;
+  void operator()(buffer& b) const { b.push_back(x); }
+};
+
+struct push_next {
+  int x;
+  auto operator()(mon::unit) const -> decltype(mon::modify_state<buffer>(push{x}))
+  {
+    return mon::modify_state<buffer>(push{x});
+  }
+};
+
+// Depth actions, each pushing to the buffer
+template <int Depth>
+struct state_chain {
+  static auto make() -> decltype(mon::mbind(state_chain<Depth - 1>::make(), push_next{Depth}))
+  {
+    return mon::mbind(state_chain<Depth - 1>::make(), push_next{Depth});
+  }
+};
+
+template <>
+struct state_chain<1> {
+  static auto make() -> decltype(mon::modify_state<buffer>(push{1}))
+  {
+    return mon::modify_state<buffer>(push{1});
+  }
+};
+
+// the same step as a pure action, taking the state and returning it
+struct pure_push {
+  int x;
+  std::pair<mon::unit, buffer> operator()(buffer const& b) const
+  {
+    buffer next = b;
+    next.push_back(x);
+    return std::make_pair(mon::unit(), next);
+  }
+};
+
+template <int Depth>
+void bench_cps_chain(bench::options const& o, const char* name)
+{
+  bench::run(o, name, [](std::size_t n) {
+      int out = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        auto m = cps_chain<Depth>::build(mon::mreturn<mon::cps>(bench::opaque(int(i))));
+        mon::run_cont(m, sink{out});
+        bench::do_not_optimize(out);
+      }
+    });
+}
+
+int main(int argc, char** argv)
+{
+  bench::options o = bench::parse_args(argc, argv);
+  bench::header(o);
+
+  // dispatch: calling the monad's bind directly vs. through mbind
+  std::unique_ptr<int> maybe(new int(1));
+  bench::run(o, "mbind/unique_ptr/direct", [&](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::do_not_optimize(*std::boost_mbind(maybe, maybe_inc{}));
+    });
+  bench::run(o, "mbind/unique_ptr/adl", [&](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::do_not_optimize(*mon::mbind(maybe, maybe_inc{}));
+    });
+  auto cont = mon::mreturn<mon::cps>(1);
+  bench::run(o, "mbind/cps/direct", [&](std::size_t n) {
+      int out = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        mon::run_cont(bench::opaque(cont).mbind(cps_inc{}), sink{out});
+        bench::do_not_optimize(out);
+      }
+    });
+  bench::run(o, "mbind/cps/member", [&](std::size_t n) {
+      int out = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        mon::run_cont(mon::mbind(bench::opaque(cont), cps_inc{}), sink{out});
+        bench::do_not_optimize(out);
+      }
+    });
+  bench::run(o, "mbind/future/ready", [&](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i)
+        bench::do_not_optimize(mon::mbind(mon::make_ready_future(1), future_inc{}).get());
+    });
+
+  // continuation chains
+  bench_cps_chain<1>(o, "cont/chain/1");
+  bench_cps_chain<4>(o, "cont/chain/4");
+  bench_cps_chain<16>(o, "cont/chain/16");
+  // lazily: binds to built monads, and mreturns folded into one
+  bench::run(o, "cont/chain/16/lazy", [](std::size_t n) {
+      int out = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        auto m = lazy_chain<16>::build(mon::lazy_return<mon::cps>(bench::opaque(int(i)))).unpipe();
+        mon::run_cont(m, sink{out});
+        bench::do_not_optimize(out);
+      }
+    });
+  bench::run(o, "cont/chain/16/lazy/folded", [](std::size_t n) {
+      int out = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        auto m = lazy_chain<16, lazy_inc>::build(mon::lazy_return<mon::cps>(bench::opaque(int(i)))).unpipe();
+        mon::run_cont(m, sink{out});
+        bench::do_not_optimize(out);
+      }
+    });
+
+  // type erased continuations: calling one, erasing and calling one,
+  // chains of binds to functions returning erased monads and call_cc
+  // returning one; all of them without allocations
+  erased_cont erased(mon::mreturn<mon::cps>(1));
+  bench::run(o, "cont_erased/call", [&](std::size_t n) {
+      int out = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        erased(sink{out});
+        bench::do_not_optimize(out);
+      }
+    });
+  bench::run(o, "cont_erased/make_and_call", [&](std::size_t n) {
+      int out = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        erased_cont m(mon::mreturn<mon::cps>(int(i)));
+        m(sink{out});
+        bench::do_not_optimize(out);
+      }
+    });
+  bench::run(o, "cont_erased/bind_chain/4", [&](std::size_t n) {
+      int out = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        auto m = cps_chain<4, erased_inc>::build(mon::mreturn<mon::erased_cps<void, int> >(int(i)));
+        mon::run_cont(m, sink{out});
+        bench::do_not_optimize(out);
+      }
+    });
+  bench::run(o, "cont_erased/call_cc", [&](std::size_t n) {
+      int out = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        mon::run_cont(mon::call_cc(erased_escape{int(i)}), sink{out});
+        bench::do_not_optimize(out);
+      }
+    });
+  // passing a continuation that does not fit into std::function's
+  // inline buffer, to the erased monad and to its std::function
+  // counterpart
+  bench::run(o, "cont_erased/call/large_k", [&](std::size_t n) {
+      int out = 0, calls = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        erased(tally{out, calls, 1});
+        bench::do_not_optimize(out);
+      }
+    });
+  std::function<void(std::function<void(int)>)> erased_by_function(
+      [](std::function<void(int)> const& k) { k(1); });
+  bench::run(o, "std_function/call/large_k", [&](std::size_t n) {
+      int out = 0, calls = 0;
+      for (std::size_t i = 0; i < n; ++i) {
+        erased_by_function(tally{out, calls, 1});
+        bench::do_not_optimize(out);
+      }
+    });
+
+  // a loop of 1000 binds built at runtime and run as a whole; ns and
+  // allocations per step.  The erased chain runs recursively and needs
+  // stack in proportion to its length, the trampolined one runs in
+  // constant stack.
+  const int loop = 1000;
+  erased_cont erased_loop = mon::mreturn<mon::erased_cps<void, int> >(0);
+  for (int k = 0; k < loop; ++k)
+    erased_loop = erased_cont(mon::mbind(std::move(erased_loop), erased_inc{}));
+  bench::run(o, "loop/erased/step", [&](std::size_t n) {
+      int out = 0;
+      for (std::size_t i = 0; i < n; i += loop) {
+        mon::run_cont(erased_loop, sink{out});
+        bench::do_not_optimize(out);
+      }
+    });
+  mon::trampolined_cont_monad<int> trampolined_loop = mon::mreturn<mon::trampolined_cps>(0);
+  for (int k = 0; k < loop; ++k)
+    trampolined_loop = mon::mbind(trampolined_loop, tramp_inc{});
+  bench::run(o, "loop/trampolined/step", [&](std::size_t n) {
+      int out = 0;
+      for (std::size_t i = 0; i < n; i += loop) {
+        mon::run_cont(trampolined_loop, sink{out});
+        bench::do_not_optimize(out);
+      }
+    });
+
+  // Maybe chains of 16 binds, all present and cut short after the first
+  bench::run(o, "maybe/unique_ptr/chain/16", [&](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        std::unique_ptr<int> m(new int(0));
+        for (int k = 0; k < 16; ++k)
+          m = mon::mbind(m, maybe_inc{});
+        bench::do_not_optimize(*m);
+      }
+    });
+  bench::run(o, "maybe/unique_ptr/chain/16/empty", [&](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        std::unique_ptr<int> m(bench::opaque<int*>(nullptr));
+        for (int k = 0; k < 16; ++k)
+          m = mon::mbind(m, maybe_inc{});
+        bench::do_not_optimize(m.get());
+      }
+    });
+  bench::run(o, "maybe/optional/chain/16", [&](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        boost::optional<int> m = mon::mreturn<boost::optional<int> >(bench::opaque(int(i)));
+        for (int k = 0; k < 16; ++k)
+          m = mon::mbind(m, optional_inc{});
+        bench::do_not_optimize(*m);
+      }
+    });
+  bench::run(o, "maybe/optional/chain/16/empty", [&](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        boost::optional<int> m = bench::opaque(boost::optional<int>());
+        for (int k = 0; k < 16; ++k)
+          m = mon::mbind(m, optional_inc{});
+        bench::do_not_optimize(bool(m));
+      }
+    });
+
+  // Writer chains of 64 binds, each adding a line to the log: binding
+  // the lvalue copies the log every time, the temporary appends in place
+  bench::run(o, "writer/chain/64/copy", [&](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        logged m = mon::mreturn<logged>(0);
+        for (int k = 0; k < 64; ++k)
+          m = mon::mbind(m, log_inc{});
+        bench::do_not_optimize(m.log.size());
+      }
+    });
+  bench::run(o, "writer/chain/64/inplace", [&](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        logged m = mon::mreturn<logged>(0);
+        for (int k = 0; k < 64; ++k)
+          m = mon::mbind(std::move(m), log_inc{});
+        bench::do_not_optimize(m.log.size());
+      }
+    });
+
+  // 16 State steps pushing to a buffer: in place, and as pure actions
+  // passing the state on by value
+  auto actions = state_chain<16>::make();
+  bench::run(o, "state/chain/16/inplace", [&](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        buffer b;
+        mon::run_state(actions, b);
+        bench::do_not_optimize(b.data());
+      }
+    });
+  bench::run(o, "state/chain/16/pure", [&](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        buffer b;
+        for (int k = 1; k <= 16; ++k)
+          b = pure_push{k}(b).second;
+        bench::do_not_optimize(b.data());
+      }
+    });
+
+  // future chains of 16 binds, on ready futures and on a pending one
+  bench::run(o, "future/chain/16/ready", [&](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        mon::future<int> f = mon::make_ready_future(0);
+        for (int k = 0; k < 16; ++k)
+          f = mon::mbind(std::move(f), future_inc{});
+        bench::do_not_optimize(f.get());
+      }
+    });
+  bench::run(o, "future/chain/16/pending", [&](std::size_t n) {
+      for (std::size_t i = 0; i < n; ++i) {
+        mon::promise<int> p;
+        mon::future<int> f = p.get_future();
+        for (int k = 0; k < 16; ++k)
+          f = mon::mbind(std::move(f), future_inc{});
+        p.set_value(0);
+        bench::do_not_optimize(f.get());
+      }
+    });
+}
@@ -0,0 +1,275 @@
+#include "benchmark.hpp"
+#include "count_allocations.hpp"
+
+#include <boost/monads/monad.hpp>
+#include <boost/monads/algorithm.hpp>
+#include <boost/monads/pipeline.hpp>
+#include <boost/monads/segment.hpp>
+#include <boost/monads/file.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Segment pipelines: throughput of a filter/map pipeline over 100k
+// elements per transport and batch size (ns per element), of a parallel
+// CPU-heavy stage, of a flatMap over inner queues that are slow to
+// fill, one at a time and concurrently, and the latency of a single
+// element travelling through two stages when the pipeline is otherwise
+// idle, and of taking the first 10 elements with and without cancelling
+// the rest.  The file benchmarks read lines from a memory-mapped file
+// against getline into strings, and write them with the buffered sink
+// against an ofstream.
+// Heap allocations are reported per element.
+
+namespace mon = boost::monads;
+
+template <typename SegmentMonad>
+struct error_filter {
+  typedef decltype(SegmentMonad::template mempty<std::string>()) queue_type;
+  queue_type operator()(std::string const& s) const
+  {
+    return s.compare(0, 6, "Error:") == 0 ? SegmentMonad::mreturn(s)
+                                          : SegmentMonad::template mempty<std::string>();
+  }
+};
+
+struct strip_prefix {
+  std::string operator()(std::string const& s) const { return s.substr(6); }
+};
+
+template <typename SegmentMonad>
+std::size_t count_errors(std::vector<std::string> const& lines, std::size_t batch_size,
+                         std::size_t capacity = 0)
+{
+  mon::queue_options options;
+  options.batch_size = batch_size;
+  options.capacity = capacity;
+  auto q = (mon::pipeline<SegmentMonad>(SegmentMonad::from_range(lines.begin(), lines.end(), options))
+            >> error_filter<SegmentMonad>()
+            | strip_prefix()).get();
+  std::size_t n = 0;
+  for (std::string s; q->pop(s);)
+    ++n;
+  return n;
+}
+
+struct checksum {
+  unsigned operator()(int i) const
+  {
+    unsigned h = i;
+    for (int k = 0; k < 2000; ++k)
+      h = h * 2654435761u + k;
+    return h;
+  }
+};
+
+std::size_t run_parallel(std::vector<int> const& input, std::size_t workers)
+{
+  mon::queue_options options;
+  options.batch_size = 16;
+  auto q = (mon::pipeline<mon::segment_monad>(
+                mon::segment_monad::from_range(input.begin(), input.end(), options))
+            | mon::parallel(workers, checksum())).get();
+  std::size_t n = 0;
+  for (unsigned r; q->pop(r);)
+    n += r & 1;
+  return n;
+}
+
+// lines of path, counted on the consumer side
+std::size_t read_mapped(std::string const& path)
+{
+  mon::queue_options options;
+  options.batch_size = 64;
+  auto q = mon::from_file<mon::spsc_segment_monad>(path, options);
+  std::size_t n = 0;
+  for (mon::file_record r; q->pop(r);)
+    n += r.size();
+  return n;
+}
+
+std::size_t read_getline(std::string const& path)
+{
+  std::ifstream in(path.c_str());
+  std::vector<std::string> lines;
+  for (std::string s; std::getline(in, s);)
+    lines.push_back(s);
+  mon::queue_options options;
+  options.batch_size = 64;
+  auto q = mon::spsc_segment_monad::from_range(lines.begin(), lines.end(), options);
+  std::size_t n = 0;
+  for (std::string s; q->pop(s);)
+    n += s.size();
+  return n;
+}
+
+template <typename Queue>
+void write_ofstream(std::shared_ptr<Queue> const& q, std::string const& path)
+{
+  std::ofstream out(path.c_str());
+  for (std::string s; q->pop(s);)
+    out << s << '\n';
+}
+
+// an inner queue that a task on `io' fills after a delay, as a read
+// would: 16 elements, 1 ms after it was asked for
+struct slow_source {
+  mon::thread_pool* io;
+  mon::shared_blocking_queue<int> operator()(int i) const
+  {
+    auto q = std::make_shared<mon::blocking_queue<int> >();
+    io->post([q, i]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        for (int k = 0; k < 16; ++k)
+          q->push(i + k);
+        q->close();
+      });
+    return q;
+  }
+};
+
+// the elements of the slow inner queues of input, flattened by mbind
+// with f, concat_map or merge_map
+template <typename F>
+std::size_t run_slow_inner(std::vector<int> const& input, F f)
+{
+  auto q = mon::mbind(mon::segment_monad::from_range(input.begin(), input.end()), f);
+  std::size_t n = 0;
+  for (int x; q->pop(x);)
+    n += x & 1;
+  return n;
+}
+
+// the first 10 errors of lines: with take(10), which cancels the rest of
+// the pipeline, and by popping 10 and draining the others, as a consumer
+// without cancellation has to before the pipeline's threads are free
+std::size_t first_errors(std::vector<std::string> const& lines, bool cancel)
+{
+  mon::queue_options options;
+  options.batch_size = 64;
+  options.capacity = 1024;
+  auto p = mon::pipeline<mon::segment_monad>(mon::segment_monad::from_range(lines.begin(), lines.end(), options))
+           >> error_filter<mon::segment_monad>()
+           | strip_prefix();
+  auto q = cancel ? (std::move(p) || mon::take(10)).get() : std::move(p).get();
+  std::size_t n = 0;
+  std::string s;
+  for (; n < 10 && q->pop(s); ++n)
+    ;
+  while (q->pop(s))
+    ;
+  return n;
+}
+
+struct plus_one {
+  int operator()(int i) const { return i + 1; }
+};
+
+int main(int argc, char** argv)
+{
+  bench::options o = bench::parse_args(argc, argv);
+  bench::header(o);
+
+  std::vector<std::string> lines;
+  for (int i = 0; i < 100000; ++i)
+    lines.push_back(i % 2 ? "Error:  line " + std::to_string(i) : "all right");
+  bench::run_fixed(o, "segment/throughput/blocking/batch/1", lines.size(), [&]() {
+      bench::do_not_optimize(count_errors<mon::segment_monad>(lines, 1));
+    });
+  bench::run_fixed(o, "segment/throughput/blocking/batch/64", lines.size(), [&]() {
+      bench::do_not_optimize(count_errors<mon::segment_monad>(lines, 64));
+    });
+  bench::run_fixed(o, "segment/throughput/blocking/batch/64/bounded", lines.size(), [&]() {
+      bench::do_not_optimize(count_errors<mon::segment_monad>(lines, 64, 1024));
+    });
+  bench::run_fixed(o, "segment/throughput/spsc/batch/1", lines.size(), [&]() {
+      bench::do_not_optimize(count_errors<mon::spsc_segment_monad>(lines, 1));
+    });
+  bench::run_fixed(o, "segment/throughput/spsc/batch/64", lines.size(), [&]() {
+      bench::do_not_optimize(count_errors<mon::spsc_segment_monad>(lines, 64));
+    });
+
+  // the lines above as a 1.5 MB file
+  const std::string path = "/tmp/boost_monads_bench_lines.txt";
+  const std::string copy = "/tmp/boost_monads_bench_copy.txt";
+  {
+    std::ofstream out(path.c_str());
+    for (auto const& s : lines)
+      out << s << '\n';
+  }
+  bench::run_fixed(o, "file/read/mmap", lines.size(), [&]() {
+      bench::do_not_optimize(read_mapped(path));
+    });
+  bench::run_fixed(o, "file/read/getline", lines.size(), [&]() {
+      bench::do_not_optimize(read_getline(path));
+    });
+  mon::queue_options batched;
+  batched.batch_size = 64;
+  bench::run_fixed(o, "file/write/buffered", lines.size(), [&]() {
+      mon::write_to(mon::spsc_segment_monad::from_range(lines.begin(), lines.end(), batched), copy).get();
+    });
+  bench::run_fixed(o, "file/write/ofstream", lines.size(), [&]() {
+      write_ofstream(mon::spsc_segment_monad::from_range(lines.begin(), lines.end(), batched), copy);
+    });
+  std::remove(path.c_str());
+  std::remove(copy.c_str());
+
+  std::vector<int> input(20000);
+  for (std::size_t i = 0; i < input.size(); ++i)
+    input[i] = int(i);
+  bench::run_fixed(o, "segment/parallel/1", input.size(), [&]() {
+      bench::do_not_optimize(run_parallel(input, 1));
+    });
+  const std::size_t cores = std::thread::hardware_concurrency();
+  bench::run_fixed(o, "segment/parallel/cores", input.size(), [&]() {
+      bench::do_not_optimize(run_parallel(input, cores));
+    });
+
+  bench::run_fixed(o, "segment/first 10/take", 10, [&]() {
+      bench::do_not_optimize(first_errors(lines, true));
+    });
+  bench::run_fixed(o, "segment/first 10/drain", 10, [&]() {
+      bench::do_not_optimize(first_errors(lines, false));
+    });
+
+  // flatMap over inner queues that take 1 ms each to fill: one after
+  // the other, and up to 8 at once in input order and as they come
+  mon::thread_pool io(8);
+  std::vector<int> outer(64);
+  for (std::size_t i = 0; i < outer.size(); ++i)
+    outer[i] = int(i);
+  bench::options slow = o;
+  slow.reps = o.reps < 5 ? o.reps : 5;
+  slow.warmup = 1;
+  bench::run_fixed(slow, "segment/flatmap/slow inner/bind", 16 * outer.size(), [&]() {
+      bench::do_not_optimize(run_slow_inner(outer, slow_source{&io}));
+    });
+  bench::run_fixed(slow, "segment/flatmap/slow inner/concat_map/8", 16 * outer.size(), [&]() {
+      bench::do_not_optimize(run_slow_inner(outer, mon::concat_map(8, slow_source{&io})));
+    });
+  bench::run_fixed(slow, "segment/flatmap/slow inner/merge_map/8", 16 * outer.size(), [&]() {
+      bench::do_not_optimize(run_slow_inner(outer, mon::merge_map(8, slow_source{&io})));
+    });
+
+  // one element at a time through two own stages; every sample is a
+  // single round trip, so the percentiles are those of the latency
+  bench::options single = o;
+  single.reps = o.reps * 40;
+  auto source = std::make_shared<mon::blocking_queue<int> >();
+  auto out = (mon::pipeline<mon::segment_monad>(source)
+              | mon::own_stage(plus_one()) | mon::own_stage(plus_one())).get();
+  int value = 0;
+  bench::run_fixed(single, "segment/latency/blocking/2 stages", 1, [&]() {
+      source->push(value);
+      out->pop(value);
+    });
+  source->close();
+  while (out->pop(value))
+    ;
+}
@@ -0,0 +1,90 @@
+#include "benchmark.hpp"
+
+#include <boost/monads/monad.hpp>
+#include <boost/monads/algorithm.hpp>
+#include <boost/monads/pipeline.hpp>
+#include <boost/monads/segment.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+// Placement of a pipeline of four stages over spsc queues, 1M elements
+// in batches of 64 (ns per element): on a pool the OS schedules freely,
+// on one pinned to the cpus of node 0 and one confined to node 0 but not
+// pinned, both with the ring buffers bound to node 0.  With more than one
+// NUMA node, also with the workers on node 0 and the buffers on node 1,
+// the cost of a pipeline whose queues live on the other socket.  On a
+// single node the placed runs should match the unplaced one.
+
+namespace mon = boost::monads;
+
+struct plus_one {
+  int operator()(int i) const { return i + 1; }
+};
+
+long run_stages(std::vector<int> const& input, mon::queue_options options)
+{
+  options.batch_size = 64;
+  options.capacity = 16 * 1024;
+  auto q = (mon::pipeline<mon::spsc_segment_monad>(
+                mon::spsc_segment_monad::from_range(input.begin(), input.end(), options))
+            | mon::own_stage(plus_one()) | mon::own_stage(plus_one())
+            | mon::own_stage(plus_one()) | mon::own_stage(plus_one())).get();
+  long sum = 0;
+  for (int i; q->pop(i);)
+    sum += i;
+  return sum;
+}
+
+int main(int argc, char** argv)
+{
+  bench::options o = bench::parse_args(argc, argv);
+  bench::header(o);
+
+  std::vector<int> input(1000*1000);
+  for (std::size_t i = 0; i < input.size(); ++i)
+    input[i] = int(i);
+
+  // a worker per stage and one for the source, as far as node 0 has cpus
+  auto const& topology = mon::cpu_topology::get();
+  const std::size_t workers = std::min<std::size_t>(5, topology.cpus(0).size());
+
+  {
+    mon::thread_pool pool(workers);
+    mon::queue_options options;
+    options.executor = pool;
+    bench::run_fixed(o, "placement/4 stages/unplaced", input.size(), [&]() {
+        bench::do_not_optimize(run_stages(input, options));
+      });
+  }
+  mon::placement node0;
+  node0.node = 0;
+  {
+    mon::thread_pool pool(workers, node0);
+    bench::run_fixed(o, "placement/4 stages/node 0/pinned", input.size(), [&]() {
+        bench::do_not_optimize(run_stages(input, mon::placed_on(pool)));
+      });
+  }
+  {
+    mon::placement floating = node0;
+    floating.pin_threads = false;
+    mon::thread_pool pool(workers, floating);
+    bench::run_fixed(o, "placement/4 stages/node 0/floating", input.size(), [&]() {
+        bench::do_not_optimize(run_stages(input, mon::placed_on(pool)));
+      });
+  }
+  if (!topology.numa()) {
+    if (!o.json)
+      std::printf("(a single NUMA node: no cross-node runs)\n");
+    return 0;
+  }
+  {
+    mon::thread_pool pool(workers, node0);
+    mon::queue_options options = mon::placed_on(pool);
+    options.numa_node = 1;
+    bench::run_fixed(o, "placement/4 stages/node 0/queues on node 1", input.size(), [&]() {
+        bench::do_not_optimize(run_stages(input, options));
+      });
+  }
+}
@@ -0,0 +1,70 @@
+#include "benchmark.hpp"
+
+#include <boost/monads/queue.hpp>
+
+#include <thread>
+#include <vector>
+
+// Throughput of the segment transports: one producer thread pushes
+// `count' integers, the calling thread pops and sums them; ns per
+// element, per item and in batches of 64.
+
+namespace mon = boost::monads;
+
+template <typename Queue>
+long transfer(long count)
+{
+  Queue q;
+  std::thread producer([&]() {
+      for (long i = 0; i < count; ++i)
+        q.push(i);
+      q.close();
+    });
+  long sum = 0;
+  for (long i; q.pop(i);)
+    sum += i;
+  producer.join();
+  return sum;
+}
+
+template <typename Queue>
+long transfer_batched(long count, std::size_t batch)
+{
+  Queue q;
+  std::thread producer([&]() {
+      std::vector<long> buf(batch);
+      for (long i = 0; i < count;) {
+        std::size_t n = 0;
+        for (; n < batch && i < count; ++n)
+          buf[n] = i++;
+        q.push_n(buf.begin(), n);
+      }
+      q.close();
+    });
+  long sum = 0;
+  std::vector<long> buf(batch);
+  while (std::size_t n = q.pop_batch(buf.begin(), batch))
+    for (std::size_t i = 0; i < n; ++i)
+      sum += buf[i];
+  producer.join();
+  return sum;
+}
+
+int main(int argc, char** argv)
+{
+  bench::options o = bench::parse_args(argc, argv);
+  bench::header(o);
+  const long count = 1000 * 1000;
+  bench::run_fixed(o, "queue/blocking/item", count, [&]() {
+      bench::do_not_optimize(transfer<mon::blocking_queue<long> >(count));
+    });
+  bench::run_fixed(o, "queue/spsc/item", count, [&]() {
+      bench::do_not_optimize(transfer<mon::spsc_queue<long> >(count));
+    });
+  bench::run_fixed(o, "queue/blocking/batch/64", count, [&]() {
+      bench::do_not_optimize(transfer_batched<mon::blocking_queue<long> >(count, 64));
+    });
+  bench::run_fixed(o, "queue/spsc/batch/64", count, [&]() {
+      bench::do_not_optimize(transfer_batched<mon::spsc_queue<long> >(count, 64));
+    });
+}
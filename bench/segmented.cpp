@@ -0,0 +1,118 @@
+#include "benchmark.hpp"
+
+#include <boost/monads/monad.hpp>
+#include <boost/monads/controlmonad.hpp>
+#include <boost/monads/segmented.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <numeric>
+#include <vector>
+
+// Iteration over std::deque (10M elements, ns per element): the standard
+// algorithms against element-wise and span-wise continuations, the
+// latter two also behind type_erased_cont_monad.
+
+namespace mon = boost::monads;
+
+// sum of a[i] * b[i] with independent partial sums, so that the loop
+// vectorizes without -ffast-math
+double dot_kernel(float const* a, float const* b, std::size_t n)
+{
+  double acc[8] = {};
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    for (int j = 0; j < 8; ++j)
+      acc[j] += a[i + j] * b[i + j];
+  double r = 0;
+  for (; i < n; ++i)
+    r += a[i] * b[i];
+  for (int j = 0; j < 8; ++j)
+    r += acc[j];
+  return r;
+}
+
+// runs on_element and on_span through inlined and type erased
+// continuations over c
+template <typename C, typename OnElement, typename OnSpan>
+void compare_shapes(bench::options const& o, std::string const& name, C const& c,
+                    OnElement on_element, OnSpan on_span)
+{
+  typedef typename C::value_type T;
+  mon::type_erased_cont_monad<void, T> erased_elements(
+      mon::make_cont_monad(mon::foreacher(c)));
+  mon::type_erased_cont_monad<void, mon::span<T const> > erased_spans(
+      mon::make_cont_monad(mon::span_foreacher(c)));
+  bench::run_fixed(o, (name + "/element/inlined").c_str(), c.size(),
+                   [&]() { mon::run_cont(mon::foreacher(c), on_element); });
+  bench::run_fixed(o, (name + "/element/erased").c_str(), c.size(),
+                   [&]() { mon::run_cont(erased_elements, on_element); });
+  bench::run_fixed(o, (name + "/span/inlined").c_str(), c.size(),
+                   [&]() { mon::run_cont(mon::span_foreacher(c), on_span); });
+  bench::run_fixed(o, (name + "/span/erased").c_str(), c.size(),
+                   [&]() { mon::run_cont(erased_spans, on_span); });
+}
+
+int main(int argc, char** argv)
+{
+  bench::options o = bench::parse_args(argc, argv);
+  bench::header(o);
+
+  const int size = 10*1000*1000;
+  std::srand(0);
+  std::deque<int> d;
+  for (int i = 0; i < size; ++i)
+    d.push_back(std::rand());
+  std::deque<int> const& cd = d;
+
+  bench::run_fixed(o, "deque/int sum/accumulate", d.size(), [&]() {
+      bench::do_not_optimize(std::accumulate(d.begin(), d.end(), 0u));
+    });
+  bench::run_fixed(o, "deque/int sum/range for", d.size(), [&]() {
+      unsigned sum = 0;
+      for (int i : d)
+        sum += i;
+      bench::do_not_optimize(sum);
+    });
+  bench::run_fixed(o, "deque/int sum/segmented_accumulate", d.size(), [&]() {
+      bench::do_not_optimize(mon::segmented_accumulate(d, 0u));
+    });
+
+  unsigned sum = 0;
+  compare_shapes(o, "deque/int sum", cd,
+                 [&](int i) { sum += i; },
+                 [&](mon::span<int const> s) { sum = std::accumulate(s.begin(), s.end(), sum); });
+  bench::do_not_optimize(sum);
+
+  std::deque<float> a;
+  std::vector<float> b;
+  for (int i = 0; i < size; ++i) {
+    a.push_back(std::rand() / float(RAND_MAX));
+    b.push_back(std::rand() / float(RAND_MAX));
+  }
+  double dot = 0;
+  std::size_t offset = 0;
+  compare_shapes(o, "deque/float dot", a,
+                 [&](float x) {
+                   dot += x * b[offset];
+                   if (++offset == b.size())
+                     offset = 0;
+                 },
+                 [&](mon::span<float const> s) {
+                   if (offset == b.size())
+                     offset = 0;
+                   dot += dot_kernel(s.data(), b.data() + offset, s.size());
+                   offset += s.size();
+                 });
+  bench::do_not_optimize(dot);
+
+  std::deque<char> text;
+  for (int i = 0; i < size; ++i)
+    text.push_back(char(std::rand()));
+  std::size_t lines = 0;
+  compare_shapes(o, "deque/byte scan", text,
+                 [&](char c) { lines += c == '\n'; },
+                 [&](mon::span<char const> s) { lines += std::count(s.begin(), s.end(), '\n'); });
+  bench::do_not_optimize(lines);
+}
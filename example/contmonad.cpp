@@ -1,9 +1,11 @@
 #include <boost/monads/monad.hpp>
 #include <boost/monads/controlmonad.hpp>
 #include <boost/monads/algorithm.hpp>
+#include <boost/monads/trampoline.hpp>
 #include <memory>
 #include <iostream>
 #include <cassert>
+#include <type_traits>
 
 namespace mon = boost::monads;
 
@@ -54,6 +56,51 @@ struct call_cc_test {
   }
 };
 
+// a continuation owning its value, so it can be moved but not copied
+struct owning_cont {
+  std::unique_ptr<int> value;
+  template <typename K>
+  void operator()(K&& k) const { k(*value); }
+};
+
+// a continuation too large for the inline buffer
+struct large_cont {
+  int values[16];
+  template <typename K>
+  void operator()(K&& k) const
+  {
+    int sum = 0;
+    for (int v : values)
+      sum += v;
+    k(sum);
+  }
+};
+
+struct erased_inc {
+  mon::type_erased_cont_monad<void,int> operator()(int i) const
+  {
+    return mon::mreturn<mon::erased_cps<void,int> >(i + 1);
+  }
+};
+
+struct tramp_inc {
+  mon::trampolined_cont_monad<long> operator()(long i) const
+  {
+    return mon::mreturn<mon::trampolined_cps>(i + 1);
+  }
+};
+
+// a loop built while it runs: i >>= count_to >>= count_to ... until n
+struct count_to {
+  long n;
+  mon::trampolined_cont_monad<long> operator()(long i) const
+  {
+    if (i == n)
+      return mon::mreturn<mon::trampolined_cps>(i);
+    return mon::mbind(mon::mreturn<mon::trampolined_cps>(i + 1), *this);
+  }
+};
+
 int main()
 {
   auto inc = [](int i){return mon::mreturn<mon::cps>(i+1);};
@@ -93,4 +140,57 @@ int main()
                                   >>= loud_sqr).unpipe(), printer{});
     std::cout << "---------\n";
   }
+  {
+    typedef mon::type_erased_cont_monad<void,int> erased;
+    int out = 0;
+    auto store = [&](int i) { out = i; };
+    // binding erased monads composes statically around them
+    erased m = mon::mreturn<mon::erased_cps<void,int> >(1);
+    mon::run_cont(mon::mbind(mon::mbind(m, erased_inc{}), inc), store);
+    assert(out == 3);
+    mon::run_cont(((mon::monad_pipe(m) >>= erased_inc{}) >>= erased_inc{}).unpipe(), store);
+    assert(out == 3);
+    // move-only callables go into the move-only unique_cont_monad
+    typedef mon::unique_cont_monad<void,int> unique;
+    static_assert(!std::is_copy_constructible<unique>::value, "unique_cont_monad is move-only");
+    static_assert(std::is_copy_constructible<erased>::value, "type_erased_cont_monad copies");
+    unique owning = owning_cont{std::unique_ptr<int>(new int(7))};
+    unique moved = std::move(owning);
+    assert(!owning && moved);
+    mon::run_cont(moved, store);
+    assert(out == 7);
+    mon::run_cont(std::move(moved).mbind(erased_inc{}), store);
+    assert(out == 8);
+    // large callables live on the heap and are copied as well
+    large_cont big;
+    for (int i = 0; i < 16; ++i)
+      big.values[i] = i;
+    erased large = big;
+    erased copy = large;
+    large = erased();
+    mon::run_cont(copy, store);
+    assert(out == 120);
+  }
+  {
+    // chains far too long for the native stack run on a trampoline,
+    // whether built up front or while running
+    const long n = 300000;
+    mon::trampolined_cont_monad<long> m = mon::mreturn<mon::trampolined_cps>(0L);
+    for (long i = 0; i < n; ++i)
+      m = mon::mbind(m, tramp_inc{});
+    assert(mon::run_cont(m, [](long x) { return x; }) == n);
+    long out = 0;
+    mon::run_cont(mon::mbind(mon::mreturn<mon::trampolined_cps>(0L), count_to{3 * n}),
+                  [&](long x) { out = x; });
+    assert(out == 3 * n);
+    // an ordinary continuation monad as the start of a chain
+    auto lifted = mon::trampolined<long>(mon::mreturn<mon::cps>(41L));
+    assert(mon::run_cont((mon::monad_pipe(lifted) >>= tramp_inc{}).unpipe(),
+                         [](long x) { return x; }) == 42);
+    // a continuation may return a reference, which run_cont passes on
+    long slots[3] = {};
+    long& slot = mon::run_cont(mon::mbind(m, tramp_inc{}),
+                               [&](long x) -> long& { return slots[x - n]; });
+    assert(&slot == &slots[1]);
+  }
 }
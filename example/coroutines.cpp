@@ -0,0 +1,291 @@
+#include <boost/monads/monad.hpp>
+#include <boost/monads/controlmonad.hpp>
+#include <boost/monads/future.hpp>
+#include <boost/monads/segment.hpp>
+#include <boost/monads/coroutine.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cassert>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if defined(BOOST_MONADS_HAS_COROUTINES)
+
+namespace mon = boost::monads;
+
+auto square(int i)
+  -> decltype(mon::mreturn<mon::cps>(i*i))
+{
+  return mon::mreturn<mon::cps>(i*i);
+}
+
+mon::co_cont<int> add_squares(int a, int b)
+{
+  int x = co_await square(a);
+  int y = co_await square(b);
+  co_return x + y;
+}
+
+mon::co_cont<int> nested()
+{
+  int x = co_await add_squares(1, 2);
+  int y = co_await mon::mreturn<mon::erased_cps<void,int> >(10);
+  co_return x + y;
+}
+
+struct escape {
+  template <typename K>
+  auto operator()(K&& k) const
+  {
+    return k(-1);
+  }
+};
+
+mon::co_cont<int> with_call_cc()
+{
+  int x = co_await mon::call_cc(escape{});
+  co_return x;
+}
+
+// far more awaits than the stack could hold as nested continuations
+mon::co_cont<long> count(long n)
+{
+  long sum = 0;
+  for (long i = 0; i < n; ++i)
+    sum += co_await mon::mreturn<mon::cps>(1L);
+  co_return sum;
+}
+
+mon::co_cont<int> throwing()
+{
+  int x = co_await square(2);
+  if (x == 4)
+    throw std::runtime_error("boom");
+  co_return x;
+}
+
+mon::future<int> add(mon::future<int> a, mon::future<int> b)
+{
+  int x = co_await std::move(a);
+  int y = co_await std::move(b);
+  co_return x + y;
+}
+
+mon::future<int> fails(mon::future<int> a)
+{
+  int x = co_await std::move(a);
+  co_return x;
+}
+
+// a stage: doubles every element of in
+mon::shared_spsc_queue<int> doubled(mon::shared_spsc_queue<int> in)
+{
+  auto r = mon::reader(in);
+  while (auto x = co_await r.next())
+    co_yield 2 * *x;
+}
+
+// sets ended when the coroutine's frame goes
+struct set_on_exit {
+  std::atomic<bool>& ended;
+  ~set_on_exit() { ended = true; }
+};
+
+// n, n + 1, ... for the first element n of start, until the output is
+// cancelled; the output gets the options of start, bounded, so the
+// coroutine suspends when it is full
+mon::shared_blocking_queue<int> count_from(mon::shared_blocking_queue<int> start, std::atomic<bool>& ended)
+{
+  set_on_exit guard{ended};
+  auto r = mon::reader(start);
+  auto n = co_await r.next();
+  for (int i = n ? *n : 0;; ++i)
+    co_yield i;
+}
+
+// doubles the elements of in, and throws at the first negative one
+mon::shared_blocking_queue<int> doubled_until_negative(mon::shared_blocking_queue<int> in,
+                                                       std::atomic<bool>& ended)
+{
+  set_on_exit guard{ended};
+  auto r = mon::reader(in);
+  while (auto x = co_await r.next()) {
+    if (*x < 0)
+      throw std::runtime_error("negative");
+    co_yield 2 * *x;
+  }
+}
+
+// runs what is posted to it on the calling thread, when asked, and keeps
+// the exception a task throws
+struct manual_executor {
+  std::deque<std::function<void()> > tasks;
+  std::exception_ptr error;
+
+  void post(std::function<void()> task) { tasks.push_back(std::move(task)); }
+  void run()
+  {
+    while (!tasks.empty()) {
+      std::function<void()> task = std::move(tasks.front());
+      tasks.pop_front();
+      try {
+        task();
+      } catch (...) {
+        error = std::current_exception();
+      }
+    }
+  }
+};
+
+template <typename F>
+bool eventually(F f)
+{
+  for (int i = 0; i < 1000 && !f(); ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  return f();
+}
+
+struct store {
+  int& out;
+  void operator()(int i) const { out = i; }
+};
+
+int main()
+{
+  int out = 0;
+  {
+    mon::run_cont(add_squares(2, 3), store{out});
+    assert(out == 13);
+    mon::run_cont(nested(), store{out});
+    assert(out == 15);
+    mon::run_cont(with_call_cc(), store{out});
+    assert(out == -1);
+    const long n = 1000000;
+    assert(mon::run_cont(count(n), [](long x) { return x; }) == n);
+    // a co_cont binds like any continuation monad
+    auto inc = [](int i) { return mon::mreturn<mon::cps>(i + 1); };
+    mon::run_cont(mon::mbind(add_squares(1, 1), inc), store{out});
+    assert(out == 3);
+    // it runs once
+    auto once = add_squares(1, 1);
+    mon::run_cont(once, store{out});
+    bool threw = false;
+    try {
+      mon::run_cont(once, store{out});
+    } catch (std::logic_error const&) {
+      threw = true;
+    }
+    assert(threw);
+    threw = false;
+    try {
+      mon::run_cont(throwing(), store{out});
+    } catch (std::runtime_error const&) {
+      threw = true;
+    }
+    assert(threw);
+  }
+  {
+    // ready futures run through, pending ones suspend the coroutine
+    assert(add(mon::make_ready_future(1), mon::make_ready_future(2)).get() == 3);
+    mon::promise<int> a, b;
+    auto f = add(a.get_future(), b.get_future());
+    assert(!f.is_ready());
+    a.set_value(20);
+    assert(!f.is_ready());
+    std::thread t([&]() { b.set_value(22); });
+    assert(f.get() == 42);
+    t.join();
+    mon::promise<int> broken;
+    auto g = fails(broken.get_future());
+    broken.set_exception(std::make_exception_ptr(std::runtime_error("boom")));
+    bool threw = false;
+    try {
+      g.get();
+    } catch (std::runtime_error const&) {
+      threw = true;
+    }
+    assert(threw);
+  }
+  {
+    // a stage with small queues, so it waits on both sides
+    std::vector<int> v(10000);
+    for (int i = 0; i < int(v.size()); ++i)
+      v[i] = i;
+    mon::queue_options options;
+    options.capacity = 16;
+    options.batch_size = 4;
+    auto out = doubled(mon::spsc_segment_monad::from_range(v.begin(), v.end(), options));
+    long sum = 0;
+    int count = 0;
+    for (int x; out->pop(x); ++count)
+      sum += x;
+    assert(count == 10000);
+    assert(sum == 2L * 9999 * 10000 / 2);
+    // and as a function to bind
+    auto q = mon::mbind(mon::segment_monad::from_range(v.begin(), v.begin() + 100),
+                        [](int x) -> mon::shared_blocking_queue<int> { co_yield x; co_yield -x; });
+    sum = 0;
+    count = 0;
+    for (int x; q->pop(x); ++count)
+      sum += x;
+    assert(count == 200);
+    assert(sum == 0);
+  }
+  {
+    // take(n) cancels the queue of an endless coroutine, which ends at
+    // its next co_yield, and a stage's input along with its output
+    std::atomic<bool> ended(false);
+    mon::queue_options bounded;
+    bounded.capacity = 16;
+    std::vector<int> start(1, 7);
+    auto five = mon::take(5)(count_from(mon::segment_monad::from_range(start.begin(), start.end(), bounded), ended));
+    std::vector<int> got;
+    for (int x; five->pop(x);)
+      got.push_back(x);
+    assert((got == std::vector<int>{7, 8, 9, 10, 11}));
+    assert(eventually([&]() { return bool(ended); }));
+    std::vector<int> v(10000);
+    auto source = mon::spsc_segment_monad::from_range(v.begin(), v.end(), bounded);
+    auto three = mon::take(3)(doubled(source));
+    int count = 0;
+    for (int x; three->pop(x);)
+      ++count;
+    assert(count == 3);
+    assert(source->cancelled());
+  }
+  {
+    // a stage that throws ends: its output is closed after what it
+    // yielded, its frame and its input go, and the exception reaches the
+    // executor.  This one keeps it; on default_executor() it would
+    // terminate the process, since thread_pool does not catch.
+    manual_executor ex;
+    mon::queue_options options;
+    options.executor = ex;
+    std::vector<int> v = {1, 2, -1, 4};
+    std::atomic<bool> ended(false);
+    auto source = mon::segment_monad::from_range(v.begin(), v.end(), options);
+    std::weak_ptr<mon::blocking_queue<int> > weak_source = source;
+    auto out = doubled_until_negative(std::move(source), ended);
+    ex.run();
+    assert(ex.error && ended && weak_source.expired());
+    std::vector<int> got;
+    for (int x; out->pop(x);)
+      got.push_back(x);
+    assert((got == std::vector<int>{2, 4}));
+  }
+}
+
+#else
+
+int main()
+{
+  std::cout << "no coroutines\n";
+}
+
+#endif
@@ -1,115 +1,193 @@
 #include <boost/monads/monad.hpp>
 #include <boost/monads/controlmonad.hpp>
+#include <boost/monads/segmented.hpp>
 
 #include <cassert>
+#include <algorithm>
 #include <numeric>
-#include <iostream>
-#include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <deque>
+#include <iterator>
+#include <list>
+#include <vector>
 
-// this only works with stdlibc++
+namespace mon = boost::monads;
 
+// A user-defined chunked container takes part in segmented iteration by
+// providing boost_for_each_segment, found via ADL.
+namespace demo {
 template <typename T>
-struct deque_foreacher {
-  std::deque<T>& deq;
+struct chunked {
+  std::vector<std::vector<T> > chunks;
+};
 
-  template <typename K>
-  void operator()(K&& k) const {
-    using namespace std;
+template <typename T, typename K>
+void boost_for_each_segment(chunked<T> const& c, K& k)
+{
+  for (auto const& chunk : c.chunks)
+    k(chunk.data(), chunk.data() + chunk.size());
+}
+}
 
-    _Deque_iterator<T, const T&, const T*> __first = deq.begin();
-    _Deque_iterator<T, const T&, const T*> __last = deq.end();
-    
-    typedef typename _Deque_iterator<T, T&, T*>::_Self _Self;
-    typedef typename _Self::difference_type difference_type;
-    
-    difference_type __len = __last - __first;
-    while (__len > 0) {
-      const difference_type __clen = __first._M_last - __first._M_cur;
-      for (auto* segment_first = __first._M_cur, 
-               * segment_last  = __first._M_last;
-           segment_first != segment_last; ++segment_first) {
-        k(*segment_first);
-      }
-      __first += __clen;
-      __len -= __clen;
-    }
-  }
-};
+// Element-wise and span-wise continuations, inlined and behind
+// type_erased_cont_monad, compute the same thing; check() is called
+// after each.  Timings: bench/segmented.cpp.
+template <typename C, typename OnElement, typename OnSpan, typename Check>
+void check_shapes(C const& c, OnElement on_element, OnSpan on_span, Check check)
+{
+  typedef typename C::value_type T;
+  mon::type_erased_cont_monad<void, T> erased_elements(
+      mon::make_cont_monad(mon::foreacher(c)));
+  mon::type_erased_cont_monad<void, mon::span<T const> > erased_spans(
+      mon::make_cont_monad(mon::span_foreacher(c)));
+  mon::run_cont(mon::foreacher(c), on_element);
+  check();
+  mon::run_cont(erased_elements, on_element);
+  check();
+  mon::run_cont(mon::span_foreacher(c), on_span);
+  check();
+  mon::run_cont(erased_spans, on_span);
+  check();
+}
 
-template <typename F>
-void time_call(const char* msg, F&& f)
+// sum of a[i] * b[i] with independent partial sums, so that the loop
+// vectorizes without -ffast-math
+double dot_kernel(float const* a, float const* b, std::size_t n)
 {
-  using namespace std::chrono;
-  auto start = high_resolution_clock::now();
-  f();
-  auto end = high_resolution_clock::now();
-  std::cout << msg << ": "
-            << duration_cast<nanoseconds>(end - start).count()
-            << "ns\n";
+  double acc[8] = {};
+  std::size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    for (int j = 0; j < 8; ++j)
+      acc[j] += a[i + j] * b[i + j];
+  double r = 0;
+  for (; i < n; ++i)
+    r += a[i] * b[i];
+  for (int j = 0; j < 8; ++j)
+    r += acc[j];
+  return r;
 }
 
 int main()
 {
   std::deque<int> d;
-  const int size = 10*1000*1000;
+  const int size = 1000*1000;
   srand(0);
   for (int i=0; i<size; ++i)
     d.push_back(rand());
 
-  int master_sum = std::accumulate(d.begin(), d.end(), 0);
-  for (int i=0; i<10; ++i) {
-    time_call("accumulate  ", [&]() {
-        int sum=std::accumulate(d.begin(), d.end(), 0);
-        assert(sum == master_sum);
-      });
-  
-    time_call("foreach loop", [&]() {
-        int sum=0;
-        for (int i : d)
-          sum += i;
-        assert(sum == master_sum);
-      });
-    time_call("continuation", [&]() {
-        int sum=0;
-        boost::monads::run_cont(deque_foreacher<int>{d},
-                                [&](int i){sum += i;});
-        assert(sum == master_sum);
+  // the continuation walks the deque node by node
+  unsigned master_sum = std::accumulate(d.begin(), d.end(), 0u);
+  {
+    unsigned sum=0;
+    mon::run_cont(mon::foreacher(d), [&](int i){sum += i;});
+    assert(sum == master_sum);
+    assert(mon::segmented_accumulate(d, 0u) == master_sum);
+  }
+
+  // the other segmented algorithms agree with their standard versions
+  auto odd = [](int i) { return i % 2 != 0; };
+  assert(mon::segmented_count_if(d, odd)
+         == std::size_t(std::count_if(d.begin(), d.end(), odd)));
+  std::vector<int> copy;
+  mon::segmented_copy(d, std::back_inserter(copy));
+  assert(std::equal(copy.begin(), copy.end(), d.begin()));
+  long n = 0;
+  mon::segmented_for_each(d, [&](int) { ++n; });
+  assert(n == size);
+
+  {
+    // a sub-range that ends in the middle of a node
+    std::deque<int> small(d.begin(), d.begin() + 1000);
+    assert(mon::segmented_accumulate(small, 0L)
+           == std::accumulate(small.begin(), small.end(), 0L));
+  }
+  {
+    demo::chunked<int> c;
+    c.chunks = {{1, 2, 3}, {}, {4, 5}};
+    assert(mon::segmented_accumulate(c, 0) == 15);
+  }
+  {
+    // a queue is consumed batch by batch
+    mon::blocking_queue<int> q;
+    for (int i = 1; i <= 100; ++i)
+      q.push(i);
+    q.close();
+    assert(mon::segmented_accumulate(q, 0) == 5050);
+  }
+  {
+    std::vector<int> v = {1, 2, 3};
+    assert(mon::segmented_count_if(v, odd) == 2);
+    // spans of a vector point into it; other ranges are copied in chunks
+    int const* first = nullptr;
+    mon::run_cont(mon::span_foreacher(v), [&](mon::span<int const> s) { first = s.data(); });
+    assert(first == v.data());
+    std::list<int> l(1000, 1);
+    std::size_t spans = 0;
+    mon::run_cont(mon::span_foreacher(l), [&](mon::span<int const> s) {
+        ++spans;
+        assert(std::accumulate(s.begin(), s.end(), 0) == int(s.size()));
       });
+    assert(spans == 4);
   }
-}
 
-/*
-Just for reference, here's the output using g++ (GCC) 4.8.2:
+  {
+    // a node-based container, in spans of copied elements
+    std::list<int> l(d.begin(), d.begin() + 10000);
+    const long expected = std::accumulate(l.begin(), l.end(), 0L);
+    long sum = 0;
+    check_shapes(l,
+                 [&](int i) { sum += i; },
+                 [&](mon::span<int const> s) {
+                   sum = std::accumulate(s.begin(), s.end(), sum);
+                 },
+                 [&]() { assert(sum == expected); sum = 0; });
+  }
 
-accumulate  : 5354118ns
-foreach loop: 5601285ns
-continuation: 3022173ns
-accumulate  : 5320084ns
-foreach loop: 5016697ns
-continuation: 2909400ns
-accumulate  : 5995062ns
-foreach loop: 5032623ns
-continuation: 2653683ns
-accumulate  : 5520358ns
-foreach loop: 4975916ns
-continuation: 2628977ns
-accumulate  : 5308461ns
-foreach loop: 4991878ns
-continuation: 2617513ns
-accumulate  : 5769553ns
-foreach loop: 5339515ns
-continuation: 2820368ns
-accumulate  : 5769728ns
-foreach loop: 5011447ns
-continuation: 2658527ns
-accumulate  : 5393961ns
-foreach loop: 5000950ns
-continuation: 2642141ns
-accumulate  : 5316114ns
-foreach loop: 4966526ns
-continuation: 2665640ns
-accumulate  : 6192621ns
-foreach loop: 4972837ns
-continuation: 2622478ns
- */
+  std::deque<int> const& cd = d;
+  {
+    unsigned sum = 0;
+    check_shapes(cd,
+                 [&](int i) { sum += i; },
+                 [&](mon::span<int const> s) {
+                   sum = std::accumulate(s.begin(), s.end(), sum);
+                 },
+                 [&]() { assert(sum == master_sum); sum = 0; });
+  }
+  {
+    std::deque<float> a;
+    std::vector<float> b;
+    for (int i=0; i<size; ++i) {
+      a.push_back(rand() / float(RAND_MAX));
+      b.push_back(rand() / float(RAND_MAX));
+    }
+    double dot = 0, expected = 0;
+    std::size_t offset = 0;
+    for (std::size_t i=0; i<b.size(); ++i)
+      expected += a[i] * b[i];
+    check_shapes(a,
+                 [&](float x) { dot += x * b[offset++]; },
+                 [&](mon::span<float const> s) {
+                   dot += dot_kernel(s.data(), b.data() + offset, s.size());
+                   offset += s.size();
+                 },
+                 [&]() {
+                   assert(std::abs(dot - expected) < 1e-6 * expected);
+                   dot = 0;
+                   offset = 0;
+                 });
+  }
+  {
+    std::deque<char> text;
+    for (int i=0; i<size; ++i)
+      text.push_back(char(rand()));
+    std::size_t lines = 0;
+    const std::size_t expected = std::count(text.begin(), text.end(), '\n');
+    check_shapes(text,
+                 [&](char c) { lines += c == '\n'; },
+                 [&](mon::span<char const> s) {
+                   lines += std::count(s.begin(), s.end(), '\n');
+                 },
+                 [&]() { assert(lines == expected); lines = 0; });
+  }
+}
@@ -0,0 +1,129 @@
+#include <boost/monads/monad.hpp>
+#include <boost/monads/pipeline.hpp>
+#include <boost/monads/segment.hpp>
+#include <boost/monads/file.hpp>
+
+#include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+namespace mon = boost::monads;
+using mon::file_record;
+using mon::segment_monad;
+using mon::spsc_segment_monad;
+
+std::string temp_path(const char* name)
+{
+    return "/tmp/boost_monads_" + std::to_string(::getpid()) + "_" + name;
+}
+
+std::string read_all(std::string const& path)
+{
+    std::ifstream in(path.c_str(), std::ios::binary);
+    std::ostringstream s;
+    s << in.rdbuf();
+    return s.str();
+}
+
+// keeps the error lines, as views into the input file
+template <typename SegmentMonad>
+struct errors_only {
+    typedef decltype(SegmentMonad::template mempty<file_record>()) queue_type;
+    queue_type operator()(file_record&& line) const
+    {
+        return line.size() >= 6 && std::string(line.data(), 6) == "Error:"
+            ? SegmentMonad::mreturn(std::move(line))
+            : SegmentMonad::template mempty<file_record>();
+    }
+};
+
+template <typename SegmentMonad>
+void filter_file(std::size_t batch_size, std::size_t buffer_size)
+{
+    const std::string in = temp_path("log.txt"), out = temp_path("errors.txt");
+    std::string input, expected;
+    for (int i = 0; i < 10000; ++i) {
+        const std::string line = (i % 3 ? "ok " : "Error: ") + std::to_string(i);
+        input += line + '\n';
+        if (i % 3 == 0)
+            expected += line + '\n';
+    }
+    std::ofstream(in.c_str()) << input;
+
+    mon::queue_options options;
+    options.batch_size = batch_size;
+    mon::file_sink_options sink;
+    sink.buffer_size = buffer_size;
+    auto q = (mon::pipeline<SegmentMonad>(mon::from_file<SegmentMonad>(in, options))
+              >> errors_only<SegmentMonad>()).get();
+    assert(mon::write_to(q, out, sink).get() == expected.size());
+    assert(read_all(out) == expected);
+    std::remove(in.c_str());
+    std::remove(out.c_str());
+}
+
+int main()
+{
+    filter_file<segment_monad>(1, 1);
+    filter_file<segment_monad>(64, 4096);
+    filter_file<spsc_segment_monad>(64, 1 << 20);
+
+    const std::string path = temp_path("records.txt");
+    {
+        // fixed-size records, the last one short; no trailing newline
+        std::ofstream(path.c_str()) << "aaaabbbbcc";
+        auto q = mon::from_file_records<segment_monad>(path, 4);
+        std::vector<file_record> records;
+        for (file_record r; q->pop(r);)
+            records.push_back(r);
+        assert(records.size() == 3);
+        assert(records[0] == "aaaa" && records[1] == "bbbb" && records[2] == "cc");
+        // the records keep the mapping alive after the file is gone
+        std::remove(path.c_str());
+        assert(records[1].str() == "bbbb");
+        assert(records[0].file() == records[2].file());
+    }
+    {
+        // lines without the delimiter, a last one without a newline too
+        std::ofstream(path.c_str()) << "one\n\nthree";
+        auto q = mon::from_file<segment_monad>(path);
+        std::vector<std::string> lines;
+        for (file_record r; q->pop(r);)
+            lines.push_back(r.str());
+        assert((lines == std::vector<std::string>{"one", "", "three"}));
+        std::ofstream(path.c_str(), std::ios::trunc);
+        auto empty = mon::from_file<segment_monad>(path);
+        file_record r;
+        assert(!empty->pop(r));
+        std::remove(path.c_str());
+    }
+    {
+        bool threw = false;
+        try {
+            mon::from_file<segment_monad>(temp_path("missing"));
+        } catch (std::system_error const&) {
+            threw = true;
+        }
+        assert(threw);
+        // numbers are written as text, errors arrive through the future
+        std::vector<int> v = {1, 2, 3};
+        mon::file_sink_options csv;
+        csv.separator = ",";
+        assert(mon::write_to(segment_monad::from_range(v.begin(), v.end()), path, csv).get() == 6);
+        assert(read_all(path) == "1,2,3,");
+        std::remove(path.c_str());
+        threw = false;
+        try {
+            mon::write_to(segment_monad::from_range(v.begin(), v.end()), -1).get();
+        } catch (std::system_error const&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+}
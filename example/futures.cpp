@@ -0,0 +1,134 @@
+#include <boost/monads/monad.hpp>
+#include <boost/monads/algorithm.hpp>
+#include <boost/monads/future.hpp>
+
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+
+namespace mon = boost::monads;
+
+// count heap allocations to check the cost of a bind chain
+static std::atomic<long> allocations(0);
+
+void* operator new(std::size_t n)
+{
+  ++allocations;
+  if (void* p = std::malloc(n ? n : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+int main()
+{
+  auto inc = [](int i) { return mon::mreturn<mon::future_monad>(i + 1); };
+  {
+    // ready fast path: the whole chain runs while it is built
+    auto f = mon::mbind(mon::mreturn<mon::future_monad>(1), inc);
+    assert(f.is_ready());
+    assert(f.get() == 2);
+  }
+  {
+    // continuations run when the value arrives
+    mon::promise<int> p;
+    auto f = p.get_future().then([](int i) { return i * 2; });
+    assert(!f.is_ready());
+    p.set_value(21);
+    assert(f.get() == 42);
+  }
+  {
+    // one bind state per step; inc allocates one ready future
+    const int n = 1000;
+    mon::promise<int> p;
+    mon::future<int> f = p.get_future();
+    long before = allocations;
+    for (int i = 0; i < n; ++i)
+      f = mon::mbind(std::move(f), inc);
+    assert(allocations - before == n);
+    p.set_value(0);
+    assert(allocations - before == 2 * n);
+    assert(f.get() == n);
+  }
+  {
+    // exceptions skip the remaining steps
+    auto f = mon::mbind(mon::mreturn<mon::future_monad>(1),
+                        [](int) -> mon::future<int> { throw std::runtime_error("boom"); });
+    bool caught = false;
+    try {
+      mon::mbind(std::move(f), inc).get();
+    } catch (std::runtime_error const&) {
+      caught = true;
+    }
+    assert(caught);
+  }
+  {
+    auto f = mon::async(mon::default_executor(), []() { return 20; })
+               .then(mon::default_executor(), [](int i) { return i + 1; });
+    assert(mon::mbind(std::move(f), inc).get() == 22);
+  }
+  {
+    // a continuation that returns nothing gives a future<void>
+    int seen = 0;
+    mon::future<void> f = mon::make_ready_future(1).then([&](int i) { seen = i; });
+    assert(f.is_ready());
+    f.get();
+    assert(seen == 1);
+
+    mon::promise<void> p;
+    mon::future<int> g = p.get_future().then([&]() { return seen + 1; });
+    assert(!g.is_ready());
+    p.set_value();
+    assert(g.get() == 2);
+
+    auto h = mon::async(mon::default_executor(), [&]() { seen = 3; })
+               .then(mon::default_executor(), [&]() { return seen; });
+    assert(h.get() == 3);
+    mon::make_ready_future().get();
+  }
+  {
+    // f returning a future without a state ends the bind with no_state
+    auto f = mon::mbind(mon::make_ready_future(1), [](int) { return mon::future<int>(); });
+    assert(f.is_ready());
+    bool no_state = false;
+    try {
+      f.get();
+    } catch (std::future_error const& e) {
+      no_state = e.code() == std::future_errc::no_state;
+    }
+    assert(no_state);
+  }
+  {
+    // a promise is satisfied once
+    mon::promise<int> p;
+    mon::future<int> f = p.get_future();
+    p.set_value(1);
+    bool satisfied = false;
+    try {
+      p.set_exception(std::make_exception_ptr(std::runtime_error("late")));
+    } catch (std::future_error const& e) {
+      satisfied = e.code() == std::future_errc::promise_already_satisfied;
+    }
+    assert(satisfied);
+    assert(f.get() == 1);
+  }
+  {
+    mon::future<int> f;
+    {
+      mon::promise<int> p;
+      f = p.get_future();
+    }
+    bool broken = false;
+    try {
+      f.get();
+    } catch (std::future_error const&) {
+      broken = true;
+    }
+    assert(broken);
+  }
+  std::cout << "ok\n";
+}
@@ -0,0 +1,119 @@
+#include <boost/monads/monad.hpp>
+#include <boost/monads/controlmonad.hpp>
+#include <boost/monads/algorithm.hpp>
+#include <boost/monads/optional.hpp>
+#include <boost/monads/lazy.hpp>
+
+#include <cassert>
+#include <type_traits>
+
+namespace mon = boost::monads;
+
+typedef decltype(mon::mreturn<mon::cps>(0)) cps_int;
+
+struct inc {
+  cps_int operator()(int i) const { return mon::mreturn<mon::cps>(i + 1); }
+};
+
+// returns its monad unbuilt, so a chain of them folds into one mreturn
+struct lazy_inc {
+  auto operator()(int i) const -> decltype(mon::lazy_return<mon::cps>(i + 1))
+  {
+    return mon::lazy_return<mon::cps>(i + 1);
+  }
+};
+
+struct plus_one {
+  int* calls;
+  int operator()(int i) const { ++*calls; return i + 1; }
+};
+
+struct twice {
+  int operator()(int i) const { return 2 * i; }
+};
+
+struct half {
+  boost::optional<int> operator()(int i) const
+  {
+    if (i % 2)
+      return boost::none;
+    return boost::optional<int>(i / 2);
+  }
+};
+
+struct store {
+  int& out;
+  void operator()(int i) const { out = i; }
+};
+
+int main()
+{
+  int out = 0;
+  {
+    // the same results as binding right away
+    auto eager = (((mon::monad_pipe(mon::mreturn<mon::cps>(1)) >>= inc{}) >>= inc{}) >>= inc{}).unpipe();
+    auto lazy = (((mon::lazy_return<mon::cps>(1) >>= inc{}) >>= inc{}) >>= inc{}).unpipe();
+    mon::run_cont(eager, store{out});
+    assert(out == 4);
+    out = 0;
+    mon::run_cont(lazy, store{out});
+    assert(out == 4);
+    // starting from a built monad
+    auto from = ((mon::lazy_pipe<mon::cps>(mon::mreturn<mon::cps>(1)) >>= inc{}) >>= inc{}).unpipe();
+    mon::run_cont(from, store{out});
+    assert(out == 3);
+  }
+  {
+    // mreturns all the way through leave a single apply_cps
+    auto m = (((mon::lazy_return<mon::cps>(1) >>= lazy_inc{}) >>= lazy_inc{}) >>= lazy_inc{}).unpipe();
+    static_assert(std::is_same<decltype(m), cps_int>::value, "chain folded");
+    mon::run_cont(m, store{out});
+    assert(out == 4);
+    // also behind a built monad, inside the one bind that is left
+    auto n = ((mon::lazy_pipe<mon::cps>(mon::mreturn<mon::cps>(1)) >>= lazy_inc{}) >>= lazy_inc{}).unpipe();
+    mon::run_cont(n, store{out});
+    assert(out == 3);
+  }
+  {
+    // fmaps fuse, and fold into mreturn
+    int calls = 0;
+    auto m = mon::fmap<mon::cps>(mon::fmap<mon::cps>(mon::lazy_return<mon::cps>(1), plus_one{&calls}),
+                                 twice{}).unpipe();
+    static_assert(std::is_same<decltype(m), cps_int>::value, "fmaps folded");
+    mon::run_cont(m, store{out});
+    assert(out == 4);
+    assert(calls == 1);
+    // over a built monad, a single bind runs both functions
+    auto n = mon::fmap<mon::cps>(mon::fmap<mon::cps>(mon::lazy_pipe<mon::cps>(mon::mreturn<mon::cps>(3)),
+                                                     plus_one{&calls}), twice{}).unpipe();
+    mon::run_cont(n, store{out});
+    assert(out == 8);
+    assert(calls == 2);
+    // fmap followed by bind, and bind followed by fmap
+    auto b = (mon::fmap<mon::cps>(mon::lazy_return<mon::cps>(1), twice{}) >>= inc{}).unpipe();
+    mon::run_cont(b, store{out});
+    assert(out == 3);
+    auto f = mon::fmap<mon::cps>(mon::lazy_return<mon::cps>(1) >>= lazy_inc{}, twice{}).unpipe();
+    static_assert(std::is_same<decltype(f), cps_int>::value, "bind and fmap folded");
+    mon::run_cont(f, store{out});
+    assert(out == 4);
+  }
+  {
+    // join of mreturn is the inner monad
+    auto j = mon::join(mon::lazy_return<mon::cps>(mon::mreturn<mon::cps>(5))).unpipe();
+    static_assert(std::is_same<decltype(j), cps_int>::value, "join folded");
+    mon::run_cont(j, store{out});
+    assert(out == 5);
+    auto k = (mon::join(mon::lazy_return<mon::cps>(mon::mreturn<mon::cps>(5))) >>= inc{}).unpipe();
+    mon::run_cont(k, store{out});
+    assert(out == 6);
+  }
+  {
+    // other monads: Maybe
+    typedef boost::optional<int> maybe;
+    assert(*((mon::lazy_return<maybe>(8) >>= half{}) >>= half{}).unpipe() == 2);
+    assert(!(((mon::lazy_return<maybe>(4) >>= half{}) >>= half{}) >>= half{}).unpipe());
+    assert(*mon::fmap<maybe>(mon::lazy_pipe<maybe>(maybe(3)), twice{}).unpipe() == 6);
+    assert(!mon::fmap<maybe>(mon::lazy_pipe<maybe>(maybe()), twice{}).unpipe());
+  }
+}
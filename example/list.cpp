@@ -0,0 +1,94 @@
+#include <boost/monads/monad.hpp>
+#include <boost/monads/algorithm.hpp>
+#include <boost/monads/list.hpp>
+
+#include <cassert>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mon = boost::monads;
+using mon::list_monad;
+
+typedef std::vector<int> ints;
+
+// counts its copies, to check that elements are moved
+struct counted {
+  static int copies;
+  std::string s;
+
+  counted(std::string s) : s(std::move(s)) {}
+  counted(counted const& other) : s(other.s) { ++copies; }
+  counted(counted&&) = default;
+  counted& operator=(counted const& other) { s = other.s; ++copies; return *this; }
+  counted& operator=(counted&&) = default;
+};
+int counted::copies = 0;
+
+struct twice {
+  ints operator()(int i) const { return ints{i, i}; }
+};
+
+struct evens {
+  mon::list_single<int> operator()(int i) const
+  {
+    return i % 2 ? list_monad::mempty<int>() : list_monad::mreturn(i);
+  }
+};
+
+int main()
+{
+  {
+    // flatMap
+    ints v = {1, 2, 3};
+    assert((mon::mbind(v, twice()) == ints{1, 1, 2, 2, 3, 3}));
+    assert((v == ints{1, 2, 3}));
+    assert((mon::mbind(v, [](int i) { return ints(i - 1, i); }) == ints{2, 3, 3}));
+    assert(mon::mbind(ints(), twice()).empty());
+    // filter: at most one element each, reserved for all of them
+    auto e = mon::mbind(ints{1, 2, 3, 4, 5, 6}, evens());
+    assert((e == ints{2, 4, 6}));
+    assert(e.capacity() == 6);
+    // a list_single binds too
+    assert(mon::mbind(list_monad::mreturn(3), twice()).size() == 2);
+    assert(mon::mbind(list_monad::mempty<int>(), twice()).empty());
+  }
+  {
+    // size hints reserve the result once
+    ints v = {1, 2, 3, 4};
+    auto r = mon::mbind(v, mon::with_size_hint(twice(), 2));
+    assert(r.size() == 8 && r.capacity() == 8);
+    auto s = mon::mbind(v, mon::with_size_hint([](int i) { return ints(i, i); }, [](int i) { return i; }));
+    assert(s.size() == 10 && s.capacity() == 10);
+    // fmap, without a vector per element
+    auto f = mon::fmap<std::vector<std::string> >(v, [](int i) { return std::to_string(i); });
+    assert((f == std::vector<std::string>{"1", "2", "3", "4"}));
+    assert(f.capacity() == 4);
+  }
+  {
+    // join moves the inner elements out of a temporary, copies them from an lvalue
+    std::vector<std::vector<counted> > nested(3, std::vector<counted>(2, counted("x")));
+    counted::copies = 0;
+    auto copied = mon::join(nested);
+    assert(copied.size() == 6 && copied.capacity() == 6);
+    assert(counted::copies == 6);
+    counted::copies = 0;
+    auto moved = mon::join(std::move(nested));
+    assert(moved.size() == 6 && moved[5].s == "x");
+    assert(counted::copies == 0);
+    // the elements of a temporary are moved into f
+    counted::copies = 0;
+    auto passed = mon::mbind(std::move(moved), [](counted&& c) { return list_monad::mreturn(std::move(c)); });
+    assert(passed.size() == 6 && counted::copies == 0);
+  }
+  {
+    // monad laws
+    auto ret = [](int i) { return mon::mreturn<ints>(i); };
+    ints v = {1, 2, 3};
+    assert((mon::mbind(mon::mreturn<ints>(5), twice()) == twice()(5)));
+    assert((mon::mbind(v, ret) == v));
+    auto twice_then_twice = [](int i) { return mon::mbind(twice()(i), twice()); };
+    assert((mon::mbind(mon::mbind(v, twice()), twice()) == mon::mbind(v, twice_then_twice)));
+    assert((((mon::monad_pipe(v) >>= twice()) >>= evens()).unpipe() == ints{2, 2}));
+  }
+}
@@ -0,0 +1,110 @@
+// per-stage counters are compiled in on request only
+#define BOOST_MONADS_ENABLE_METRICS
+
+#include <boost/monads/monad.hpp>
+#include <boost/monads/algorithm.hpp>
+#include <boost/monads/pipeline.hpp>
+#include <boost/monads/segment.hpp>
+
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace mon = boost::monads;
+
+struct plus_one {
+    int operator()(int i) const { return i + 1; }
+};
+
+struct twice {
+    long operator()(int i) const { return 2L * i; }
+};
+
+// source -> bind -> parallel -> consumer in main, with a consumer that
+// starts late, so that the last stage waits for room in its output
+template <typename SegmentMonad>
+void run_instrumented(const char* name)
+{
+    const int n = 10000;
+    std::vector<int> input(n);
+    for (int i = 0; i < n; ++i)
+        input[i] = i;
+    mon::queue_options options;
+    options.batch_size = 8;
+    options.capacity = 16;
+    options.metrics = std::make_shared<mon::pipeline_metrics>();
+    auto p = mon::pipeline<SegmentMonad>(SegmentMonad::from_range(input.begin(), input.end(), options))
+        | mon::own_stage(plus_one());
+    assert(p.metrics() == options.metrics);
+    auto q = (std::move(p) | mon::parallel(2, twice())).get();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    long sum = 0;
+    for (long x; q->pop(x);)
+        sum += x;
+    assert(sum == long(n) * (n + 1));
+
+    mon::pipeline_snapshot s = options.metrics->snapshot();
+    std::cout << name << ":\n" << s;
+    // one queue per stage, every element went through each of them
+    assert(s.queues.size() == 3);
+    for (auto const& qs : s.queues) {
+        assert(qs.items_in == std::uint64_t(n) && qs.items_out == std::uint64_t(n));
+        assert(qs.depth == 0);
+        assert(qs.peak_depth > 0 && qs.peak_depth <= options.capacity);
+    }
+    assert(s.queues.back().producer_blocked_ns >= 1000 * 1000);
+    assert(s.stages.size() == 3);
+    assert(s.stages[0].kind == std::string("source") && s.stages[0].input == 0);
+    assert(s.stages[1].kind == std::string("bind"));
+    assert(s.stages[2].kind == std::string("parallel"));
+    for (std::size_t i = 0; i < s.stages.size(); ++i) {
+        assert(s.stages[i].output == s.queues[i].id);
+        assert(s.stages[i].items_out == std::uint64_t(n));
+        assert(s.stages[i].busy_ns > 0);
+        if (i)
+            assert(s.stages[i].input == s.queues[i - 1].id && s.stages[i].items_in == std::uint64_t(n));
+    }
+
+    // once the pipeline is gone, prune() drops its counters
+    const std::size_t last = s.queues.back().id;
+    q.reset();
+    for (int i = 0; i < 1000 && !s.queues.empty(); ++i) {
+        options.metrics->prune();
+        s = options.metrics->snapshot();
+        if (!s.queues.empty())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    assert(s.queues.empty() && s.stages.empty());
+    auto again = std::make_shared<mon::blocking_queue<int> >();
+    again->set_options(options);
+    assert(options.metrics->snapshot().queues.at(0).id == last + 1);
+}
+
+int main()
+{
+  static_assert(mon::pipeline_metrics::enabled, "BOOST_MONADS_ENABLE_METRICS is defined above");
+  run_instrumented<mon::segment_monad>("segment_monad");
+  run_instrumented<mon::spsc_segment_monad>("spsc_segment_monad");
+  {
+      // a thread blocked in pop counts as waiting consumer
+      mon::queue_options options;
+      options.metrics = std::make_shared<mon::pipeline_metrics>();
+      auto q = std::make_shared<mon::blocking_queue<int> >();
+      q->set_options(options);
+      std::thread producer([=]() {
+              std::this_thread::sleep_for(std::chrono::milliseconds(10));
+              q->push(1);
+              q->close();
+          });
+      int x;
+      assert(q->pop(x) && x == 1 && !q->pop(x));
+      producer.join();
+      mon::pipeline_snapshot s = options.metrics->snapshot();
+      assert(s.queues.size() == 1 && s.stages.empty());
+      assert(s.queues[0].consumer_waiting_ns >= 1000 * 1000);
+  }
+}
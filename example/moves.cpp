@@ -0,0 +1,132 @@
+#include <boost/monads/monad.hpp>
+#include <boost/monads/controlmonad.hpp>
+#include <boost/monads/algorithm.hpp>
+
+#include <cassert>
+#include <memory>
+#include <utility>
+
+namespace mon = boost::monads;
+
+// counts how often it, and anything holding it, is copied and moved
+struct counts {
+  int copies;
+  int moves;
+};
+
+struct counted {
+  counts* c;
+  explicit counted(counts& c) : c(&c) {}
+  counted(counted const& o) : c(o.c) { ++c->copies; }
+  counted(counted&& o) : c(o.c) { ++c->moves; }
+  counted& operator=(counted const& o) { c = o.c; ++c->copies; return *this; }
+  counted& operator=(counted&& o) { c = o.c; ++c->moves; return *this; }
+};
+
+// a monad with one element, whose rvalue mbind hands the element over
+template <typename T>
+struct box {
+  T value;
+
+  template <typename F>
+  auto mbind(F&& f) const& -> decltype(std::forward<F>(f)(value))
+  {
+    return std::forward<F>(f)(value);
+  }
+
+  template <typename F>
+  auto mbind(F&& f) && -> decltype(std::forward<F>(f)(std::move(value)))
+  {
+    return std::forward<F>(f)(std::move(value));
+  }
+
+  template <typename U>
+  static box<typename std::decay<U>::type> mreturn(U&& x)
+  {
+    return box<typename std::decay<U>::type>{std::forward<U>(x)};
+  }
+};
+
+struct rebox {
+  template <typename T>
+  box<T> operator()(T x) const { return box<T>{std::move(x)}; }
+};
+
+struct deref_inc {
+  box<int> operator()(std::unique_ptr<int> p) const { return box<int>{*p + 1}; }
+};
+
+// a continuation function carrying state, as large captures would
+struct counted_inc {
+  counted state;
+  auto operator()(int i) const -> decltype(mon::mreturn<mon::cps>(i + 1))
+  {
+    return mon::mreturn<mon::cps>(i + 1);
+  }
+};
+
+struct counted_plus {
+  counted state;
+  int operator()(int i) const { return i + 1; }
+};
+
+int main()
+{
+  {
+    // rvalue chains move the monad through every bind
+    counts c = {0, 0};
+    box<counted> b = ((mon::monad_pipe(box<counted>{counted(c)}) >>= rebox{}) >>= rebox{}).unpipe();
+    assert(c.copies == 0);
+    assert(b.value.c == &c);
+    // an lvalue monad is left alone, so binding it copies
+    ((mon::monad_pipe(b) >>= rebox{}) >>= rebox{}).unpipe();
+    assert(c.copies == 1);
+    assert(b.value.c == &c);
+  }
+  {
+    // which a move-only monad could not be: this compiles because nothing
+    // is copied
+    box<std::unique_ptr<int> > p{std::unique_ptr<int>(new int(1))};
+    auto b = ((mon::monad_pipe(std::move(p)) >>= rebox{}) >>= deref_inc{}).unpipe();
+    assert(b.value == 2);
+  }
+  {
+    // rvalue functions are moved into continuation monads, and so are the
+    // monads themselves
+    counts c = {0, 0};
+    int out = 0;
+    auto m = (((mon::monad_pipe(mon::mreturn<mon::cps>(1))
+                >>= counted_inc{counted(c)})
+               >>= counted_inc{counted(c)})
+              >>= counted_inc{counted(c)}).unpipe();
+    assert(c.copies == 0);
+    mon::run_cont(m, [&](int i) { out = i; });
+    assert(out == 4);
+    assert(c.copies == 0);
+    mon::run_cont(mon::mbind(mon::mbind(mon::mreturn<mon::cps>(1), counted_inc{counted(c)}),
+                             counted_inc{counted(c)}),
+                  [&](int i) { out = i; });
+    assert(out == 3);
+    assert(c.copies == 0);
+    // binding an lvalue function copies it once
+    counted_inc lvalue{counted(c)};
+    mon::run_cont(mon::mbind(mon::mreturn<mon::cps>(1), lvalue), [&](int i) { out = i; });
+    assert(out == 2);
+    assert(c.copies == 1);
+  }
+  {
+    // fmap, join and liftm
+    counts c = {0, 0};
+    int out = 0;
+    auto m = mon::fmap<mon::cps>(mon::mreturn<mon::cps>(1), counted_plus{counted(c)});
+    assert(c.copies == 0);
+    mon::run_cont(std::move(m), [&](int i) { out = i; });
+    assert(out == 2);
+    box<counted> b = mon::join(box<box<counted> >{box<counted>{counted(c)}});
+    assert(c.copies == 0);
+    assert(b.value.c == &c);
+    auto inc = mon::liftm<box<int> >(counted_plus{counted(c)});
+    assert(c.copies == 0);
+    assert(inc(box<int>{1}).value == 2);
+  }
+}
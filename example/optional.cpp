@@ -0,0 +1,60 @@
+#include <boost/monads/monad.hpp>
+#include <boost/monads/optional.hpp>
+
+#include <cassert>
+
+namespace mon = boost::monads;
+
+// counts calls, to check that an empty optional skips the rest of a chain
+struct counting_inc {
+  int& calls;
+  boost::optional<int> operator()(int i) const
+  {
+    ++calls;
+    return boost::optional<int>(i + 1);
+  }
+};
+
+struct half {
+  boost::optional<int> operator()(int i) const
+  {
+    if (i % 2)
+      return boost::none;
+    return boost::optional<int>(i / 2);
+  }
+};
+
+int main()
+{
+  {
+    boost::optional<int> maybe = mon::mreturn<boost::optional<int> >(4);
+    auto inc = [](int i){return boost::optional<int>(i+1);};
+    auto nullify = [](int){return boost::optional<int>();};
+
+    assert(*mon::mbind(maybe, inc) == 5);
+    assert(*maybe == 4); // inc does not alter original
+    assert(!mon::mbind(boost::optional<int>(), inc));
+    assert(*(mon::monad_pipe(maybe) >>= inc).unpipe() == 5);
+    assert(*((mon::monad_pipe(maybe) >>= inc) >>= inc).unpipe() == 6);
+    assert(!(((mon::monad_pipe(maybe) >>= inc) >>= nullify) >>= inc).unpipe());
+    assert(*((mon::monad_pipe(maybe) >>= half{}) >>= half{}).unpipe() == 1);
+    assert(!(((mon::monad_pipe(maybe) >>= half{}) >>= half{}) >>= half{}).unpipe());
+
+    int calls = 0;
+    assert(!((((mon::monad_pipe(maybe) >>= inc) >>= half{}) >>= counting_inc{calls})
+             >>= counting_inc{calls}).unpipe());
+    assert(calls == 0);
+  }
+#if defined(BOOST_MONADS_HAS_STD_OPTIONAL)
+  {
+    std::optional<int> maybe = mon::mreturn<std::optional<int> >(4);
+    auto inc = [](int i){return std::optional<int>(i+1);};
+    auto nullify = [](int){return std::optional<int>();};
+
+    assert(*mon::mbind(maybe, inc) == 5);
+    assert(!mon::mbind(std::optional<int>(), inc));
+    assert(*((mon::monad_pipe(maybe) >>= inc) >>= inc).unpipe() == 6);
+    assert(!(((mon::monad_pipe(maybe) >>= inc) >>= nullify) >>= inc).unpipe());
+  }
+#endif
+}
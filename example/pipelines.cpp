@@ -1,12 +1,20 @@
 #include <boost/monads/monad.hpp>
 #include <boost/monads/controlmonad.hpp>
 #include <boost/monads/algorithm.hpp>
+#include <boost/monads/future.hpp>
+#include <boost/monads/pipeline.hpp>
+#include <boost/monads/segment.hpp>
 #include <boost/algorithm/string.hpp> // starts_with and trim
 
+#include <atomic>
 #include <memory>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+#include <algorithm>
 #include <cassert>
 #include <future>
+#include <thread>
 
 namespace mon = boost::monads;
 
@@ -17,228 +25,195 @@ namespace mon = boost::monads;
 //
 
 // -----------------------------------------------------------------------------
-// 1) provide nice operators
-
-// n3534 hardcodes function<void(IN,OUT)>,
-//                 function<void(IN,queue_back<OUT>)>,
-//                 function<void(queue_front<IN>,OUT)> and
-//                 function<void(queue_front<IN>,queue_back<OUT>)>
-// for different interfaces.  As this cannot be done in general (what
-// if IN should be queue_front<int>?) and for any monad, I use
-// different operators for this: |, >>, << and ||.
-//
-// Notation: a := IN, b := OUT,
-//           M1 a := queue_front<IN>
-//           M2 b := queue_back<OUT>
-//           x -> y := void(x, y) (for any x and y)
-// Then we can pipeline using the following operators:
-//    pipeline | (a -> b)          Haskell: (|)  :: M a -> (a -> b) -> M b;   (|)  = flip fmap
-//    pipeline >> (a -> M b)       Haskell: (>>) :: M a -> (a -> M b) -> M b; (>>) = mbind)
-//    pipeline << (M a -> b)       Haskell: (<<) :: M a -> (M a -> b) -> M b; (<<) m f = return $ f m
-//    pipeline || (M a -> M b)     Haskell: (||) :: M a -> (M a -> M b) -> M b; (||) = flip ($)
-//
-// Note that "|" and "||" can be implemented more generally for
-// Functors, but this demo focusses on Monads.
+// 1) provide nice operators: see boost/monads/pipeline.hpp
+//    pipeline | (a -> b), pipeline >> (a -> M b),
+//    pipeline << (M a -> b), pipeline || (M a -> M b)
 
-template <typename Monad, typename M_a> struct pipeliner;
+using mon::pipeline;
+using mon::pipeline_from;
 
-template <typename Monad, typename M_a>
-pipeliner<Monad, typename std::decay<M_a>::type> pipeline(M_a&& m);
-
-template <typename Monad, typename M_a>
-struct pipeliner
-{
-    M_a monad;
+// -----------------------------------------------------------------------------
+// 2) a) a future as monad: see boost/monads/future.hpp
+// mreturn is make_ready_future and mbind attaches a continuation, so no
+// stage of a future pipeline owns a thread.
 
-    M_a get() && { return std::move(monad); }
+using mon::future_monad;
 
-    pipeliner(M_a monad) : monad(std::move(monad)) {}
+// -----------------------------------------------------------------------------
+// 2) b) a concurrent queue as monad: see boost/monads/segment.hpp
+// segment_monad moves items through a mutex-protected blocking_queue,
+// spsc_segment_monad through a lock-free single-producer/single-consumer
+// ring buffer.
 
-    template <typename MInToMOut>
-    auto operator||(MInToMOut&& m_in_to_m_out)
-        -> decltype(pipeline<Monad>(std::forward<MInToMOut>(m_in_to_m_out)(std::move(monad))))
-    {
-        return pipeline<Monad>(std::forward<MInToMOut>(m_in_to_m_out)(std::move(monad)));
-    }
+using mon::blocking_queue;
+using mon::shared_blocking_queue;
+using mon::segment_monad;
+using mon::spsc_segment_monad;
+using mon::shared_spsc_queue;
 
-    template <typename InToOut>
-    auto operator|(InToOut&& in_to_out)
-        -> decltype(*this || mon::liftm<Monad>(std::forward<InToOut>(in_to_out)))
-    {
-        return *this || mon::liftm<Monad>(std::forward<InToOut>(in_to_out));
-    }
+#include <type_traits>
+#include <chrono>
+#include <vector>
 
-    template <typename InToMOut>
-    auto operator>>(InToMOut&& in_to_m_out)
-        -> decltype(pipeline<Monad>(mon::join(std::move((*this | std::forward<InToMOut>(in_to_m_out)).monad))))
+// CPU-heavy transform for the parallel stage
+struct checksum {
+    std::pair<int, unsigned> operator()(int i) const
     {
-        return pipeline<Monad>(mon::join(std::move((*this | std::forward<InToMOut>(in_to_m_out)).monad)));
+        unsigned h = i;
+        for (int k = 0; k < 2000; ++k)
+            h = h * 2654435761u + k;
+        return std::make_pair(i, h);
     }
+};
 
-    template <typename MInToOut>
-    auto operator<<(MInToOut&& m_in_to_out)
-        -> decltype(pipeline<Monad>(mon::mreturn<Monad>(std::move((*this || std::forward<MInToOut>(m_in_to_out)).monad))))
+// a slow transform with state: every task of a parallel stage calls a
+// copy of its own, so each copy is only ever called on one thread
+struct thread_checked {
+    std::thread::id user;
+    int operator()(int i)
     {
-        return pipeline<Monad>(mon::mreturn<Monad>(std::move((*this || std::forward<MInToOut>(m_in_to_out)).monad)));
+        if (user == std::thread::id())
+            user = std::this_thread::get_id();
+        assert(user == std::this_thread::get_id());
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        return i;
     }
 };
 
-template <typename Monad, typename M_a>
-pipeliner<Monad, typename std::decay<M_a>::type> pipeline(M_a&& m)
+// pushes 0 .. n-1 through `| parallel(workers, checksum())' and checks
+// that the results arrive in input order
+template <typename SegmentMonad>
+void run_parallel(int n, std::size_t workers, std::size_t window)
 {
-    return pipeliner<Monad, typename std::decay<M_a>::type>(std::forward<M_a>(m));
+    std::vector<int> input(n);
+    for (int i = 0; i < n; ++i)
+        input[i] = i;
+    mon::queue_options options;
+    options.batch_size = 16;
+    auto q = (pipeline<SegmentMonad>(SegmentMonad::from_range(input.begin(), input.end(), options))
+              | mon::parallel(workers, checksum(), window)).get();
+    int expected = 0;
+    for (std::pair<int, unsigned> r; q->pop(r); ++expected)
+        assert(r.first == expected);
+    assert(expected == n);
 }
 
-template <typename Monad, typename T>
-auto pipeline_from(T&& x)
-    -> decltype(pipeline<Monad>(boost::monads::mreturn<Monad>(std::forward<T>(x))))
+// element i of the input expands to the inner queue of groups[i];
+// checks that concat_map keeps the input order and that merge_map keeps
+// at least the order within each group
+template <typename SegmentMonad>
+void run_merge(int n, std::size_t width, bool ordered)
 {
-    return pipeline<Monad>(boost::monads::mreturn<Monad>(std::forward<T>(x)));
-}
-
-// -----------------------------------------------------------------------------
-// 2) a) implement std::future as monad
-// This should be done much more efficiently, this is only a proof of concept.
-
-struct future_monad {
-    template <typename T>
-    static std::future<T> mreturn(T&& x)
-    {
-        // should return "make_ready_future"
-        return std::async(std::launch::deferred, [](T&& x){return x;}, std::move(x));
+    std::vector<std::vector<int> > groups(n);
+    for (int i = 0; i < n; ++i)
+        for (int k = 0; k < i % 7; ++k)
+            groups[i].push_back(100 * i + k);
+    std::vector<int> input(n);
+    for (int i = 0; i < n; ++i)
+        input[i] = i;
+    mon::queue_options options;
+    options.batch_size = 4;
+    options.capacity = 8;
+    auto expand = [&](int i) { return SegmentMonad::from_range(groups[i].begin(), groups[i].end()); };
+    auto source = SegmentMonad::from_range(input.begin(), input.end(), options);
+    auto q = ordered
+        ? (pipeline<SegmentMonad>(source) >> mon::concat_map(width, expand)).get()
+        : (pipeline<SegmentMonad>(source) >> mon::merge_map(width, expand)).get();
+    std::vector<int> out;
+    for (int x; q->pop(x);)
+        out.push_back(x);
+    std::vector<int> next(n, 0);
+    std::size_t total = 0, in_order = 0;
+    for (std::size_t j = 0; j < out.size(); ++j) {
+        const int i = out[j] / 100;
+        assert(out[j] == 100 * i + next[i]++);
+        if (j == 0 || out[j] > out[j - 1])
+            ++in_order;
     }
-};
-
-namespace std {
-template <typename T, typename F>
-auto boost_mbind(std::future<T> p, F &&fun)
-    -> std::future<decltype(std::forward<F>(fun)(std::move(p).get()).get())> {
-  struct move_captured_lambda
-  {
-      future<T> fut;
-      F fun;
-      decltype(std::forward<F>(fun)(std::move(p).get()).get()) operator()()
-      {
-        // should call future.then()
-          return std::forward<F>(fun)(std::move(std::move(fut).get())).get();
-      }
-  };
-  return std::async(std::launch::async,
-                    move_captured_lambda{std::move(p), std::forward<F>(fun)});
+    for (int i = 0; i < n; ++i) {
+        assert(next[i] == i % 7);
+        total += groups[i].size();
+    }
+    assert(out.size() == total);
+    if (ordered)
+        assert(in_order == total);
 }
-} // namespace std
 
-// -----------------------------------------------------------------------------
-// 2) b) implement a concurrent queue as monad
-// This should be done much more efficiently, this is only a proof of concept.
-
-#include <queue>
-#include <thread>
-#include <mutex>
-#include <condition_variable>
-
-template <typename T>
-class blocking_queue
+// inner sources that take a while to fill, as I/O would: with
+// merge_map(width, f) up to width of them are filled at once
+std::size_t slow_sources_at_once(std::size_t width)
 {
-    std::deque<T> queue;
-    bool closed = false;
-    std::mutex mutex;
-    std::condition_variable cond;
-public:
-    typedef T value_type;
-
-    template <typename T2>
-    void push(T2&& value)
-    {
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            queue.push_back(std::forward<T2>(value));
-        }
-        cond.notify_one();
-    }
-    bool pop(T& elem)
-    {
-        std::unique_lock<std::mutex> lock(mutex);
-
-        cond.wait(lock, [=](){ return closed || !queue.empty(); });
-        if (closed && queue.empty())
-            return false;
-        elem = std::move(queue.front());
-        queue.pop_front();
-        return true;
-    }
-    void close()
-    {
-        std::lock_guard<std::mutex> lock(mutex);
-        closed = true;
-        cond.notify_one();
-    }
-};
-
-template <typename T>
-using shared_blocking_queue = std::shared_ptr<blocking_queue<T> >;
-
-struct segment_monad {
-    template <typename T>
-    static shared_blocking_queue<T> mempty()
-    {
-        auto q = std::make_shared<blocking_queue<T> >();
-        q->close();
-        return q;
-    }
-
-    template <typename T>
-    static shared_blocking_queue<typename std::decay<T>::type> mreturn(T x)
-    {
-        auto q = std::make_shared<blocking_queue<T> >();
-        q->push(std::forward<T>(x));
-        q->close();
+    std::atomic<int> active(0), most(0);
+    mon::thread_pool io(8);
+    auto slow = [&](int i) {
+        auto q = std::make_shared<blocking_queue<int> >();
+        io.post([&, q, i]() {
+                const int now = ++active;
+                for (int m = most; now > m && !most.compare_exchange_weak(m, now);)
+                    ;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                q->push(i);
+                --active;
+                q->close();
+            });
         return q;
-    }
-
-    template <typename Iter,
-              typename T=typename std::iterator_traits<Iter>::value_type>
-    static shared_blocking_queue<T>
-    from_range(Iter from, Iter to)
-    {
-        auto out = std::make_shared<blocking_queue<T> >();
-        std::thread([=](){
-                std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-                for (Iter f=from, t=to; f != t;)
-                    out->push(*f++);
-                out->close();
-            }).detach();
-        return out;
-    }
+    };
+    std::vector<int> input(16);
+    for (int i = 0; i < 16; ++i)
+        input[i] = i;
+    auto q = (pipeline<segment_monad>(segment_monad::from_range(input.begin(), input.end()))
+              >> mon::merge_map(width, slow)).get();
+    int sum = 0;
+    for (int x; q->pop(x);)
+        sum += x;
+    assert(sum == 15 * 16 / 2);
+    return most;
+}
 
-    template <typename F, typename T>
-    using RetVal = typename std::decay<decltype(std::declval<F>()(std::declval<T>()))>::type;
-    template <typename T>
-    using ElemType = typename T::element_type;
-    template <typename T>
-    using ValueType = typename T::value_type;
+// take(n), take_while(p), first(p) on 0 .. 99999 behind a counting
+// stage; the stages upstream stop once they are done, and the bounded
+// queues keep them from running far ahead meanwhile
+template <typename SegmentMonad, typename Take>
+std::vector<int> run_take(Take take, std::size_t& seen)
+{
+    static std::vector<int> input;
+    for (int i = int(input.size()); i < 100000; ++i)
+        input.push_back(i);
+    mon::queue_options options;
+    options.capacity = 16;
+    std::atomic<std::size_t> counted(0);
+    auto q = (pipeline<SegmentMonad>(SegmentMonad::from_range(input.begin(), input.end(), options))
+              | [&](int i) { ++counted; return i; }
+              || take).get();
+    std::vector<int> out;
+    for (int x; q->pop(x);)
+        out.push_back(x);
+    // let stages that were still running see the cancellation
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    seen = counted;
+    return out;
+}
 
-    template <typename T, typename F,
-              typename U = ValueType<ElemType<RetVal<F, T> > > >
-    friend shared_blocking_queue<U>
-    boost_mbind(shared_blocking_queue<T> const &q, F fun) {
-        auto out = std::make_shared<blocking_queue<U> >();
-        std::thread([=](F fun){
-                T in;
-                U mid;
-                while (q->pop(in)) {
-                    auto q2 = fun(std::move(in));
-                    while (q2->pop(mid)) {
-                        out->push(std::move(mid));
-                    }
-                }
-                out->close();
-            }, std::move(fun)).detach();
-        return out;
-    }
-};
+// runs the error filter over `lines' and returns the number of matches
+template <typename SegmentMonad>
+std::size_t count_errors(std::vector<std::string> const& lines, std::size_t batch_size)
+{
+    mon::queue_options options;
+    options.batch_size = batch_size;
+    typedef decltype(SegmentMonad::template mempty<std::string>()) queue_type;
+    std::size_t count = 0;
+    (pipeline<SegmentMonad>(SegmentMonad::from_range(lines.begin(), lines.end(), options)) >>
+     [](std::string const& s) { return boost::starts_with(s, "Error:") ? SegmentMonad::mreturn(s) : SegmentMonad::template mempty<std::string>(); }
+     | [](std::string const& s) { return s.substr(std::string("Error:").size()); }
+     | [](std::string s) { boost::trim(s); return s; })
+        << [&](queue_type q) {
+        for (std::string s; q->pop(s);)
+            ++count;
+        return true;
+    };
+    return count;
+}
 
-#include <type_traits>
 int main()
 {
   namespace mon = boost::monads;
@@ -251,35 +226,51 @@ int main()
       std::cout<< msg << "@"<<std::this_thread::get_id()<<std::endl;
   };
   {
+      // the first value arrives later on default_executor(), so the
+      // stages continue it there after the pipeline is built; with
+      // pipeline_from(2) they would continue a ready future and run on
+      // this thread while the pipeline is built
+      auto two = []() {
+          std::this_thread::sleep_for(std::chrono::milliseconds(100));
+          return 2;
+      };
       auto r = 
-          pipeline_from<future_monad>(2)
+          pipeline<future_monad>(mon::async(mon::default_executor(), two))
           | [=](int i){pause(100);return i+1;}
           | [=](int i){pause(100);return 2*i;}
-         || [=](std::future<int> i){return std::async([=](std::future<int> j){pause(100); return j.get()-1;}, std::move(i));};
+         || [=](mon::future<int> i){return std::move(i).then(mon::default_executor(), [=](int j){pause(100); return j-1;});};
       std::cout << "pipeline created in "; pause(0); std::cout << "--" << std::endl;
-      std::cout << "pipeline result: "<<std::move(r).get().get() << '\n';
-      // output: 
-      //   pipeline created in thread id: 140342130247488
+      const int result = std::move(r).get().get();
+      std::cout << "pipeline result: " << result << '\n';
+      // output:
+      //   pipeline created in thread id: 139942586833280
       //   --
-      //   thread id: 140342113699584
-      //   thread id: 140342130247488
-      //   thread id: 140342104979200
+      //   thread id: 139942581884608
+      //   thread id: 139942581884608
+      //   thread id: 139942581884608
       //   pipeline result: 5
   }
+  {
+      // adjacent "|" stages are fused into one bind, own_stage() opts out
+      auto inc = [](int i) { return i + 1; };
+      auto p = pipeline_from<future_monad>(1) | inc | inc;
+      static_assert(std::is_same<decltype(p.monad), mon::future<int> >::value,
+                    "nothing is bound before the run of | stages ends");
+      assert(std::move(p).get().get() == 3);
+      assert((pipeline_from<future_monad>(1) | inc | mon::own_stage(inc) | inc).get().get() == 4);
+  }
   {
       auto filter_spaces = [=](char c)
           { xpause("filter spaces"); return c==' ' ? segment_monad::mempty<char>() : segment_monad::mreturn(c); };
       auto parse_digit = [=](char c) { xpause("parse digit"); return c-'0'; };
       auto length_until_zero = [=](shared_blocking_queue<int> const& q)
           {  auto out = std::make_shared<blocking_queue<size_t> >();
-             std::thread([=](shared_blocking_queue<int> in){
-                     xpause("length until zero");
-                     size_t s = 0;
-                     for (int i; in->pop(i);)
-                         if (i==0) { out->push(s); s=0; }
-                         else s++;
-                     out->close();
-                 }, q).detach();
+             auto s = std::make_shared<size_t>(0);
+             xpause("length until zero");
+             mon::consume(q,
+                          [=](int i) { if (i==0) { out->push(*s); *s=0; }
+                                       else ++*s; },
+                          [=]() { out->close(); });
              return out;
           };
       auto product = [=](shared_blocking_queue<size_t> const& q) {
@@ -301,7 +292,9 @@ int main()
            std::cout << '|'<<c.get()<<'|'<<std::flush;
       std::cout << '\n';
       
-      // output:
+      // output (the stages are tasks on default_executor(), so the
+      // thread ids depend on the size of the pool; this is from the
+      // thread-per-stage version):
       //   pipeline initiated in thread id: 140673683539776
       //   product@140673683539776
       //   length until zero@140673632118528
@@ -355,4 +348,209 @@ int main()
       //   trim   me
       //   end of pipe
   }
+  {
+      // same pipeline on the lock-free transport
+      using std::begin; using std::end;
+      const char* test[] =
+          {"Error:1","all right","Error... not really an error",
+           "Error", "Error:          trim   me      ", "Error: end of pipe"};
+      (pipeline<spsc_segment_monad>(spsc_segment_monad::from_range(begin(test), end(test))) >>
+       [](std::string const& s) { return boost::starts_with(s, "Error:") ? spsc_segment_monad::mreturn(s) : spsc_segment_monad::mempty<std::string>(); }
+       | [](std::string const& s) { return s.substr(std::string("Error:").size()); }
+       | [](std::string s) { boost::trim(s); return s; })
+          << [](shared_spsc_queue<std::string> q) {
+          for (std::string s; q->pop(s);)
+              std::cout << s << '\n';
+          return true; // currently needed
+      };
+      // output:
+      //   1
+      //   trim   me
+      //   end of pipe
+  }
+  {
+      // backpressure: every queue of the pipeline holds at most 16
+      // elements, so the producer thread is throttled while the consumer
+      // sleeps instead of buffering its whole output
+      mon::queue_options options;
+      options.capacity = 16;
+      options.gauges = std::make_shared<mon::queue_gauges>();
+      options.metrics = std::make_shared<mon::pipeline_metrics>();
+      auto source = std::make_shared<blocking_queue<int> >();
+      auto doubled = (pipeline<segment_monad>(source, options)
+                      | [](int i) { return 2 * i; }).get();
+      std::thread producer([=]() {
+              for (int i = 0; i < 10000; ++i)
+                  source->push(i);
+              source->close();
+          });
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      long sum = 0;
+      for (int i; doubled->pop(i);)
+          sum += i;
+      producer.join();
+      assert(sum == 10000L * 9999);
+      assert(source->throttled_pushes() > 0);
+      assert(options.gauges->throttled >= source->throttled_pushes());
+      std::cout << "throttled pushes: " << options.gauges->throttled << '\n';
+      // without BOOST_MONADS_ENABLE_METRICS nothing is counted (see
+      // metrics.cpp), and the options keep no pointer to the metrics
+      assert(options.metrics->snapshot().queues.empty());
+      static_assert(std::is_empty<mon::pipeline_metrics>::value
+                    && std::is_empty<mon::pipeline_metrics_ptr>::value, "metrics compiled out");
+  }
+  {
+      // parallel(n, f) spreads the elements of one stage over n tasks and
+      // emits the results in input order; the window bounds the results
+      // waiting for a slow predecessor
+      run_parallel<segment_monad>(1000, 4, 3);
+      run_parallel<spsc_segment_monad>(1000, 4, 0);
+      std::vector<int> input(1000, 1);
+      mon::thread_pool pool(4);
+      mon::queue_options options;
+      options.batch_size = 16;
+      options.executor = pool;
+      auto q = (pipeline<segment_monad>(segment_monad::from_range(input.begin(), input.end(), options))
+                | mon::parallel(4, thread_checked())).get();
+      int sum = 0;
+      for (int i; q->pop(i);)
+          sum += i;
+      assert(sum == 1000);
+  }
+  {
+      // concat_map(k, f) and merge_map(k, f) keep up to k of the queues f
+      // returns open at once, merged in input order or as they fill
+      for (std::size_t width : {1, 3, 16}) {
+          run_merge<segment_monad>(200, width, true);
+          run_merge<segment_monad>(200, width, false);
+          run_merge<spsc_segment_monad>(200, width, true);
+          run_merge<spsc_segment_monad>(200, width, false);
+      }
+      assert(slow_sources_at_once(1) == 1);
+      const std::size_t at_once = slow_sources_at_once(4);
+      assert(at_once > 1 && at_once <= 4);
+  }
+  {
+      // a consumer that has enough cancels its queue, and the stages
+      // upstream stop instead of producing into the void
+      std::size_t seen;
+      auto ten = run_take<segment_monad>(mon::take(10), seen);
+      assert((ten == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+      assert(seen < 1000);
+      assert(run_take<spsc_segment_monad>(mon::take(3), seen).size() == 3 && seen < 1000);
+      assert(run_take<segment_monad>(mon::take(0), seen).empty());
+      auto small = run_take<segment_monad>(mon::take_while([](int i) { return i < 20; }), seen);
+      assert(small.size() == 20 && small.back() == 19 && seen < 1000);
+      auto found = run_take<spsc_segment_monad>(mon::first([](int i) { return i > 0 && i % 1000 == 0; }), seen);
+      assert((found == std::vector<int>{1000}) && seen < 2000);
+      assert((run_take<segment_monad>(mon::first(), seen) == std::vector<int>{0}));
+      // the whole input if it ends first
+      assert(run_take<segment_monad>(mon::first([](int i) { return i < 0; }), seen).empty());
+      assert(seen == 100000);
+
+      // cancelling by hand, through a >> stage and a merge_map stage
+      std::vector<int> input(100000);
+      std::atomic<std::size_t> counted(0);
+      mon::queue_options options;
+      options.capacity = 16;
+      auto source = segment_monad::from_range(input.begin(), input.end(), options);
+      auto q = (((pipeline<segment_monad>(source) | [&](int i) { ++counted; return i; })
+                 >> [](int i) { return segment_monad::mreturn(i); })
+                >> mon::merge_map(4, [](int i) { return segment_monad::mreturn(i); })).get();
+      int x;
+      for (int i = 0; i < 5; ++i)
+          assert(q->pop(x));
+      q->cancel();
+      assert(q->cancelled() && q->drained() && !q->pop(x));
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      assert(source->cancelled());
+      assert(counted < 1000);
+
+      // a bind waiting for a slow inner queue cancels that one too,
+      // instead of waiting for it to produce
+      std::vector<int> two = {0, 1};
+      auto slow = std::make_shared<blocking_queue<int> >();
+      std::atomic<bool> handed_out(false);
+      auto waiting = mon::mbind(segment_monad::from_range(two.begin(), two.end()), [&](int i) {
+          if (!i)
+              return segment_monad::mreturn(i);
+          handed_out = true;
+          return slow;
+        });
+      assert(waiting->pop(x) && x == 0);
+      while (!handed_out)
+          std::this_thread::yield();
+      waiting->cancel();
+      for (int i = 0; i < 200 && !slow->cancelled(); ++i)
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      assert(slow->cancelled());
+  }
+  {
+      // a consumer that drops its queue without draining it frees the
+      // stages feeding it, even one waiting to push to a full queue
+      std::vector<int> input(100000);
+      mon::queue_options options;
+      options.capacity = 16;
+      auto token = std::make_shared<int>(0);
+      auto source = segment_monad::from_range(input.begin(), input.end(), options);
+      std::weak_ptr<blocking_queue<int> > weak_source = source;
+      auto q = ((pipeline<segment_monad>(std::move(source)) | mon::own_stage([token](int i) { return i; }))
+                >> [](int i) { return segment_monad::mreturn(i); }).get();
+      int x;
+      assert(q->pop(x));
+      q.reset();
+      for (int i = 0; i < 200 && (token.use_count() > 1 || !weak_source.expired()); ++i)
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      assert(token.use_count() == 1 && weak_source.expired());
+  }
+  {
+      // a single-pass range is read once, also when the queue is full
+      std::istringstream in("1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20");
+      mon::queue_options options;
+      options.batch_size = 4;
+      options.capacity = 2;
+      auto q = segment_monad::from_range(std::istream_iterator<int>(in), std::istream_iterator<int>(), options);
+      std::vector<int> got;
+      for (int i; q->pop(i);)
+          got.push_back(i);
+      assert(got.size() == 20 && got.front() == 1 && got.back() == 20);
+      assert(std::is_sorted(got.begin(), got.end()));
+  }
+  {
+      // per-item and chunked transfer between the stages (timings:
+      // bench/pipelines.cpp)
+      std::vector<std::string> lines;
+      for (int i = 0; i < 10000; ++i)
+          lines.push_back(i % 2 ? "Error:  line " + std::to_string(i) : "all right");
+      for (std::size_t batch : {1, 64}) {
+          assert(count_errors<segment_monad>(lines, batch) == lines.size() / 2);
+          assert(count_errors<spsc_segment_monad>(lines, batch) == lines.size() / 2);
+      }
+  }
+  {
+      // stages on pinned workers of the first node, ring buffers bound
+      // to it; the same on a machine with a single node
+      auto const& topology = mon::cpu_topology::get();
+      std::vector<int> cpus = topology.cpus(0);
+      assert(!cpus.empty() && topology.node_of(cpus.front()) == 0);
+      assert(topology.cpus(int(topology.node_count())).size() >= cpus.size());
+      mon::placement where;
+      where.node = 0;
+      mon::thread_pool pool(2 * cpus.size(), where);
+      std::promise<int> ran_on;
+      pool.post([&]() { ran_on.set_value(sched_getcpu()); });
+      const int cpu = ran_on.get_future().get();
+      assert(std::find(cpus.begin(), cpus.end(), cpu) != cpus.end());
+
+      mon::queue_options options = mon::placed_on(pool);
+      options.capacity = 4096;
+      assert(options.numa_node == 0);
+      std::vector<int> input(10000, 1);
+      auto q = (pipeline<spsc_segment_monad>(spsc_segment_monad::from_range(input.begin(), input.end(), options))
+                | [](int i) { return i + 1; } | mon::own_stage([](int i) { return 2 * i; })).get();
+      int sum = 0;
+      for (int i; q->pop(i);)
+          sum += i;
+      assert(sum == 4 * 10000);
+  }
 }
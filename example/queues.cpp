@@ -0,0 +1,231 @@
+#include <boost/monads/queue.hpp>
+
+#include <atomic>
+#include <cassert>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The segment transports: one producer thread pushes `count' integers,
+// the calling thread pops and sums them.  Timings: bench/queues.cpp.
+
+namespace mon = boost::monads;
+
+// a producer blocked on a full queue is released by the consumer's
+// cancel(), which runs the producer's hook once; pushes after it are
+// dropped and pops fail
+template <typename Queue>
+void cancel_blocked_producer(Queue& q)
+{
+  std::atomic<int> hooks(0);
+  q.on_cancel([&]() { ++hooks; });
+  std::thread producer([&]() {
+      for (long i = 0; i < 1000; ++i)
+        q.push(i);
+    });
+  long first;
+  assert(q.pop(first) && first == 0);
+  q.cancel();
+  producer.join();
+  assert(q.cancelled() && hooks == 1);
+  assert(!q.pop(first) && q.drained());
+  assert(!q.notify_when_readable([]() {}) && !q.notify_when_writable([]() {}));
+  q.on_cancel([&]() { ++hooks; });
+  assert(hooks == 2);
+}
+
+// hooks added with on_cancel run once, in the order they were added, and
+// one added after the cancellation runs right away
+template <typename Queue>
+void chain_hooks(Queue& q)
+{
+  std::vector<int> order;
+  q.on_cancel([&]() { order.push_back(1); });
+  q.on_cancel([&]() { order.push_back(2); });
+  q.cancel();
+  q.cancel();
+  assert((order == std::vector<int>{1, 2}));
+  q.on_cancel([&]() { order.push_back(3); });
+  assert((order == std::vector<int>{1, 2, 3}));
+}
+
+template <typename Queue>
+void transfer(Queue& q, long count)
+{
+  std::thread producer([&]() {
+      for (long i = 0; i < count; ++i)
+        q.push(i);
+      q.close();
+    });
+  long sum = 0;
+  for (long i; q.pop(i);)
+    sum += i;
+  producer.join();
+  assert(sum == count * (count - 1) / 2);
+}
+
+// same, moving up to `batch' elements per synchronization
+template <typename Queue>
+void transfer_batched(Queue& q, long count, std::size_t batch)
+{
+  std::thread producer([&]() {
+      std::vector<long> buf(batch);
+      for (long i = 0; i < count;) {
+        std::size_t n = 0;
+        for (; n < batch && i < count; ++n)
+          buf[n] = i++;
+        q.push_n(buf.begin(), n);
+      }
+      q.close();
+    });
+  long sum = 0;
+  std::vector<long> buf(batch);
+  while (std::size_t n = q.pop_batch(buf.begin(), batch))
+    for (std::size_t i = 0; i < n; ++i)
+      sum += buf[i];
+  producer.join();
+  assert(sum == count * (count - 1) / 2);
+}
+
+int main()
+{
+  const long count = 200*1000;
+  {
+    mon::blocking_queue<long> q;
+    transfer(q, count);
+  }
+  {
+    mon::spsc_queue<long> q;
+    transfer(q, count);
+  }
+  {
+    mon::blocking_queue<long> q;
+    transfer_batched(q, count, 64);
+  }
+  {
+    mon::spsc_queue<long> q;
+    transfer_batched(q, count, 64);
+  }
+  {
+    // capacity 1 forces producer and consumer to alternate
+    mon::spsc_queue<long> q(1);
+    transfer(q, 1000);
+  }
+  {
+    mon::queue_options options;
+    options.capacity = 1;
+    mon::blocking_queue<long> q, r;
+    q.set_options(options);
+    transfer(q, 1000);
+    r.set_options(options);
+    transfer_batched(r, 1000, 64);
+  }
+  {
+    // bounded in elements: try_push_n takes what fits
+    long items[10] = {};
+    mon::queue_options options;
+    options.capacity = 4;
+    mon::blocking_queue<long> q;
+    q.set_options(options);
+    assert(q.try_push_n(items, 10) == 4);
+    assert(q.throttled_pushes() == 1);
+    assert(q.notify_when_writable([]() {}));
+    mon::spsc_queue<long> r(4);
+    assert(r.try_push_n(items, 10) == 4);
+    assert(r.throttled_pushes() == 1);
+  }
+  {
+    // bounded in bytes, as measured by the size function
+    std::string items[] = {"aa", "bbbb", "cc", "dddddddddd"};
+    auto length = [](std::string const& s) { return s.size(); };
+    mon::queue_options options;
+    options.capacity_bytes = 8;
+    mon::blocking_queue<std::string> q;
+    q.set_options(options);
+    q.set_item_size(length);
+    mon::spsc_queue<std::string> r(16, 8);
+    r.set_item_size(length);
+    assert(q.try_push_n(items, 4) == 3);
+    assert(r.try_push_n(items, 4) == 3);
+    bool resumed = false;
+    assert(q.notify_when_writable([&]() { resumed = true; }));
+    std::string out[4];
+    q.try_pop_batch(out, 2);
+    assert(!resumed);
+    q.try_pop_batch(out, 1);
+    assert(resumed);
+    // an element larger than the limit still fits into an empty queue
+    assert(q.try_push_n(items + 3, 1) == 1);
+    r.try_pop_batch(out, 3);
+    assert(r.try_push_n(items + 3, 1) == 1);
+  }
+  {
+    // elements converted on the way in are not moved from while the
+    // queue is full, so a retried push still has them
+    typedef std::unique_ptr<int> owned;
+    mon::queue_options options;
+    options.capacity = 1;
+    mon::blocking_queue<std::shared_ptr<int> > q;
+    q.set_options(options);
+    mon::spsc_queue<std::shared_ptr<int> > r(1, sizeof(int));
+    r.set_item_size([](std::shared_ptr<int> const&) { return sizeof(int); });
+    std::vector<owned> items;
+    for (int i = 0; i < 3; ++i)
+      items.push_back(owned(new int(i)));
+    assert(q.try_push_n(std::make_move_iterator(items.begin()), 2) == 1);
+    assert(q.try_push_n(std::make_move_iterator(items.begin() + 1), 2) == 0);
+    assert(items[1] && items[2]);
+    std::shared_ptr<int> out;
+    assert(q.pop(out) && *out == 0);
+    assert(q.try_push_n(std::make_move_iterator(items.begin() + 1), 2) == 1);
+    assert(!items[1] && items[2]);
+    assert(q.pop(out) && *out == 1);
+    // bounded in bytes
+    assert(r.try_push_n(std::make_move_iterator(items.begin() + 2), 1) == 1);
+    items[2].reset(new int(2));
+    assert(r.try_push_n(std::make_move_iterator(items.begin() + 2), 1) == 0);
+    assert(items[2]);
+    assert(r.pop(out) && *out == 2);
+    assert(r.try_push_n(std::make_move_iterator(items.begin() + 2), 1) == 1);
+  }
+  {
+    // closed queues, as mreturn and mempty build them
+    mon::blocking_queue<std::string> one(mon::closed_queue_t(), "x");
+    mon::spsc_queue<std::string> other(mon::closed_queue_t(), "y");
+    mon::blocking_queue<int> none((mon::closed_queue_t()));
+    std::string s;
+    assert(one.pop(s) && s == "x" && !one.pop(s) && one.drained());
+    assert(other.pop(s) && s == "y" && !other.pop(s) && other.drained());
+    assert(none.drained() && !none.notify_when_readable([]() {}));
+  }
+  {
+    // pool blocks freed on another thread come back through the depot
+    typedef mon::spsc_queue<long> queue;
+    std::vector<std::shared_ptr<queue> > made;
+    for (int i = 0; i < 1000; ++i)
+      made.push_back(std::allocate_shared<queue>(mon::pool_allocator<queue>(), 4));
+    std::thread([&]() { made.clear(); }).join();
+    for (int i = 0; i < 1000; ++i)
+      made.push_back(std::allocate_shared<queue>(mon::pool_allocator<queue>(), 4));
+    transfer(*made.back(), 1000);
+  }
+  {
+    mon::blocking_queue<long> q;
+    mon::queue_options o;
+    o.capacity = 4;
+    q.set_options(o);
+    cancel_blocked_producer(q);
+  }
+  {
+    mon::spsc_queue<long> q(4);
+    cancel_blocked_producer(q);
+  }
+  {
+    mon::blocking_queue<int> q;
+    chain_hooks(q);
+    mon::spsc_queue<int> r;
+    chain_hooks(r);
+  }
+}
@@ -0,0 +1,112 @@
+#include <boost/monads/monad.hpp>
+#include <boost/monads/writer.hpp>
+#include <boost/monads/state.hpp>
+
+#include <cassert>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mon = boost::monads;
+using mon::writer;
+using mon::unit;
+
+// a log that counts its copies
+struct counted_log {
+  static int copies;
+  std::vector<std::string> lines;
+
+  counted_log() {}
+  counted_log(std::string line) : lines(1, std::move(line)) {}
+  counted_log(counted_log const& other) : lines(other.lines) { ++copies; }
+  counted_log(counted_log&&) = default;
+  counted_log& operator=(counted_log const& other) { lines = other.lines; ++copies; return *this; }
+  counted_log& operator=(counted_log&&) = default;
+  counted_log& operator+=(counted_log&& more)
+  {
+    lines.insert(lines.end(), more.lines.begin(), more.lines.end());
+    return *this;
+  }
+};
+int counted_log::copies = 0;
+
+typedef writer<counted_log, int> logged;
+
+struct half {
+  logged operator()(int i) const { return logged(i / 2, counted_log("halved " + std::to_string(i))); }
+};
+
+struct log_it {
+  writer<std::string, unit> operator()(unit) const { return mon::tell(std::string("x")); }
+};
+
+// a monad that only binds in place, through adl
+namespace counter {
+struct count {
+  int n;
+};
+
+template <typename F>
+count boost_mbind_inplace(count&& c, F&& f)
+{
+  c.n = f(c.n).n + 1;
+  return c;
+}
+}
+
+typedef std::vector<int> buffer;
+
+struct push {
+  int x;
+  void operator()(buffer& b) const { b.push_back(x); }
+};
+
+struct get_buffer {
+  auto operator()(mon::unit) const -> decltype(mon::get_state<buffer>())
+  {
+    return mon::get_state<buffer>();
+  }
+};
+
+int main()
+{
+  {
+    // temporaries bind in place: no copies of the log
+    counted_log::copies = 0;
+    auto r = (((mon::monad_pipe(mon::mreturn<logged>(64)) >>= half()) >>= half()) >>= half()).unpipe();
+    assert(r.value == 8);
+    assert((r.log.lines == std::vector<std::string>{"halved 64", "halved 32", "halved 16"}));
+    assert(counted_log::copies == 0);
+    // an lvalue is left alone, its log is copied
+    logged start = mon::mreturn<logged>(10);
+    auto s = mon::mbind(start, half());
+    assert(s.value == 5 && s.log.lines.size() == 1 && start.value == 10);
+    assert(counted_log::copies == 1);
+    // tell
+    auto t = ((mon::monad_pipe(mon::tell(std::string("a"))) >>= log_it()) >>= log_it()).unpipe();
+    assert(t.log == "axx");
+  }
+  {
+    // adl in-place bind, chosen for rvalues only
+    counter::count c{0};
+    auto d = mon::mbind(std::move(c), [](int n) { return counter::count{n + 10}; });
+    assert(d.n == 11);
+  }
+  {
+    // a chain of actions on a buffer, changed in place
+    auto m = (((mon::monad_pipe(mon::modify_state<buffer>(push{1}))
+                >>= [](unit) { return mon::modify_state<buffer>(push{2}); })
+               >>= get_buffer())
+              >>= [](buffer const& b) { return mon::mreturn<mon::state_monad<buffer> >(b.size()); }).unpipe();
+    buffer b;
+    assert(mon::run_state(m, b) == 2);
+    assert((b == buffer{1, 2}));
+    // an action runs every time
+    assert(mon::run_state(m, b) == 4);
+    auto put = mon::mbind(mon::put_state(buffer{7}), [](unit) { return mon::get_state<buffer>(); });
+    assert((mon::run_state(put, b) == buffer{7}));
+    // an lvalue action is copied into the bound one
+    auto twice = mon::mbind(m, [](std::size_t n) { return mon::mreturn<mon::state_monad<buffer> >(2 * n); });
+    assert(mon::run_state(twice, b) == 6);
+  }
+}
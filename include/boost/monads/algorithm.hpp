@@ -5,7 +5,9 @@
 #define BOOST_MONADS_ALGORITHM_HPP
 
 #include "monad.hpp"
+#include <cstddef>
 #include <functional>
+#include <type_traits>
 
 namespace boost { namespace monads {
 
@@ -14,7 +16,7 @@ struct identity_
     template <typename T>
     T operator() (T&& x) const
     {
-        return x;
+        return std::forward<T>(x);
     }
 };
 identity_ identity() { return identity_{}; }
@@ -24,7 +26,7 @@ template <typename M, typename F>
 struct return_after_f {
     F f;
     template <typename A>
-    auto operator()(A&& a)
+    auto operator()(A&& a) const
         -> decltype(mreturn<M>(f(std::forward<A>(a))))
     {
         return mreturn<M>(f(std::forward<A>(a)));
@@ -67,6 +69,49 @@ auto liftm(F&& f)
     return detail::bind_first_for_fmap<M, typename std::decay<F>::type>{std::forward<F>(f)};
 }
 
+// fmap whose function may run on up to `workers' concurrent tasks.  A
+// monad supports it with an mbind overload taking parallel_t; the
+// results keep the order of the input.  Every task calls a copy of f of
+// its own, so f may change its members, but whatever its copies share
+// (captured references, shared_ptrs) must be safe to use concurrently.
+template <typename F>
+struct parallel_t {
+    std::size_t workers;
+    // maximum number of elements in flight, 0 for the monad's default
+    std::size_t window;
+    F f;
+};
+
+template <typename F>
+parallel_t<typename std::decay<F>::type> parallel(std::size_t workers, F&& f, std::size_t window = 0)
+{
+    return parallel_t<typename std::decay<F>::type>{workers ? workers : 1, window, std::forward<F>(f)};
+}
+
+// mbind that evaluates the monads f returns up to `width' at a time
+// instead of one after the other, and merges what they yield: in the
+// order of the input for concat_map, in the order it becomes available
+// for merge_map.  A monad supports it with an mbind overload taking
+// merge_t.
+template <typename F>
+struct merge_t {
+    std::size_t width;
+    bool ordered;
+    F f;
+};
+
+template <typename F>
+merge_t<typename std::decay<F>::type> concat_map(std::size_t width, F&& f)
+{
+    return merge_t<typename std::decay<F>::type>{width ? width : 1, true, std::forward<F>(f)};
+}
+
+template <typename F>
+merge_t<typename std::decay<F>::type> merge_map(std::size_t width, F&& f)
+{
+    return merge_t<typename std::decay<F>::type>{width ? width : 1, false, std::forward<F>(f)};
+}
+
 }} // namespace boost::monads
 
 #endif // BOOST_MONADS_ALGORITHM_HPP
@@ -4,7 +4,12 @@
 #ifndef BOOST_MONADS_CONTROLMONAD_HPP
 #define BOOST_MONADS_CONTROLMONAD_HPP
 
+#include <cstddef>
 #include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include "monad.hpp"
 
 namespace boost { namespace monads {
@@ -33,9 +38,9 @@ struct take_a_return_r_t_storing_f_and_b_to_r {
     BToR b_to_r;
     template <typename A>
     auto operator()(A&& a) const
-        -> decltype(call(call(f, std::forward<A>(a)), b_to_r))
+        -> decltype(f(std::forward<A>(a))(b_to_r))
     {
-        return call(call(f, std::forward<A>(a)), b_to_r);
+        return f(std::forward<A>(a))(b_to_r);
     }
 };
 
@@ -45,39 +50,93 @@ struct take_b_to_r_return_r_storing_s_and_f {
     F f;
     template <typename BToR>
     auto operator()(BToR&& b_to_r) const
-        -> decltype(call(s, take_a_return_r_t_storing_f_and_b_to_r<F&&, BToR&&>{f, std::forward<BToR>(b_to_r)}))
+        -> decltype(s(take_a_return_r_t_storing_f_and_b_to_r<F const&, typename std::remove_reference<BToR>::type&>{f, b_to_r}))
     {
-        return call(s, take_a_return_r_t_storing_f_and_b_to_r<F&&, BToR&&>{f, std::forward<BToR>(b_to_r)});
+        return s(take_a_return_r_t_storing_f_and_b_to_r<F const&, typename std::remove_reference<BToR>::type&>{f, b_to_r});
     }
 };
-} // namespace detail
 
+template <typename T> struct apply_cps;
+template <typename F> struct call_cc_cont;
+
+// the library's own steps of a continuation monad
+template <typename T> struct is_cont_step : std::false_type {};
+template <typename S, typename F>
+struct is_cont_step<take_b_to_r_return_r_storing_s_and_f<S, F> > : std::true_type {};
 template <typename T>
-class cont_monad
+struct is_cont_step<apply_cps<T> > : std::true_type {};
+template <typename F>
+struct is_cont_step<call_cc_cont<F> > : std::true_type {};
+
+// What a cont_monad runs.  Running a chain of n binds instantiates the
+// call operators of every step, nested n deep, so each one a step adds
+// counts against the compiler's template depth.  The library's steps
+// are therefore base classes whose call operator is the cont_monad's
+// own; any other callable is a member called through a forwarding one.
+template <typename T, bool = is_cont_step<T>::value>
+class cont_holder : T
 {
-    T wrapped;
+protected:
+    cont_holder(T const& wrapped) : T(wrapped) {}
+    cont_holder(T&& wrapped) : T(std::move(wrapped)) {}
 public:
-    cont_monad(T&& wrapped)
-        : wrapped(std::forward<T>(wrapped))
-    {
-    }
+    using T::operator();
+};
 
+template <typename T>
+class cont_holder<T, false>
+{
+    T wrapped;
+protected:
+    cont_holder(T const& wrapped) : wrapped(wrapped) {}
+    cont_holder(T&& wrapped) : wrapped(std::move(wrapped)) {}
+public:
     template <typename Callable>
     auto operator()(Callable&& callable) const
         -> decltype(wrapped(std::forward<Callable>(callable)))
     {
         return wrapped(std::forward<Callable>(callable));
     }
+};
+} // namespace detail
+
+template <typename T>
+class cont_monad : detail::cont_holder<T>
+{
+public:
+    cont_monad(T const& wrapped)
+        : detail::cont_holder<T>(wrapped)
+    {
+    }
+
+    cont_monad(T&& wrapped)
+        : detail::cont_holder<T>(std::move(wrapped))
+    {
+    }
+
+    using detail::cont_holder<T>::operator();
 
     // first argument  s :: cont_monad ((a->r)->r)
     // second argument f :: a -> (cont_monad ((b->r)->r))
     // return type       :: cont_monad ((b->r)->r)
+    // An rvalue monad and function are moved into the result, so chains of
+    // temporaries bind without copies.  The result type is spelled out
+    // instead of asked of make_cont_monad, whose lookup via adl walks all
+    // the binds before this one.
     template <typename MakeContMonad>
-    auto mbind(MakeContMonad&& f) const
-        -> decltype(make_cont_monad(detail::take_b_to_r_return_r_storing_s_and_f<cont_monad, MakeContMonad>{*this,std::forward<MakeContMonad>(f)}))
+    auto mbind(MakeContMonad&& f) const&
+        -> cont_monad<detail::take_b_to_r_return_r_storing_s_and_f<cont_monad, typename std::decay<MakeContMonad>::type> >
     {
-        using Ret = detail::take_b_to_r_return_r_storing_s_and_f<cont_monad, MakeContMonad>;
-        return make_cont_monad(Ret{*this,std::forward<MakeContMonad>(f)});
+        using Ret = detail::take_b_to_r_return_r_storing_s_and_f<cont_monad, typename std::decay<MakeContMonad>::type>;
+        return cont_monad<Ret>(Ret{*this,std::forward<MakeContMonad>(f)});
+    }
+
+    template <typename MakeContMonad>
+    auto mbind(MakeContMonad&& f) &&
+        -> cont_monad<detail::take_b_to_r_return_r_storing_s_and_f<cont_monad, typename std::decay<MakeContMonad>::type> >
+    {
+        using Ret = detail::take_b_to_r_return_r_storing_s_and_f<cont_monad, typename std::decay<MakeContMonad>::type>;
+        return cont_monad<Ret>(Ret{std::move(*this),std::forward<MakeContMonad>(f)});
     }
 };
 
@@ -106,7 +165,7 @@ struct cps {
     static auto mreturn(T&& x)
         -> cont_monad<detail::apply_cps<typename std::decay<T>::type> >
     {
-        return make_cont_monad(detail::apply_cps<typename std::decay<T>::type>{x});
+        return make_cont_monad(detail::apply_cps<typename std::decay<T>::type>{std::forward<T>(x)});
     }
 };
 
@@ -128,9 +187,9 @@ struct a_and_h_to_cont {
     H const& h;
     template <typename A>
     auto operator()(A a) const
-        -> decltype(make_cont_monad(always_call_h<H, A>{h, std::move(a)}))
+        -> cont_monad<always_call_h<H, A> >
     {
-        return make_cont_monad(always_call_h<H, A>{h, std::move(a)});
+        return cont_monad<always_call_h<H, A> >(always_call_h<H, A>{h, std::move(a)});
     }
 };
 
@@ -148,42 +207,262 @@ struct call_cc_cont {
 
 template <typename CallCC>
 auto call_cc(CallCC&& f)
-    -> decltype(make_cont_monad(detail::call_cc_cont<typename std::decay<CallCC>::type>{f}))
+    -> decltype(make_cont_monad(detail::call_cc_cont<typename std::decay<CallCC>::type>{std::forward<CallCC>(f)}))
 {
-    return make_cont_monad(detail::call_cc_cont<typename std::decay<CallCC>::type>{f});
+    return make_cont_monad(detail::call_cc_cont<typename std::decay<CallCC>::type>{std::forward<CallCC>(f)});
 }
 
+// Non-owning reference to a continuation a -> r, the parameter of a type
+// erased continuation monad.  It only lives for the duration of one run,
+// so binding it costs neither an allocation nor a copy of the callable.
 template <typename R, typename A>
-class type_erased_cont_monad {
-    std::function<R(std::function<R(A)>)> wrapped;
+class cont_ref
+{
+    void* callable;
+    R (*invoke)(void*, A);
+
+    template <typename F>
+    static R invoke_(void* f, A a)
+    {
+        return (*static_cast<F*>(f))(std::forward<A>(a));
+    }
 public:
-    type_erased_cont_monad(std::function<R(std::function<R(A)>)> wrapped)
-        : wrapped(wrapped)
+    template <typename F,
+              typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<F>::type, cont_ref>::value>::type>
+    cont_ref(F&& f)
+        : callable(const_cast<void*>(static_cast<void const*>(std::addressof(f))))
+        , invoke(&invoke_<typename std::remove_reference<F>::type>)
     {
     }
 
-    template <typename T>
-    type_erased_cont_monad(cont_monad<T> orig)
-        : wrapped([=](std::function<R(A)> f){return orig(f);})
+    R operator()(A a) const
     {
+        return invoke(callable, std::forward<A>(a));
     }
+};
 
+namespace detail {
+// what a type_erased_cont_monad does with the callable it stores
+template <typename R, typename A>
+struct erased_cont_ops {
+    R (*call)(void const*, cont_ref<R, A>);
+    // move-constructs into the second argument and destroys the first
+    void (*move)(void*, void*);
+    // copy-constructs into the second argument; null if move-only
+    void (*copy)(void const*, void*);
+    void (*destroy)(void*);
+};
 
-    R operator()(std::function<R(A)>&& f) const
+// callables that are small and nothrow movable live in the buffer
+template <typename F, typename R, typename A>
+struct inline_cont {
+    static F const& get(void const* p) { return *static_cast<F const*>(p); }
+    static R call(void const* p, cont_ref<R, A> k) { return get(p)(k); }
+    static void move(void* from, void* to)
     {
-        using namespace std::placeholders;
-        return wrapped(f);
+        ::new (to) F(std::move(*static_cast<F*>(from)));
+        static_cast<F*>(from)->~F();
+    }
+    static void copy(void const* from, void* to) { ::new (to) F(get(from)); }
+    static void destroy(void* p) { static_cast<F*>(p)->~F(); }
+};
+
+// all others on the heap, the buffer holding the pointer
+template <typename F, typename R, typename A>
+struct heap_cont {
+    static F const& get(void const* p) { return **static_cast<F* const*>(p); }
+    static R call(void const* p, cont_ref<R, A> k) { return get(p)(k); }
+    static void move(void* from, void* to) { ::new (to) F*(*static_cast<F**>(from)); }
+    static void copy(void const* from, void* to) { ::new (to) F*(new F(get(from))); }
+    static void destroy(void* p) { delete *static_cast<F**>(p); }
+};
+
+template <typename Impl, typename R, typename A>
+erased_cont_ops<R, A> const* erased_ops(std::true_type /*copyable*/)
+{
+    static const erased_cont_ops<R, A> ops = {&Impl::call, &Impl::move, &Impl::copy, &Impl::destroy};
+    return &ops;
+}
+
+template <typename Impl, typename R, typename A>
+erased_cont_ops<R, A> const* erased_ops(std::false_type /*copyable*/)
+{
+    static const erased_cont_ops<R, A> ops = {&Impl::call, &Impl::move, nullptr, &Impl::destroy};
+    return &ops;
+}
+
+// the buffer and the table of a type_erased_cont_monad; copying one that
+// holds a move-only callable is ruled out by the monad's type
+template <typename R, typename A>
+class erased_cont_storage {
+public:
+    static const std::size_t inline_size = 4 * sizeof(void*);
+private:
+    typedef erased_cont_ops<R, A> ops_type;
+
+    typename std::aligned_storage<inline_size, alignof(std::max_align_t)>::type buffer;
+    ops_type const* ops;
+
+    template <typename F>
+    struct fits_inline
+        : std::integral_constant<bool, sizeof(F) <= inline_size
+                                       && alignof(std::max_align_t) % alignof(F) == 0
+                                       && std::is_nothrow_move_constructible<F>::value> {};
+
+    template <typename F>
+    void store(F&& f, std::true_type /*inline*/)
+    {
+        typedef typename std::decay<F>::type Fn;
+        ::new (static_cast<void*>(&buffer)) Fn(std::forward<F>(f));
+        ops = erased_ops<inline_cont<Fn, R, A>, R, A>(std::is_copy_constructible<Fn>());
+    }
+    template <typename F>
+    void store(F&& f, std::false_type /*inline*/)
+    {
+        typedef typename std::decay<F>::type Fn;
+        ::new (static_cast<void*>(&buffer)) Fn*(new Fn(std::forward<F>(f)));
+        ops = erased_ops<heap_cont<Fn, R, A>, R, A>(std::is_copy_constructible<Fn>());
+    }
+    void reset()
+    {
+        if (ops)
+            ops->destroy(&buffer);
+        ops = nullptr;
+    }
+public:
+    erased_cont_storage() : ops(nullptr) {}
+    template <typename F>
+    explicit erased_cont_storage(F&& f)
+    {
+        store(std::forward<F>(f), fits_inline<typename std::decay<F>::type>());
+    }
+    erased_cont_storage(erased_cont_storage&& other) noexcept
+        : ops(other.ops)
+    {
+        if (ops)
+            ops->move(&other.buffer, &buffer);
+        other.ops = nullptr;
+    }
+    erased_cont_storage(erased_cont_storage const& other)
+        : ops(nullptr)
+    {
+        if (!other.ops)
+            return;
+        other.ops->copy(&other.buffer, &buffer);
+        ops = other.ops;
+    }
+    erased_cont_storage& operator=(erased_cont_storage other) noexcept
+    {
+        reset();
+        if (other.ops)
+            other.ops->move(&other.buffer, &buffer);
+        ops = other.ops;
+        other.ops = nullptr;
+        return *this;
+    }
+    ~erased_cont_storage()
+    {
+        reset();
+    }
+
+    bool empty() const { return ops == nullptr; }
+    R call(cont_ref<R, A> k) const { return ops->call(&buffer, k); }
+};
+
+template <typename R, typename A>
+const std::size_t erased_cont_storage<R, A>::inline_size;
+
+// an empty base that deletes the copies of the class deriving from it
+// unless Copyable
+template <bool Copyable>
+struct copyable_if {};
+
+template <>
+struct copyable_if<false> {
+    copyable_if() = default;
+    copyable_if(copyable_if&&) = default;
+    copyable_if(copyable_if const&) = delete;
+    copyable_if& operator=(copyable_if&&) = default;
+    copyable_if& operator=(copyable_if const&) = delete;
+};
+} // namespace detail
+
+// A continuation monad ((a -> r) -> r) behind a fixed type.  The wrapped
+// callable is stored inline if it takes at most inline_size bytes and
+// moves without throwing, and on the heap otherwise; running the monad
+// passes the continuation as cont_ref.  So erasing a small callable,
+// like the result of mreturn<erased_cps<R, A> > or the continuations of
+// call_cc, and running it does not allocate.
+//
+// The monad runs its callable through a const reference, so the callable
+// must be callable as const: a lambda declared mutable is rejected.  The
+// callable must be copyable; unique_cont_monad<R, A> erases move-only
+// callables and is itself move-only.  mbind composes statically, like
+// cont_monad::mbind, and keeps this monad by value.
+template <typename R, typename A, bool Copyable = true>
+class type_erased_cont_monad : detail::copyable_if<Copyable> {
+    detail::erased_cont_storage<R, A> storage;
+public:
+    typedef A value_type;
+    static const std::size_t inline_size = detail::erased_cont_storage<R, A>::inline_size;
+
+    type_erased_cont_monad() = default;
+
+    // any callable that can be run with a continuation a -> r:
+    // cont_monad, std::function<R(std::function<R(A)>)>, ...
+    template <typename F,
+              typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<F>::type, type_erased_cont_monad>::value>::type,
+              typename = decltype(std::declval<typename std::decay<F>::type const&>()(
+                                      std::declval<cont_ref<R, A> >()))>
+    type_erased_cont_monad(F&& f)
+        : storage(std::forward<F>(f))
+    {
+        static_assert(!Copyable || std::is_copy_constructible<typename std::decay<F>::type>::value,
+                      "type_erased_cont_monad: a move-only callable needs unique_cont_monad");
+    }
+
+    type_erased_cont_monad(type_erased_cont_monad&&) = default;
+    type_erased_cont_monad(type_erased_cont_monad const&) = default;
+    type_erased_cont_monad& operator=(type_erased_cont_monad&&) = default;
+    type_erased_cont_monad& operator=(type_erased_cont_monad const&) = default;
+
+    explicit operator bool() const { return !storage.empty(); }
+
+    R operator()(cont_ref<R, A> k) const
+    {
+        return storage.call(k);
+    }
+
+    // first argument  s :: type_erased_cont_monad ((a->r)->r)
+    // second argument f :: a -> (cont_monad ((b->r)->r))
+    // return type       :: cont_monad ((b->r)->r)
+    template <typename MakeContMonad>
+    auto mbind(MakeContMonad&& f) const&
+        -> decltype(make_cont_monad(detail::take_b_to_r_return_r_storing_s_and_f<type_erased_cont_monad, typename std::decay<MakeContMonad>::type>{*this,std::forward<MakeContMonad>(f)}))
+    {
+        using Ret = detail::take_b_to_r_return_r_storing_s_and_f<type_erased_cont_monad, typename std::decay<MakeContMonad>::type>;
+        return make_cont_monad(Ret{*this,std::forward<MakeContMonad>(f)});
     }
 
     template <typename MakeContMonad>
-    auto mbind(MakeContMonad&& f) const
-        -> decltype(make_cont_erased(detail::take_b_to_r_return_r_storing_s_and_f<type_erased_cont_monad, MakeContMonad>{*this,std::forward<MakeContMonad>(f)}))
+    auto mbind(MakeContMonad&& f) &&
+        -> decltype(make_cont_monad(detail::take_b_to_r_return_r_storing_s_and_f<type_erased_cont_monad, typename std::decay<MakeContMonad>::type>{std::move(*this),std::forward<MakeContMonad>(f)}))
     {
-        using Ret = detail::take_b_to_r_return_r_storing_s_and_f<type_erased_cont_monad, MakeContMonad>;
-        return make_cont_erased(Ret{*this,std::forward<MakeContMonad>(f)});
+        using Ret = detail::take_b_to_r_return_r_storing_s_and_f<type_erased_cont_monad, typename std::decay<MakeContMonad>::type>;
+        return make_cont_monad(Ret{std::move(*this),std::forward<MakeContMonad>(f)});
     }
 };
 
+template <typename R, typename A, bool Copyable>
+const std::size_t type_erased_cont_monad<R, A, Copyable>::inline_size;
+
+// the move-only counterpart of type_erased_cont_monad, for callables
+// that cannot be copied
+template <typename R, typename A>
+using unique_cont_monad = type_erased_cont_monad<R, A, false>;
+
 template <typename R, typename A>
 type_erased_cont_monad<R, A>
 make_cont_erased(std::function<R(std::function<R(A)>)> f)
@@ -197,8 +476,7 @@ struct erased_cps {
     static auto mreturn(A a)
         -> type_erased_cont_monad<R, A>
     {
-        std::function<R(std::function<R(A)>)> apply([=](std::function<R(A)> f){return f(a);});
-        return make_cont_erased(std::move(apply));
+        return type_erased_cont_monad<R, A>(detail::apply_cps<A>{std::move(a)});
     }
 };
 
@@ -0,0 +1,606 @@
+// Boost.Monads.Coroutine
+//
+
+#ifndef BOOST_MONADS_COROUTINE_HPP
+#define BOOST_MONADS_COROUTINE_HPP
+
+#if defined(__has_include)
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#define BOOST_MONADS_HAS_COROUTINES
+#endif
+#endif
+
+#if defined(BOOST_MONADS_HAS_COROUTINES)
+
+#include "controlmonad.hpp"
+#include "future.hpp"
+#include "segment.hpp"
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace boost { namespace monads {
+
+// Do-notation with C++20 coroutines (only defined if the compiler
+// supports them; BOOST_MONADS_HAS_COROUTINES tells).  Instead of a chain
+// of >>= with one closure type per step, a coroutine returning the
+// monad co_awaits monads and compiles to one state machine:
+//
+//   co_cont<A>           -- a continuation monad; co_await any
+//                           continuation monad (cont_monad, erased,
+//                           trampolined, other co_conts) for its value.
+//                           Awaited monads must call their continuation
+//                           before they return, and only the first
+//                           value counts; a co_cont runs once.
+//   future<T>            -- co_await a future<T>; the coroutine runs on
+//                           until its first co_await of a pending future
+//                           and goes on in the thread that provides the
+//                           value, as then() does
+//   shared_blocking_queue<T>, shared_spsc_queue<T>
+//                        -- a stage: co_yield x pushes to the returned
+//                           queue, co_await r.next() on a reader(q)
+//                           takes the next element of q (nullopt at its
+//                           end), co_return closes the queue.  It runs
+//                           as a task on the executor of the first queue
+//                           argument, whose options it gets, suspends
+//                           instead of blocking, and moves batch_size
+//                           elements per push.  Cancelling the queue
+//                           cancels the queue arguments and ends the
+//                           coroutine at its next co_yield.  A stage
+//                           that throws closes its queue after what it
+//                           yielded and rethrows into the executor;
+//                           thread_pool, like std::thread, does not
+//                           catch, so there the exception terminates
+//                           the process.  An executor that should
+//                           survive it catches around the tasks it runs.
+//
+// The frames come from a per-thread cache of recently freed frames, so a
+// coroutine called over and over does not allocate once warmed up.
+
+namespace detail {
+// free frames by size in steps of 64 bytes, up to 1 KiB; larger frames
+// and more than `depth' frames of a size go to operator new/delete
+class frame_cache
+{
+    static constexpr std::size_t granule = 64;
+    static constexpr std::size_t classes = 16;
+    static constexpr std::size_t depth = 8;
+
+    struct block { block* next; };
+    block* free[classes] = {};
+    std::size_t count[classes] = {};
+
+    static bool& destroyed()
+    {
+        static thread_local bool gone = false;
+        return gone;
+    }
+public:
+    ~frame_cache()
+    {
+        destroyed() = true;
+        for (block* b : free)
+            while (b) {
+                block* next = b->next;
+                ::operator delete(b);
+                b = next;
+            }
+    }
+
+    static frame_cache* local()
+    {
+        static thread_local frame_cache cache;
+        return destroyed() ? nullptr : &cache;
+    }
+
+    static void* allocate(std::size_t n)
+    {
+        const std::size_t c = (n + granule - 1) / granule;
+        if (c >= classes)
+            return ::operator new(n);
+        frame_cache* cache = local();
+        if (cache && cache->free[c]) {
+            block* b = cache->free[c];
+            cache->free[c] = b->next;
+            --cache->count[c];
+            return b;
+        }
+        return ::operator new(c * granule);
+    }
+
+    static void deallocate(void* p, std::size_t n)
+    {
+        const std::size_t c = (n + granule - 1) / granule;
+        frame_cache* cache = c < classes ? local() : nullptr;
+        if (!cache || cache->count[c] == depth) {
+            ::operator delete(p);
+            return;
+        }
+        block* b = static_cast<block*>(p);
+        b->next = cache->free[c];
+        cache->free[c] = b;
+        ++cache->count[c];
+    }
+};
+
+// base of the promise types: their frames come from the cache
+struct cached_frame {
+    static void* operator new(std::size_t n) { return frame_cache::allocate(n); }
+    static void operator delete(void* p, std::size_t n) { frame_cache::deallocate(p, n); }
+};
+
+// The value type of a continuation monad: its value_type, or the
+// argument it passes to a continuation returning it tagged.
+template <typename T> struct type_tag { typedef T type; };
+
+struct cont_value_probe {
+    template <typename T>
+    type_tag<typename std::decay<T>::type> operator()(T&&) const { return {}; }
+};
+
+template <typename M, typename = void>
+struct cont_value {
+    typedef typename decltype(std::declval<M const&>()(cont_value_probe{}))::type type;
+};
+
+template <typename M>
+struct cont_value<M, std::void_t<typename M::value_type> > {
+    typedef typename M::value_type type;
+};
+
+// runs m with a continuation that resumes the coroutine; if m calls it
+// right away, the coroutine goes on without suspending, so a long chain
+// of awaits does not grow the stack
+template <typename M>
+class cont_awaiter
+{
+    typedef typename cont_value<M>::type A;
+
+    M m;
+    std::optional<A> value;
+    std::coroutine_handle<> handle;
+    bool inside;
+
+    struct resume {
+        cont_awaiter* self;
+        template <typename T>
+        void operator()(T&& a) const
+        {
+            if (self->value)
+                return;
+            self->value.emplace(std::forward<T>(a));
+            if (!self->inside)
+                self->handle.resume();
+        }
+    };
+public:
+    explicit cont_awaiter(M m) : m(std::move(m)), inside(false) {}
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        handle = h;
+        inside = true;
+        m(resume{this});
+        inside = false;
+        return !value;
+    }
+
+    A await_resume() { return std::move(*value); }
+};
+} // namespace detail
+
+template <typename A>
+class co_cont
+{
+public:
+    typedef A value_type;
+
+    struct promise_type : detail::cached_frame {
+        std::optional<A> value;
+        std::exception_ptr error;
+        bool started = false;
+
+        co_cont get_return_object()
+        {
+            return co_cont(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        template <typename U>
+        void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+        void unhandled_exception() { error = std::current_exception(); }
+
+        template <typename M>
+        detail::cont_awaiter<typename std::decay<M>::type> await_transform(M&& m)
+        {
+            return detail::cont_awaiter<typename std::decay<M>::type>(std::forward<M>(m));
+        }
+    };
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit co_cont(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+public:
+    co_cont(co_cont&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    co_cont& operator=(co_cont other) noexcept
+    {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+    ~co_cont()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    template <typename K>
+    auto operator()(K&& k) const
+        -> decltype(std::forward<K>(k)(std::declval<A>()))
+    {
+        promise_type& p = handle.promise();
+        if (p.started)
+            throw std::logic_error("co_cont: a coroutine runs only once");
+        p.started = true;
+        handle.resume();
+        if (!handle.done())
+            throw std::logic_error("co_cont: an awaited monad did not call its continuation");
+        if (p.error)
+            std::rethrow_exception(p.error);
+        return std::forward<K>(k)(std::move(*p.value));
+    }
+
+    // first argument  s :: co_cont a
+    // second argument f :: a -> (cont_monad ((b->r)->r))
+    // return type       :: cont_monad ((b->r)->r)
+    template <typename MakeContMonad>
+    auto mbind(MakeContMonad&& f) &&
+        -> decltype(make_cont_monad(detail::take_b_to_r_return_r_storing_s_and_f<co_cont, typename std::decay<MakeContMonad>::type>{std::move(*this),std::forward<MakeContMonad>(f)}))
+    {
+        using Ret = detail::take_b_to_r_return_r_storing_s_and_f<co_cont, typename std::decay<MakeContMonad>::type>;
+        return make_cont_monad(Ret{std::move(*this),std::forward<MakeContMonad>(f)});
+    }
+};
+
+namespace detail {
+template <typename T>
+class future_awaiter
+{
+    future<T> f;
+
+    static void on_ready(void* h)
+    {
+        std::coroutine_handle<>::from_address(h).resume();
+    }
+public:
+    explicit future_awaiter(future<T>&& f) : f(std::move(f)) {}
+
+    bool await_ready() const { return f.is_ready(); }
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        f.state->attach(continuation{&future_awaiter::on_ready, h.address()});
+    }
+    T await_resume() { return f.get(); }
+};
+
+template <typename T>
+struct future_promise : cached_frame {
+    promise<T> result;
+
+    future<T> get_return_object() { return result.get_future(); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    template <typename U>
+    void return_value(U&& v) { result.set_value(std::forward<U>(v)); }
+    void unhandled_exception() { result.set_exception(std::current_exception()); }
+};
+} // namespace detail
+
+template <typename T>
+detail::future_awaiter<T> operator co_await(future<T>&& f)
+{
+    return detail::future_awaiter<T>(std::move(f));
+}
+
+namespace detail {
+// the options of the first queue among a stream coroutine's arguments
+inline queue_options first_queue_options()
+{
+    return queue_options();
+}
+
+template <typename Q, typename... Args>
+auto first_queue_options(std::shared_ptr<Q> const& q, Args const&...)
+    -> decltype(q->options())
+{
+    return q->options();
+}
+
+template <typename X, typename... Args>
+queue_options first_queue_options(X const&, Args const&... args)
+{
+    return first_queue_options(args...);
+}
+
+// hooks that cancel the queues among a stream coroutine's arguments
+typedef std::vector<std::function<void()> > cancellers;
+
+inline void input_cancellers(cancellers&)
+{
+}
+
+template <typename X, typename... Args>
+void input_cancellers(cancellers& c, X const&, Args const&... args);
+
+template <typename Q, typename... Args>
+auto input_cancellers(cancellers& c, std::shared_ptr<Q> const& q, Args const&... args)
+    -> decltype(q->cancel(), void())
+{
+    c.push_back(cancel_input(q));
+    input_cancellers(c, args...);
+}
+
+template <typename X, typename... Args>
+void input_cancellers(cancellers& c, X const&, Args const&... args)
+{
+    input_cancellers(c, args...);
+}
+
+// resumes a stream coroutine.  One that ended with an exception is
+// suspended at its final point (see stream_promise::unhandled_exception),
+// so its frame is destroyed here before the exception goes on.
+template <typename Promise>
+void resume_stream(std::coroutine_handle<Promise> h)
+{
+    try {
+        h.resume();
+    } catch (...) {
+        h.destroy();
+        throw;
+    }
+}
+
+template <typename Queue>
+class stream_promise : public cached_frame
+{
+    typedef typename Queue::value_type T;
+    typedef std::coroutine_handle<stream_promise> handle;
+
+    std::shared_ptr<Queue> out;
+    std::vector<T> pending;
+    std::size_t sent;
+    std::size_t batch;
+
+    // posts continue_(last) to the executor, once out is writable
+    struct poster {
+        handle h;
+        bool last;
+        void operator()() const
+        {
+            handle self = h;
+            bool end = last;
+            self.promise().executor().post([self, end]() { self.promise().continue_(self, end); });
+        }
+    };
+
+    void continue_(handle h, bool last)
+    {
+        if (!flush(poster{h, last}))
+            return;
+        if (last) {
+            out->close();
+            h.destroy();
+        } else {
+            resume_stream(h);
+        }
+    }
+public:
+    template <typename... Args>
+    explicit stream_promise(Args const&... args)
+        : out(make_segment_queue<Queue>(first_queue_options(args...))), sent(0)
+        , batch(out->options().batch_size ? out->options().batch_size : 1)
+    {
+        pending.reserve(batch);
+        // cancelling the output ends the input queues, which the
+        // coroutine reads to their end
+        cancellers inputs;
+        input_cancellers(inputs, args...);
+        if (!inputs.empty())
+            out->on_cancel([inputs]() {
+                    for (auto const& cancel : inputs)
+                        cancel();
+                });
+    }
+
+    executor_ref executor() const { return out->options().executor; }
+
+    // pushes what fits; true once nothing is pending, otherwise resume is
+    // called once out is writable again (if it is not null)
+    template <typename F>
+    bool flush(F const& resume)
+    {
+        for (;;) {
+            const std::size_t n = out->try_push_n(std::make_move_iterator(pending.begin() + sent),
+                                                  pending.size() - sent);
+            sent += n;
+            if (sent == pending.size()) {
+                pending.clear();
+                sent = 0;
+                return true;
+            }
+            if (!n && out->notify_when_writable(resume))
+                return false;
+        }
+    }
+
+    // pushes what fits without waiting
+    void flush_some()
+    {
+        const std::size_t n = out->try_push_n(std::make_move_iterator(pending.begin() + sent),
+                                              pending.size() - sent);
+        sent += n;
+        if (sent == pending.size()) {
+            pending.clear();
+            sent = 0;
+        }
+    }
+
+    std::shared_ptr<Queue> get_return_object() { return out; }
+
+    struct start {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(handle h) const
+        {
+            h.promise().executor().post([h]() { resume_stream(h); });
+        }
+        void await_resume() const noexcept {}
+    };
+    start initial_suspend() noexcept { return start(); }
+
+    // a coroutine whose output is cancelled ends at its next co_yield:
+    // its frame is destroyed there, with the locals it holds
+    struct yield {
+        stream_promise* p;
+        bool await_ready() const noexcept
+        {
+            return p->pending.size() < p->batch && !p->out->cancelled();
+        }
+        bool await_suspend(handle h) const
+        {
+            if (p->out->cancelled()) {
+                p->out->close();
+                h.destroy();
+                return true;
+            }
+            return !p->flush(poster{h, false});
+        }
+        void await_resume() const noexcept {}
+    };
+    template <typename U>
+    yield yield_value(U&& x)
+    {
+        pending.push_back(std::forward<U>(x));
+        return yield{this};
+    }
+
+    struct finish {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(handle h) const noexcept { h.promise().continue_(h, true); }
+        void await_resume() const noexcept {}
+    };
+    finish final_suspend() noexcept { return finish(); }
+
+    void return_void() {}
+    // like an exception from a stage function, it goes on to the
+    // executor, but the stage ends first: what fits is pushed, out is
+    // closed, and resume_stream destroys the frame, with the input queues
+    // it holds
+    void unhandled_exception()
+    {
+        flush_some();
+        out->close();
+        throw;
+    }
+};
+
+// awaits the next element of a queue in a stream coroutine
+template <typename Queue>
+class stream_next
+{
+    typedef typename Queue::value_type T;
+
+    Queue& in;
+    std::vector<T>& items;
+    std::size_t& pos;
+
+    bool refill()
+    {
+        items.clear();
+        pos = 0;
+        return in.try_pop_batch(std::back_inserter(items), items.capacity()) || in.drained();
+    }
+public:
+    stream_next(Queue& in, std::vector<T>& items, std::size_t& pos) : in(in), items(items), pos(pos) {}
+
+    bool await_ready() { return pos < items.size() || refill(); }
+
+    template <typename Promise>
+    bool await_suspend(std::coroutine_handle<Promise> h)
+    {
+        // what was produced so far goes downstream before waiting
+        h.promise().flush_some();
+        executor_ref ex = h.promise().executor();
+        for (;;) {
+            if (in.notify_when_readable([ex, h]() { ex.post([h]() { resume_stream(h); }); }))
+                return true;
+            if (refill())
+                return false;
+        }
+    }
+
+    std::optional<T> await_resume()
+    {
+        if (pos == items.size())
+            refill();
+        if (pos < items.size())
+            return std::optional<T>(std::move(items[pos++]));
+        return std::nullopt;
+    }
+};
+} // namespace detail
+
+// the consumer side of a queue in a stream coroutine
+template <typename Queue>
+class stream_reader
+{
+    std::shared_ptr<Queue> in;
+    std::vector<typename Queue::value_type> items;
+    std::size_t pos;
+public:
+    explicit stream_reader(std::shared_ptr<Queue> in) : in(std::move(in)), pos(0)
+    {
+        items.reserve(this->in->options().batch_size ? this->in->options().batch_size : 1);
+    }
+
+    detail::stream_next<Queue> next() { return detail::stream_next<Queue>(*in, items, pos); }
+};
+
+template <typename Queue>
+stream_reader<Queue> reader(std::shared_ptr<Queue> q)
+{
+    return stream_reader<Queue>(std::move(q));
+}
+
+}} // namespace boost::monads
+
+namespace std {
+template <typename T, typename... Args>
+struct coroutine_traits<boost::monads::future<T>, Args...> {
+    typedef boost::monads::detail::future_promise<T> promise_type;
+};
+
+template <typename T, typename... Args>
+struct coroutine_traits<shared_ptr<boost::monads::blocking_queue<T> >, Args...> {
+    typedef boost::monads::detail::stream_promise<boost::monads::blocking_queue<T> > promise_type;
+};
+
+template <typename T, typename... Args>
+struct coroutine_traits<shared_ptr<boost::monads::spsc_queue<T> >, Args...> {
+    typedef boost::monads::detail::stream_promise<boost::monads::spsc_queue<T> > promise_type;
+};
+} // namespace std
+
+#endif // BOOST_MONADS_HAS_COROUTINES
+
+#endif // BOOST_MONADS_COROUTINE_HPP
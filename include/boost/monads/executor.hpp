@@ -0,0 +1,266 @@
+// Boost.Monads.Executor
+//
+
+#ifndef BOOST_MONADS_EXECUTOR_HPP
+#define BOOST_MONADS_EXECUTOR_HPP
+
+#include "placement.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace boost { namespace monads {
+
+// An executor is anything that runs nullary tasks:
+//
+// struct executor_archetype {
+//     // run task() exactly once, on any thread, possibly before post returns
+//     template <typename F>
+//     void post(F&& task);
+// };
+//
+// What a task throws goes to the executor.  The executors below do not
+// catch it: on thread_pool and thread_executor, as on a std::thread, it
+// ends in std::terminate, and inline_executor passes it to the poster.
+//
+// Stages scheduled on an executor must not block; they suspend by
+// registering a resumption with the queue they wait for instead.
+
+// runs the task on the calling thread
+struct inline_executor {
+    template <typename F>
+    void post(F&& task) { std::forward<F>(task)(); }
+};
+
+// one detached thread per task, i.e. the behaviour before executors
+struct thread_executor {
+    template <typename F>
+    void post(F&& task) { std::thread(std::forward<F>(task)).detach(); }
+};
+
+// Work-stealing pool.  Tasks posted from a worker go to the back of its
+// own deque and are taken LIFO; idle workers steal from the front of the
+// other deques.  Tasks posted from outside go to a shared FIFO.
+// With a placement (see placement.hpp) the workers are pinned, worker i
+// next to workers i - 1 and i + 1, which it steals from first.
+class thread_pool
+{
+    typedef std::function<void()> task;
+    struct task_queue {
+        std::mutex mutex;
+        std::deque<task> tasks;
+    };
+
+    std::vector<std::unique_ptr<task_queue> > local;
+    task_queue injected;
+    std::vector<std::thread> threads;
+    std::atomic<std::size_t> pending;
+    std::atomic<std::size_t> sleeping;
+    std::atomic<bool> stopping;
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cond;
+    placement where;
+    // per worker, the cpus it may run on; empty for no placement
+    std::vector<std::vector<int> > cpus;
+
+    static const std::size_t no_worker = std::size_t(-1);
+
+    struct current_worker {
+        thread_pool* pool;
+        std::size_t index;
+    };
+    static current_worker& current()
+    {
+        static thread_local current_worker w = {nullptr, no_worker};
+        return w;
+    }
+    std::size_t self() const
+    {
+        return current().pool == this ? current().index : no_worker;
+    }
+
+    static bool pop_back(task_queue& q, task& t)
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty())
+            return false;
+        t = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        return true;
+    }
+    static bool pop_front(task_queue& q, task& t)
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty())
+            return false;
+        t = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        return true;
+    }
+    void start(std::size_t n)
+    {
+        if (!n)
+            n = 1;
+        for (std::size_t i = 0; i < n; ++i)
+            local.emplace_back(new task_queue);
+        for (std::size_t i = 0; i < n; ++i)
+            threads.emplace_back(&thread_pool::run, this, i);
+    }
+    bool take(std::size_t me, task& t)
+    {
+        if (me != no_worker && pop_back(*local[me], t))
+            return true;
+        if (pop_front(injected, t))
+            return true;
+        const std::size_t n = local.size();
+        for (std::size_t i = 1; i <= n; ++i)
+            if (pop_front(*local[(me + i) % n], t))
+                return true;
+        return false;
+    }
+    void run(std::size_t me)
+    {
+        current().pool = this;
+        current().index = me;
+        if (!cpus.empty())
+            run_this_thread_on(cpus[me]);
+        for (task t; !stopping.load();) {
+            if (take(me, t)) {
+                --pending;
+                t();
+                t = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            ++sleeping;
+            sleep_cond.wait(lock, [this]() { return stopping.load() || pending.load() > 0; });
+            --sleeping;
+        }
+    }
+public:
+    explicit thread_pool(std::size_t n = std::thread::hardware_concurrency())
+        : pending(0), sleeping(0), stopping(false)
+    {
+        start(n);
+    }
+    // n workers placed by p; with more workers than cpus, they wrap around
+    thread_pool(std::size_t n, placement const& p)
+        : pending(0), sleeping(0), stopping(false), where(p)
+    {
+        const std::vector<int> available = cpu_topology::get().cpus(p.node);
+        for (std::size_t i = 0; i < (n ? n : 1); ++i)
+            if (p.pin_threads)
+                cpus.push_back(std::vector<int>(1, available[i % available.size()]));
+            else
+                cpus.push_back(available);
+        start(n);
+    }
+    thread_pool(thread_pool const&) = delete;
+    thread_pool& operator=(thread_pool const&) = delete;
+
+    // tasks that have not started yet are dropped
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        sleep_cond.notify_all();
+        for (auto& t : threads)
+            t.join();
+    }
+
+    std::size_t size() const { return threads.size(); }
+    placement const& placed() const { return where; }
+
+    template <typename F>
+    void post(F&& f)
+    {
+        const std::size_t me = self();
+        task_queue& q = me == no_worker ? injected : *local[me];
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.emplace_back(std::forward<F>(f));
+        }
+        ++pending;
+        if (sleeping.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            sleep_cond.notify_one();
+        }
+    }
+
+    // run one queued task on the calling thread; used to wait without
+    // taking a worker away from the pool
+    bool run_pending_task()
+    {
+        task t;
+        if (!take(self(), t))
+            return false;
+        --pending;
+        t();
+        return true;
+    }
+};
+
+inline thread_pool& default_executor()
+{
+    static thread_pool pool;
+    return pool;
+}
+
+// Wait for f without blocking the pool: queued tasks are run meanwhile.
+template <typename T>
+void wait_helping(thread_pool& pool, std::future<T> const& f)
+{
+    while (f.wait_for(std::chrono::seconds(0)) == std::future_status::timeout)
+        if (!pool.run_pending_task())
+            std::this_thread::yield();
+}
+
+// Non-owning, type-erased handle to an executor, so that stages can carry
+// one around at runtime.  A default constructed executor_ref posts to
+// default_executor().
+class executor_ref
+{
+    void* ex;
+    void (*post_)(void*, std::function<void()>&&);
+
+    template <typename Executor>
+    static void post_to(void* e, std::function<void()>&& task)
+    {
+        static_cast<Executor*>(e)->post(std::move(task));
+    }
+public:
+    executor_ref() : ex(nullptr), post_(nullptr) {}
+
+    template <typename Executor,
+              typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<Executor>::type, executor_ref>::value>::type>
+    executor_ref(Executor& e)
+        : ex(&e), post_(&post_to<Executor>)
+    {
+    }
+
+    void post(std::function<void()> task) const
+    {
+        if (post_)
+            post_(ex, std::move(task));
+        else
+            default_executor().post(std::move(task));
+    }
+};
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_EXECUTOR_HPP
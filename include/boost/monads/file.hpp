@@ -0,0 +1,375 @@
+// Boost.Monads.File
+//
+
+#ifndef BOOST_MONADS_FILE_HPP
+#define BOOST_MONADS_FILE_HPP
+
+#include "monad.hpp"
+#include "future.hpp"
+#include "segment.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace boost { namespace monads {
+
+// Files as the two ends of a segment pipeline (POSIX).
+//
+// from_file<SegmentMonad>(path) maps the file read-only and emits one
+// file_record per line (or per fixed-size record with from_file_records):
+// a pointer and length into the mapping, so the bytes are never copied.
+// Every record shares ownership of the mapping, so a record stays valid
+// however long a later stage keeps it, and the file is unmapped when the
+// last one is gone.  Moving a record along the queues is free; copying
+// one costs a reference count.
+//
+// write_to(q, path) is the matching sink: the elements of q go into a
+// buffer of file_sink_options::buffer_size bytes, each followed by the
+// separator, and the buffer goes to the file in one write(2) whenever it
+// is full.  The returned future gets the number of bytes written once q
+// is drained, or the error that stopped the writing.
+
+class mapped_file
+{
+    const char* first;
+    std::size_t length;
+public:
+    // throws std::system_error if the file cannot be opened or mapped
+    explicit mapped_file(std::string const& path)
+        : first(nullptr), length(0)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) < 0) {
+            const int e = errno;
+            ::close(fd);
+            throw std::system_error(e, std::generic_category(), "fstat " + path);
+        }
+        length = static_cast<std::size_t>(st.st_size);
+        if (length) {
+            void* p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                const int e = errno;
+                ::close(fd);
+                throw std::system_error(e, std::generic_category(), "mmap " + path);
+            }
+            // read ahead, and drop pages behind the reader first
+            ::madvise(p, length, MADV_SEQUENTIAL);
+            first = static_cast<const char*>(p);
+        }
+        // the mapping keeps the file
+        ::close(fd);
+    }
+    ~mapped_file()
+    {
+        if (first)
+            ::munmap(const_cast<char*>(first), length);
+    }
+    mapped_file(mapped_file const&) = delete;
+    mapped_file& operator=(mapped_file const&) = delete;
+
+    const char* data() const { return first; }
+    std::size_t size() const { return length; }
+};
+
+// [data(), data() + size()) of a mapped file
+class file_record
+{
+    std::shared_ptr<mapped_file const> owner;
+    const char* first;
+    std::size_t length;
+public:
+    file_record() : first(nullptr), length(0) {}
+    file_record(std::shared_ptr<mapped_file const> owner, const char* first, std::size_t length)
+        : owner(std::move(owner)), first(first), length(length)
+    {
+    }
+
+    const char* data() const { return first; }
+    std::size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    const char* begin() const { return first; }
+    const char* end() const { return first + length; }
+    char operator[](std::size_t i) const { return first[i]; }
+
+    std::string str() const { return std::string(first, length); }
+    std::shared_ptr<mapped_file const> const& file() const { return owner; }
+};
+
+inline bool operator==(file_record const& r, std::string const& s)
+{
+    return r.size() == s.size() && std::memcmp(r.data(), s.data(), s.size()) == 0;
+}
+
+inline bool operator==(std::string const& s, file_record const& r)
+{
+    return r == s;
+}
+
+inline bool operator!=(file_record const& r, std::string const& s)
+{
+    return !(r == s);
+}
+
+inline bool operator!=(std::string const& s, file_record const& r)
+{
+    return !(r == s);
+}
+
+struct file_sink_options {
+    // bytes collected per write(2)
+    std::size_t buffer_size = std::size_t(1) << 20;
+    // written after every element
+    std::string separator = "\n";
+};
+
+namespace detail {
+// splits at a delimiter, which is not part of the record; a last record
+// without delimiter is emitted too
+struct split_lines {
+    char delimiter;
+
+    std::size_t operator()(const char* pos, const char* end, std::size_t& skip) const
+    {
+        const void* d = std::memchr(pos, delimiter, end - pos);
+        if (!d) {
+            skip = 0;
+            return end - pos;
+        }
+        skip = 1;
+        return static_cast<const char*>(d) - pos;
+    }
+};
+
+// records of a fixed size; the last one may be shorter
+struct split_fixed {
+    std::size_t record_size;
+
+    std::size_t operator()(const char* pos, const char* end, std::size_t& skip) const
+    {
+        skip = 0;
+        const std::size_t left = end - pos;
+        return left < record_size ? left : record_size;
+    }
+};
+
+// emits the records of a mapped file in chunks of batch_size
+template <typename Queue, typename Split>
+struct file_source : resumable<file_source<Queue, Split> > {
+    std::weak_ptr<Queue> output;
+    std::shared_ptr<Queue> out;
+    std::shared_ptr<mapped_file const> file;
+    const char* pos;
+    const char* end;
+    Split split;
+    std::size_t batch;
+    std::vector<file_record> pending;
+    std::size_t pushed = 0;
+    stage_probe stats;
+
+    file_source(std::shared_ptr<Queue> const& out, std::shared_ptr<mapped_file const> file, Split split)
+        : output(out), file(std::move(file))
+        , pos(this->file->data()), end(this->file->data() + this->file->size())
+        , split(split)
+        , batch(out->options().batch_size ? out->options().batch_size : 1)
+    {
+        this->executor = out->options().executor;
+        pending.reserve(batch);
+        stats.attach(out->options().metrics, "file", 0, queue_id(*out));
+    }
+
+    void fill()
+    {
+        while (pending.size() < batch && pos != end) {
+            std::size_t skip;
+            const std::size_t n = split(pos, end, skip);
+            pending.emplace_back(file, pos, n);
+            pos += n + skip;
+        }
+    }
+
+    void run()
+    {
+        stage_probe::busy_timer busy(stats);
+        held_output<Queue> hold(out, output);
+        for (;;) {
+            if (!out || out->cancelled())
+                break;
+            if (pushed == pending.size()) {
+                pending.clear();
+                pushed = 0;
+                fill();
+                if (pending.empty())
+                    break;
+            }
+            const std::size_t k = out->try_push_n(std::make_move_iterator(pending.begin() + pushed),
+                                                  pending.size() - pushed);
+            stats.produced(k);
+            pushed += k;
+            if (!k && out->notify_when_writable(this->resumer()))
+                return;
+        }
+        file.reset();
+        if (out)
+            out->close();
+    }
+};
+
+template <typename SegmentMonad, typename Split>
+std::shared_ptr<typename SegmentMonad::template queue_type<file_record> >
+from_mapped_file(std::string const& path, queue_options const& options, Split split)
+{
+    typedef typename SegmentMonad::template queue_type<file_record> queue;
+    auto file = std::make_shared<mapped_file const>(path);
+    auto out = make_segment_queue<queue>(options);
+    std::make_shared<file_source<queue, Split> >(out, std::move(file), split)->start();
+    return out;
+}
+
+// the bytes of an element: anything with data() and size(), or a number
+template <typename T>
+auto append_element(first_choice, std::string& buffer, T const& x)
+    -> decltype(buffer.append(x.data(), x.size()), void())
+{
+    buffer.append(x.data(), x.size());
+}
+
+template <typename T>
+auto append_element(second_choice, std::string& buffer, T const& x)
+    -> decltype(buffer.append(std::to_string(x)), void())
+{
+    buffer.append(std::to_string(x));
+}
+
+struct file_sink {
+    int fd;
+    bool owns_fd;
+    std::size_t capacity;
+    std::string separator;
+    std::string buffer;
+    std::size_t written = 0;
+    std::exception_ptr error;
+    promise<std::size_t> done;
+
+    file_sink(int fd, bool owns_fd, file_sink_options const& options)
+        : fd(fd), owns_fd(owns_fd)
+        , capacity(options.buffer_size ? options.buffer_size : 1)
+        , separator(options.separator)
+    {
+        buffer.reserve(capacity);
+    }
+
+    // after the first error the rest is dropped
+    void write_all(const char* p, std::size_t n)
+    {
+        while (n && !error) {
+            const ssize_t k = ::write(fd, p, n);
+            if (k < 0) {
+                if (errno != EINTR)
+                    error = std::make_exception_ptr(
+                        std::system_error(errno, std::generic_category(), "write"));
+                continue;
+            }
+            p += k;
+            n -= k;
+            written += k;
+        }
+    }
+
+    void flush()
+    {
+        write_all(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    template <typename T>
+    void push(T const& x)
+    {
+        append_element(make_choice{}, buffer, x);
+        buffer.append(separator);
+        if (buffer.size() >= capacity)
+            flush();
+    }
+
+    void close()
+    {
+        flush();
+        if (owns_fd && ::close(fd) < 0 && !error)
+            error = std::make_exception_ptr(std::system_error(errno, std::generic_category(), "close"));
+        if (error)
+            done.set_exception(error);
+        else
+            done.set_value(written);
+    }
+};
+
+template <typename Queue>
+future<std::size_t> write_to_fd(std::shared_ptr<Queue> const& q, int fd, bool owns_fd,
+                                file_sink_options const& options)
+{
+    auto sink = std::make_shared<file_sink>(fd, owns_fd, options);
+    future<std::size_t> done = sink->done.get_future();
+    consume(q,
+            [sink](typename Queue::value_type&& x) { sink->push(x); },
+            [sink]() { sink->close(); });
+    return done;
+}
+} // namespace detail
+
+// the lines of the file at path, without the delimiter
+template <typename SegmentMonad>
+std::shared_ptr<typename SegmentMonad::template queue_type<file_record> >
+from_file(std::string const& path, queue_options const& options = queue_options(),
+          char delimiter = '\n')
+{
+    return detail::from_mapped_file<SegmentMonad>(path, options, detail::split_lines{delimiter});
+}
+
+// the file at path in records of record_size bytes
+template <typename SegmentMonad>
+std::shared_ptr<typename SegmentMonad::template queue_type<file_record> >
+from_file_records(std::string const& path, std::size_t record_size,
+                  queue_options const& options = queue_options())
+{
+    return detail::from_mapped_file<SegmentMonad>(path, options,
+                                                  detail::split_fixed{record_size ? record_size : 1});
+}
+
+// writes the elements of q to the file at path, which is created or
+// truncated; throws std::system_error if it cannot be opened
+template <typename Queue>
+future<std::size_t> write_to(std::shared_ptr<Queue> const& q, std::string const& path,
+                             file_sink_options const& options = file_sink_options())
+{
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+    return detail::write_to_fd(q, fd, true, options);
+}
+
+// the same for an open file descriptor, e.g. 1 for stdout, which stays open
+template <typename Queue>
+future<std::size_t> write_to(std::shared_ptr<Queue> const& q, int fd,
+                             file_sink_options const& options = file_sink_options())
+{
+    return detail::write_to_fd(q, fd, false, options);
+}
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_FILE_HPP
@@ -0,0 +1,491 @@
+// Boost.Monads.Future
+//
+
+#ifndef BOOST_MONADS_FUTURE_HPP
+#define BOOST_MONADS_FUTURE_HPP
+
+#include "monad.hpp"
+#include "executor.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace boost { namespace monads {
+
+// A future with continuations.  A shared state holds the value (or an
+// exception) and at most one continuation; whichever of set_value and
+// attach comes second runs the continuation, so a continuation attached
+// to a ready future runs right away on the attaching thread.  then() and
+// mbind allocate one state per step that also serves as the
+// continuation, so a chain of N binds costs N small allocations.
+// future<void> carries no value: then(f) gives one when f returns
+// nothing, and its own continuations are called without an argument.
+
+template <typename T> class future;
+template <typename T> class promise;
+
+namespace detail {
+template <typename T> class future_awaiter;
+
+struct continuation {
+    void (*run)(void*);
+    void* context;
+};
+
+// refs, readiness, error and continuation of a shared state; the value
+// lives in future_state<T>, and future_state<void> has none
+class future_state_base
+{
+    enum { pending, attached, ready };
+
+    std::atomic<unsigned> refs;
+    std::atomic<int> status;
+    continuation cont;
+protected:
+    std::exception_ptr error;
+
+    void publish()
+    {
+        if (status.exchange(ready, std::memory_order_acq_rel) == attached)
+            cont.run(cont.context);
+    }
+public:
+    future_state_base() : refs(1), status(pending), cont() {}
+    future_state_base(future_state_base const&) = delete;
+    future_state_base& operator=(future_state_base const&) = delete;
+    virtual ~future_state_base() {}
+
+    void add_ref() { refs.fetch_add(1, std::memory_order_relaxed); }
+    void release()
+    {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+    bool is_ready() const { return status.load(std::memory_order_acquire) == ready; }
+
+    void set_exception(std::exception_ptr e)
+    {
+        error = e;
+        publish();
+    }
+
+    // c runs once the state is ready; at most one continuation per state
+    void attach(continuation c)
+    {
+        cont = c;
+        int expected = pending;
+        if (!status.compare_exchange_strong(expected, attached, std::memory_order_acq_rel))
+            c.run(c.context);
+    }
+};
+
+template <typename T>
+class future_state : public future_state_base
+{
+    bool has_value;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+public:
+    future_state() : has_value(false) {}
+
+    ~future_state()
+    {
+        if (has_value)
+            reinterpret_cast<T*>(&storage)->~T();
+    }
+
+    template <typename U>
+    void set_value(U&& value)
+    {
+        ::new (static_cast<void*>(&storage)) T(std::forward<U>(value));
+        has_value = true;
+        publish();
+    }
+
+    // only after the state is ready
+    T take()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*reinterpret_cast<T*>(&storage));
+    }
+};
+
+template <>
+class future_state<void> : public future_state_base
+{
+public:
+    void set_value() { publish(); }
+
+    // only after the state is ready
+    void take()
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+// what f makes of the value of a future<T>: f(value), or f() for void;
+// no type if f does not take it
+template <typename F, typename T, typename = void>
+struct continuation_result {};
+
+template <typename F, typename T>
+struct continuation_result<F, T, decltype(void(std::declval<F>()(std::declval<T>())))> {
+    typedef typename std::decay<decltype(std::declval<F>()(std::declval<T>()))>::type type;
+};
+
+template <typename F>
+struct continuation_result<F, void, decltype(void(std::declval<F>()()))> {
+    typedef typename std::decay<decltype(std::declval<F>()())>::type type;
+};
+
+template <typename F, typename T>
+using result_of_t = typename continuation_result<F, T>::type;
+
+// f applied to the value of the ready state s
+template <typename F, typename T>
+auto call_with_value(F& f, future_state<T>& s) -> decltype(f(s.take()))
+{
+    return f(s.take());
+}
+
+template <typename F>
+auto call_with_value(F& f, future_state<void>& s) -> decltype(f())
+{
+    s.take();
+    return f();
+}
+
+// target.set_value(g()), or g() and then target.set_value() when g
+// returns void; target is a state or a promise
+template <typename Target, typename G>
+auto set_result(Target& target, G&& g) -> decltype(target.set_value(g()))
+{
+    target.set_value(g());
+}
+
+template <typename Target, typename G>
+auto set_result(Target& target, G&& g)
+    -> typename std::enable_if<std::is_void<decltype(g())>::value>::type
+{
+    g();
+    target.set_value();
+}
+
+// state of then(f): continuation of the antecedent and result in one
+template <typename T, typename F, typename R>
+class then_state : public future_state<R>
+{
+    future_state<T>* antecedent;
+    F f;
+    executor_ref executor;
+    bool post;
+
+    void run()
+    {
+        try {
+            set_result(*this, [this]() { return call_with_value(f, *antecedent); });
+        } catch (...) {
+            this->set_exception(std::current_exception());
+        }
+        antecedent->release();
+        this->release();
+    }
+    static void on_ready(void* p)
+    {
+        then_state* self = static_cast<then_state*>(p);
+        if (self->post)
+            self->executor.post([self]() { self->run(); });
+        else
+            self->run();
+    }
+public:
+    then_state(future_state<T>* antecedent, F f, executor_ref executor, bool post)
+        : antecedent(antecedent), f(std::move(f)), executor(executor), post(post)
+    {
+    }
+    // the antecedent's continuation holds a reference to this state
+    void start()
+    {
+        this->add_ref();
+        antecedent->attach(continuation{&then_state::on_ready, this});
+    }
+};
+
+// state of mbind: like then_state, but f returns a future whose value is
+// forwarded once it arrives
+template <typename T, typename F, typename U>
+class bind_state : public future_state<U>
+{
+    future_state<T>* antecedent;
+    future_state<U>* inner;
+    F f;
+
+    static void on_inner_ready(void* p)
+    {
+        bind_state* self = static_cast<bind_state*>(p);
+        try {
+            set_result(*self, [self]() { return self->inner->take(); });
+        } catch (...) {
+            self->set_exception(std::current_exception());
+        }
+        self->inner->release();
+        self->release();
+    }
+    static void on_ready(void* p)
+    {
+        bind_state* self = static_cast<bind_state*>(p);
+        try {
+            self->inner = call_with_value(self->f, *self->antecedent).detach();
+            // f returned a future without a state, which never gets ready
+            if (!self->inner)
+                self->set_exception(std::make_exception_ptr(
+                    std::future_error(std::future_errc::no_state)));
+        } catch (...) {
+            self->set_exception(std::current_exception());
+        }
+        self->antecedent->release();
+        if (self->inner)
+            self->inner->attach(continuation{&bind_state::on_inner_ready, self});
+        else
+            self->release();
+    }
+public:
+    bind_state(future_state<T>* antecedent, F&& f)
+        : antecedent(antecedent), inner(nullptr), f(std::move(f))
+    {
+    }
+    void start()
+    {
+        this->add_ref();
+        antecedent->attach(continuation{&bind_state::on_ready, this});
+    }
+};
+} // namespace detail
+
+template <typename T>
+class future
+{
+    template <typename> friend class future;
+    template <typename> friend class promise;
+    template <typename, typename, typename> friend class detail::bind_state;
+    template <typename> friend class detail::future_awaiter;
+    template <typename U> friend future<typename std::decay<U>::type> make_ready_future(U&&);
+    friend future<void> make_ready_future();
+    template <typename U, typename F>
+    friend future<typename detail::result_of_t<F, U>::value_type> boost_mbind(future<U>, F);
+
+    detail::future_state<T>* state;
+
+    explicit future(detail::future_state<T>* state) : state(state) {}
+
+    detail::future_state<T>* detach()
+    {
+        detail::future_state<T>* s = state;
+        state = nullptr;
+        return s;
+    }
+
+    template <typename F, typename R = detail::result_of_t<F, T> >
+    future<R> then_(F&& f, executor_ref executor, bool post)
+    {
+        typedef detail::then_state<T, typename std::decay<F>::type, R> state_type;
+        state_type* s = new state_type(detach(), std::forward<F>(f), executor, post);
+        s->start();
+        return future<R>(s);
+    }
+public:
+    typedef T value_type;
+
+    future() : state(nullptr) {}
+    future(future&& other) : state(other.detach()) {}
+    future& operator=(future&& other)
+    {
+        if (this != &other) {
+            if (state)
+                state->release();
+            state = other.detach();
+        }
+        return *this;
+    }
+    ~future()
+    {
+        if (state)
+            state->release();
+    }
+
+    bool valid() const { return state != nullptr; }
+    bool is_ready() const { return state && state->is_ready(); }
+
+    // blocks until the value arrives; do not call from a task on an
+    // executor whose threads the producer needs
+    T get()
+    {
+        if (!state->is_ready()) {
+            struct waiter {
+                std::mutex mutex;
+                std::condition_variable cond;
+                bool done = false;
+                static void notify(void* p)
+                {
+                    waiter* w = static_cast<waiter*>(p);
+                    std::lock_guard<std::mutex> lock(w->mutex);
+                    w->done = true;
+                    w->cond.notify_one();
+                }
+            } w;
+            state->attach(detail::continuation{&waiter::notify, &w});
+            std::unique_lock<std::mutex> lock(w.mutex);
+            w.cond.wait(lock, [&]() { return w.done; });
+        }
+        struct releaser {
+            detail::future_state<T>* s;
+            ~releaser() { s->release(); }
+        } r = {detach()};
+        return r.s->take();
+    }
+
+    // f(value) runs on the thread that provides the value, or right away
+    // if the future is ready; consumes the future
+    template <typename F>
+    auto then(F&& f) -> future<detail::result_of_t<F, T> >
+    {
+        return then_(std::forward<F>(f), executor_ref(), false);
+    }
+
+    // f(value) is posted to executor once the value arrives
+    template <typename Executor, typename F>
+    auto then(Executor& executor, F&& f) -> future<detail::result_of_t<F, T> >
+    {
+        return then_(std::forward<F>(f), executor_ref(executor), true);
+    }
+};
+
+template <typename T>
+class promise
+{
+    detail::future_state<T>* state;
+public:
+    promise() : state(new detail::future_state<T>()) {}
+    promise(promise&& other) : state(other.state)
+    {
+        other.state = nullptr;
+    }
+    promise(promise const&) = delete;
+    promise& operator=(promise const&) = delete;
+    ~promise()
+    {
+        if (state) {
+            state->set_exception(std::make_exception_ptr(
+                std::future_error(std::future_errc::broken_promise)));
+            state->release();
+        }
+    }
+
+    future<T> get_future()
+    {
+        state->add_ref();
+        return future<T>(state);
+    }
+
+    // set_value() for promise<void>; a promise is satisfied once, a
+    // second value or exception throws promise_already_satisfied
+    template <typename... U>
+    void set_value(U&&... value)
+    {
+        detail::future_state<T>* s = satisfy();
+        s->set_value(std::forward<U>(value)...);
+        s->release();
+    }
+    void set_exception(std::exception_ptr e)
+    {
+        detail::future_state<T>* s = satisfy();
+        s->set_exception(e);
+        s->release();
+    }
+private:
+    detail::future_state<T>* satisfy()
+    {
+        if (!state)
+            throw std::future_error(std::future_errc::promise_already_satisfied);
+        detail::future_state<T>* s = state;
+        state = nullptr;
+        return s;
+    }
+};
+
+template <typename T>
+future<typename std::decay<T>::type> make_ready_future(T&& value)
+{
+    auto s = new detail::future_state<typename std::decay<T>::type>();
+    s->set_value(std::forward<T>(value));
+    return future<typename std::decay<T>::type>(s);
+}
+
+inline future<void> make_ready_future()
+{
+    auto s = new detail::future_state<void>();
+    s->set_value();
+    return future<void>(s);
+}
+
+namespace detail {
+template <typename F>
+using nullary_result_t = typename std::decay<decltype(std::declval<F>()())>::type;
+
+template <typename R, typename F>
+struct async_task {
+    std::shared_ptr<promise<R> > p;
+    F f;
+    void operator()()
+    {
+        try {
+            set_result(*p, [this]() { return f(); });
+        } catch (...) {
+            p->set_exception(std::current_exception());
+        }
+    }
+};
+} // namespace detail
+
+// run f() as a task on executor
+template <typename Executor, typename F>
+future<detail::nullary_result_t<F> > async(Executor& executor, F f)
+{
+    typedef detail::nullary_result_t<F> R;
+    auto p = std::make_shared<promise<R> >();
+    future<R> result = p->get_future();
+    executor.post(detail::async_task<R, F>{p, std::move(f)});
+    return result;
+}
+
+// mreturn is make_ready_future, mbind continues with f once the value is
+// there and forwards the value of the future f returns
+struct future_monad {
+    template <typename T>
+    static future<typename std::decay<T>::type> mreturn(T&& x)
+    {
+        return make_ready_future(std::forward<T>(x));
+    }
+};
+
+template <typename T, typename F>
+future<typename detail::result_of_t<F, T>::value_type> boost_mbind(future<T> m, F fun)
+{
+    typedef typename detail::result_of_t<F, T>::value_type U;
+    typedef detail::bind_state<T, F, U> state_type;
+    state_type* s = new state_type(m.detach(), std::move(fun));
+    s->start();
+    return future<U>(s);
+}
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_FUTURE_HPP
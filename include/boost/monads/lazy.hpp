@@ -0,0 +1,289 @@
+// Boost.Monads.Lazy
+//
+
+#ifndef BOOST_MONADS_LAZY_HPP
+#define BOOST_MONADS_LAZY_HPP
+
+#include "monad.hpp"
+#include "algorithm.hpp"
+
+#include <type_traits>
+#include <utility>
+
+namespace boost { namespace monads {
+
+// monad_piper binds at every >>=, nesting one monad in the next.  A
+// lazy_piper instead records >>=, fmap and join as an expression and
+// only builds the monad at unpipe(), rewriting the expression with the
+// monad laws first:
+//   mreturn(a) >>= f        ==  f(a)                     (left identity)
+//   (m >>= f) >>= g         ==  m >>= [](x){ f(x) >>= g }  (associativity)
+//   fmap(f, mreturn(a))     ==  mreturn(f(a))
+//   fmap(g, fmap(f, m))     ==  fmap(g . f, m)           (fusion)
+//   fmap(f, m) >>= g        ==  m >>= g . f
+//   join(m) >>= g           ==  m >>= [](x){ x >>= g }
+// Functions may return lazy_pipers of the same monad kind, which are
+// rewritten in turn, so a chain of mreturns folds into a single one; for
+// cps that is a single apply_cps instead of one per step.
+//
+// The laws assume pure functions: a function after mreturn is called at
+// unpipe() instead of when the monad runs.
+//
+//   lazy_return<M>(a)   -- mreturn<M>(a), not yet built
+//   lazy_pipe<M>(m)     -- an existing monad m of kind M
+//   p >>= f, fmap<M>(p, f), join(p)
+//                       -- extend the expression of the lazy_piper p
+//   p.unpipe()          -- the monad
+
+template <typename M, typename E> class lazy_piper;
+
+namespace detail {
+// expression nodes
+template <typename A> struct lazy_unit { A value; };
+template <typename N> struct lazy_wrap { N monad; };
+template <typename E, typename F> struct lazy_bind { E e; F f; };
+template <typename E, typename F> struct lazy_map { E e; F f; };
+template <typename E> struct lazy_join { E e; };
+
+template <typename G, typename F>
+struct lazy_compose {
+    G g;
+    F f;
+    template <typename A>
+    auto operator()(A&& a) const
+        -> decltype(g(f(std::forward<A>(a))))
+    {
+        return g(f(std::forward<A>(a)));
+    }
+};
+
+// the result of a function as an expression
+template <typename M, typename X>
+lazy_wrap<typename std::decay<X>::type> lazy_lift(monad_type<M>, X&& x)
+{
+    return lazy_wrap<typename std::decay<X>::type>{std::forward<X>(x)};
+}
+
+template <typename M, typename E>
+E lazy_lift(monad_type<M>, lazy_piper<M, E>&& x)
+{
+    return x.expr();
+}
+
+// the result of a function as a monad
+template <typename M, typename X>
+typename std::decay<X>::type lazy_result(monad_type<M>, X&& x)
+{
+    return std::forward<X>(x);
+}
+
+template <typename M, typename E>
+auto lazy_result(monad_type<M>, lazy_piper<M, E>&& x)
+    -> decltype(x.unpipe())
+{
+    return x.unpipe();
+}
+
+// f with its result built, for binding to a built monad
+template <typename M, typename F>
+struct lazy_lowered {
+    F f;
+    template <typename A>
+    auto operator()(A&& a) const
+        -> decltype(lazy_result(monad_type<M>{}, f(std::forward<A>(a))))
+    {
+        return lazy_result(monad_type<M>{}, f(std::forward<A>(a)));
+    }
+};
+
+// f(x) >>= g
+template <typename M, typename F, typename G>
+struct lazy_kleisli {
+    F f;
+    G g;
+    template <typename A>
+    auto operator()(A&& a) const
+        -> decltype(lazy_lower_bind(monad_type<M>{}, lazy_lift(monad_type<M>{}, f(std::forward<A>(a))), g))
+    {
+        return lazy_lower_bind(monad_type<M>{}, lazy_lift(monad_type<M>{}, f(std::forward<A>(a))), g);
+    }
+};
+
+// fmap(g, f(x))
+template <typename M, typename F, typename G>
+struct lazy_kleisli_map {
+    F f;
+    G g;
+    template <typename A>
+    auto operator()(A&& a) const
+        -> decltype(lazy_lower_map(monad_type<M>{}, lazy_lift(monad_type<M>{}, f(std::forward<A>(a))), g))
+    {
+        return lazy_lower_map(monad_type<M>{}, lazy_lift(monad_type<M>{}, f(std::forward<A>(a))), g);
+    }
+};
+
+// Lowering: e >>= f
+template <typename M, typename A, typename F>
+auto lazy_lower_bind(monad_type<M> t, lazy_unit<A>&& u, F&& f)
+    -> decltype(lazy_result(t, f(std::move(u.value))))
+{
+    return lazy_result(t, f(std::move(u.value)));
+}
+
+template <typename M, typename N, typename F>
+auto lazy_lower_bind(monad_type<M>, lazy_wrap<N>&& w, F&& f)
+    -> decltype(mbind(std::move(w.monad), lazy_lowered<M, typename std::decay<F>::type>{std::forward<F>(f)}))
+{
+    return mbind(std::move(w.monad), lazy_lowered<M, typename std::decay<F>::type>{std::forward<F>(f)});
+}
+
+template <typename M, typename E, typename F, typename G>
+auto lazy_lower_bind(monad_type<M> t, lazy_bind<E, F>&& b, G&& g)
+    -> decltype(lazy_lower_bind(t, std::move(b.e), lazy_kleisli<M, F, typename std::decay<G>::type>{std::move(b.f), std::forward<G>(g)}))
+{
+    return lazy_lower_bind(t, std::move(b.e), lazy_kleisli<M, F, typename std::decay<G>::type>{std::move(b.f), std::forward<G>(g)});
+}
+
+template <typename M, typename E, typename F, typename G>
+auto lazy_lower_bind(monad_type<M> t, lazy_map<E, F>&& m, G&& g)
+    -> decltype(lazy_lower_bind(t, std::move(m.e), lazy_compose<typename std::decay<G>::type, F>{std::forward<G>(g), std::move(m.f)}))
+{
+    return lazy_lower_bind(t, std::move(m.e), lazy_compose<typename std::decay<G>::type, F>{std::forward<G>(g), std::move(m.f)});
+}
+
+template <typename M, typename E, typename G>
+auto lazy_lower_bind(monad_type<M> t, lazy_join<E>&& j, G&& g)
+    -> decltype(lazy_lower_bind(t, std::move(j.e), lazy_kleisli<M, identity_, typename std::decay<G>::type>{identity_{}, std::forward<G>(g)}))
+{
+    return lazy_lower_bind(t, std::move(j.e), lazy_kleisli<M, identity_, typename std::decay<G>::type>{identity_{}, std::forward<G>(g)});
+}
+
+// Lowering: fmap(f, e)
+template <typename M, typename A, typename F>
+auto lazy_lower_map(monad_type<M>, lazy_unit<A>&& u, F&& f)
+    -> decltype(mreturn<M>(f(std::move(u.value))))
+{
+    return mreturn<M>(f(std::move(u.value)));
+}
+
+template <typename M, typename N, typename F>
+auto lazy_lower_map(monad_type<M>, lazy_wrap<N>&& w, F&& f)
+    -> decltype(fmap<M>(std::move(w.monad), std::forward<F>(f)))
+{
+    return fmap<M>(std::move(w.monad), std::forward<F>(f));
+}
+
+template <typename M, typename E, typename F, typename G>
+auto lazy_lower_map(monad_type<M> t, lazy_bind<E, F>&& b, G&& g)
+    -> decltype(lazy_lower_bind(t, std::move(b.e), lazy_kleisli_map<M, F, typename std::decay<G>::type>{std::move(b.f), std::forward<G>(g)}))
+{
+    return lazy_lower_bind(t, std::move(b.e), lazy_kleisli_map<M, F, typename std::decay<G>::type>{std::move(b.f), std::forward<G>(g)});
+}
+
+template <typename M, typename E, typename F, typename G>
+auto lazy_lower_map(monad_type<M> t, lazy_map<E, F>&& m, G&& g)
+    -> decltype(lazy_lower_map(t, std::move(m.e), lazy_compose<typename std::decay<G>::type, F>{std::forward<G>(g), std::move(m.f)}))
+{
+    return lazy_lower_map(t, std::move(m.e), lazy_compose<typename std::decay<G>::type, F>{std::forward<G>(g), std::move(m.f)});
+}
+
+template <typename M, typename E, typename G>
+auto lazy_lower_map(monad_type<M> t, lazy_join<E>&& j, G&& g)
+    -> decltype(fmap<M>(lazy_lower(t, std::move(j)), std::forward<G>(g)))
+{
+    return fmap<M>(lazy_lower(t, std::move(j)), std::forward<G>(g));
+}
+
+// Lowering: any expression
+template <typename M, typename A>
+auto lazy_lower(monad_type<M>, lazy_unit<A>&& u)
+    -> decltype(mreturn<M>(std::move(u.value)))
+{
+    return mreturn<M>(std::move(u.value));
+}
+
+template <typename M, typename N>
+N lazy_lower(monad_type<M>, lazy_wrap<N>&& w)
+{
+    return std::move(w.monad);
+}
+
+template <typename M, typename E, typename F>
+auto lazy_lower(monad_type<M> t, lazy_bind<E, F>&& b)
+    -> decltype(lazy_lower_bind(t, std::move(b.e), std::move(b.f)))
+{
+    return lazy_lower_bind(t, std::move(b.e), std::move(b.f));
+}
+
+template <typename M, typename E, typename F>
+auto lazy_lower(monad_type<M> t, lazy_map<E, F>&& m)
+    -> decltype(lazy_lower_map(t, std::move(m.e), std::move(m.f)))
+{
+    return lazy_lower_map(t, std::move(m.e), std::move(m.f));
+}
+
+template <typename M, typename E>
+auto lazy_lower(monad_type<M> t, lazy_join<E>&& j)
+    -> decltype(lazy_lower_bind(t, std::move(j.e), lazy_lowered<M, identity_>{}))
+{
+    return lazy_lower_bind(t, std::move(j.e), lazy_lowered<M, identity_>{});
+}
+} // namespace detail
+
+template <typename M, typename E>
+class lazy_piper
+{
+    E e;
+public:
+    explicit lazy_piper(E e) : e(std::move(e)) {}
+
+    E expr() { return std::move(e); }
+
+    auto unpipe()
+        -> decltype(detail::lazy_lower(monad_type<M>{}, std::declval<E>()))
+    {
+        return detail::lazy_lower(monad_type<M>{}, std::move(e));
+    }
+};
+
+template <typename M, typename A>
+lazy_piper<M, detail::lazy_unit<typename std::decay<A>::type> > lazy_return(A&& a)
+{
+    typedef detail::lazy_unit<typename std::decay<A>::type> node;
+    return lazy_piper<M, node>(node{std::forward<A>(a)});
+}
+
+template <typename M, typename N>
+lazy_piper<M, detail::lazy_wrap<typename std::decay<N>::type> > lazy_pipe(N&& m)
+{
+    typedef detail::lazy_wrap<typename std::decay<N>::type> node;
+    return lazy_piper<M, node>(node{std::forward<N>(m)});
+}
+
+template <typename M, typename E, typename F>
+lazy_piper<M, detail::lazy_bind<E, typename std::decay<F>::type> >
+operator>>=(lazy_piper<M, E>&& lhs, F&& f)
+{
+    typedef detail::lazy_bind<E, typename std::decay<F>::type> node;
+    return lazy_piper<M, node>(node{lhs.expr(), std::forward<F>(f)});
+}
+
+template <typename ResM, typename M, typename E, typename F>
+lazy_piper<M, detail::lazy_map<E, typename std::decay<F>::type> >
+fmap(lazy_piper<M, E>&& m_a, F&& a_to_b)
+{
+    static_assert(std::is_same<ResM, M>::value, "fmap keeps the monad kind of a lazy_piper");
+    typedef detail::lazy_map<E, typename std::decay<F>::type> node;
+    return lazy_piper<M, node>(node{m_a.expr(), std::forward<F>(a_to_b)});
+}
+
+template <typename M, typename E>
+lazy_piper<M, detail::lazy_join<E> > join(lazy_piper<M, E>&& m)
+{
+    typedef detail::lazy_join<E> node;
+    return lazy_piper<M, node>(node{m.expr()});
+}
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_LAZY_HPP
@@ -0,0 +1,273 @@
+// Boost.Monads.List
+//
+
+#ifndef BOOST_MONADS_LIST_HPP
+#define BOOST_MONADS_LIST_HPP
+
+#include "monad.hpp"
+#include "algorithm.hpp"
+
+#include <boost/optional.hpp>
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// std::vector as List monad, for flatMap and nondeterminism in memory:
+//   mbind(v, f)                  -- the concatenation of f(x) for every x
+//                                   of v; f returns a std::vector or a
+//                                   list_single
+//   mreturn<std::vector<T> >(x)  -- {x}
+//   mreturn<list_monad>(x)       -- x as a list_single: one element, no
+//   list_monad::mempty<T>()         vector; mempty is the one without any
+// The result is reserved once if its size is known before the first call
+// of f (the size-hint protocol):
+//   - f returns list_single: at most one element per element of v
+//   - f has a member size_hint(x), the number of elements it expects f(x)
+//     to give; with_size_hint(f, n or h) adds one to f
+//   - join: the sizes of the inner vectors
+//   - fmap<std::vector<U> >(v, f): one per element, and f(x) goes into
+//     the result directly instead of through a vector of its own
+// Otherwise it grows as usual.  Elements of the inner vectors are moved
+// into the result, and so are the elements of v if it is an rvalue.
+//
+// Nothing may be added to namespace std, so mbind for std::vector is one
+// of the defaults in boost::monads::detail, as for std::optional in
+// optional.hpp.
+
+namespace boost { namespace monads {
+
+// zero or one element
+template <typename T>
+class list_single
+{
+    boost::optional<T> x;
+public:
+    typedef T value_type;
+
+    list_single() {}
+    explicit list_single(T value) : x(std::move(value)) {}
+
+    bool empty() const { return !x; }
+    std::size_t size() const { return x ? 1 : 0; }
+    T& front() { return *x; }
+    T const& front() const { return *x; }
+
+    operator std::vector<T>() &&
+    {
+        std::vector<T> v;
+        if (x)
+            v.push_back(std::move(*x));
+        return v;
+    }
+};
+
+struct list_monad {
+    template <typename T>
+    static list_single<typename std::decay<T>::type> mreturn(T&& x)
+    {
+        return list_single<typename std::decay<T>::type>(std::forward<T>(x));
+    }
+
+    template <typename T>
+    static list_single<T> mempty()
+    {
+        return list_single<T>();
+    }
+};
+
+template <typename T, typename U>
+std::vector<T> mreturn(monad_type<std::vector<T> >, U&& x)
+{
+    std::vector<T> v;
+    v.emplace_back(std::forward<U>(x));
+    return v;
+}
+
+namespace detail {
+template <typename N, typename A>
+typename std::enable_if<std::is_integral<N>::value, std::size_t>::type
+apply_size_hint(N n, A const&)
+{
+    return n;
+}
+
+template <typename H, typename A>
+auto apply_size_hint(H const& h, A const& a) -> decltype(std::size_t(h(a)))
+{
+    return h(a);
+}
+} // namespace detail
+
+template <typename F, typename H>
+struct size_hinted {
+    F f;
+    H hint;
+
+    template <typename A>
+    auto operator()(A&& a) -> decltype(f(std::forward<A>(a)))
+    {
+        return f(std::forward<A>(a));
+    }
+
+    template <typename A>
+    std::size_t size_hint(A const& a) const
+    {
+        return detail::apply_size_hint(hint, a);
+    }
+};
+
+// f with a size hint: a number of elements per call, or a function of
+// the argument
+template <typename F, typename H>
+size_hinted<typename std::decay<F>::type, typename std::decay<H>::type>
+with_size_hint(F&& f, H&& hint)
+{
+    return size_hinted<typename std::decay<F>::type, typename std::decay<H>::type>{
+        std::forward<F>(f), std::forward<H>(hint)};
+}
+
+namespace detail {
+template <typename T> struct is_list_single : std::false_type {};
+template <typename T> struct is_list_single<list_single<T> > : std::true_type {};
+
+// an element of v, moved from if v is an rvalue
+template <typename M>
+using list_elem = typename std::conditional<std::is_lvalue_reference<M>::value,
+    decltype(*std::declval<M&>().begin()),
+    typename std::decay<M>::type::value_type&&>::type;
+
+template <typename M, typename F>
+using list_ret = typename std::decay<decltype(std::declval<F&>()(std::declval<list_elem<M> >()))>::type;
+
+template <typename M, typename F>
+using list_bind_ret = std::vector<typename list_ret<M, F>::value_type>;
+
+struct no_size_hint {};
+
+template <typename F, typename A>
+auto list_size_hint(first_choice, F const& f, A const& a) -> decltype(std::size_t(f.size_hint(a)))
+{
+    return f.size_hint(a);
+}
+
+// join
+template <typename A>
+auto list_size_hint(second_choice, identity_ const&, A const& a) -> decltype(std::size_t(a.size()))
+{
+    return a.size();
+}
+
+template <typename F, typename A>
+no_size_hint list_size_hint(third_choice, F const&, A const&)
+{
+    return no_size_hint();
+}
+
+template <typename U, typename V, typename F>
+void list_reserve(std::vector<U>& out, V const& v, F const&, std::true_type /*single*/)
+{
+    out.reserve(v.size());
+}
+
+template <typename U, typename V, typename F>
+void list_reserve_hinted(std::vector<U>&, V const&, F const&, no_size_hint)
+{
+}
+
+template <typename U, typename V, typename F>
+void list_reserve_hinted(std::vector<U>& out, V const& v, F const& f, std::size_t)
+{
+    std::size_t n = 0;
+    for (auto const& x : v)
+        n += list_size_hint(make_choice{}, f, x);
+    out.reserve(n);
+}
+
+template <typename U, typename V, typename F>
+void list_reserve(std::vector<U>& out, V const& v, F const& f, std::false_type)
+{
+    list_reserve_hinted(out, v, f, list_size_hint(make_choice{}, f, *v.begin()));
+}
+
+template <typename U>
+void list_append(std::vector<U>& out, list_single<U>&& r)
+{
+    if (!r.empty())
+        out.push_back(std::move(r.front()));
+}
+
+template <typename U>
+void list_append(std::vector<U>& out, std::vector<U>&& r)
+{
+    if (out.empty() && out.capacity() <= r.capacity())
+        out = std::move(r);
+    else
+        out.insert(out.end(), std::make_move_iterator(r.begin()), std::make_move_iterator(r.end()));
+}
+
+// join of an lvalue: the inner vectors are copied straight into the result
+template <typename U>
+void list_append(std::vector<U>& out, std::vector<U> const& r)
+{
+    out.insert(out.end(), r.begin(), r.end());
+}
+
+template <typename M, typename F>
+list_bind_ret<M, F> list_bind(M&& v, F& f)
+{
+    typedef list_ret<M, F> ret;
+    list_bind_ret<M, F> out;
+    if (v.empty())
+        return out;
+    list_reserve(out, v, f, is_list_single<ret>());
+    for (auto& x : v)
+        list_append(out, f(static_cast<list_elem<M> >(x)));
+    return out;
+}
+
+// fmap: no vector per element
+template <typename M, typename U, typename G>
+std::vector<U> list_bind(M&& v, return_after_f<std::vector<U>, G>& f)
+{
+    std::vector<U> out;
+    out.reserve(v.size());
+    for (auto& x : v)
+        out.push_back(f.f(static_cast<list_elem<M> >(x)));
+    return out;
+}
+} // namespace detail
+
+// a list_single binds like a list of at most one element
+template <typename T, typename F,
+          typename R = typename std::decay<decltype(std::declval<F>()(std::declval<T&&>()))>::type>
+R boost_mbind(list_single<T>&& m, F&& fun)
+{
+    if (m.empty())
+        return R();
+    return std::forward<F>(fun)(std::move(m.front()));
+}
+
+namespace detail {
+template <typename T, typename A, typename F>
+list_bind_ret<std::vector<T, A> const&, typename std::decay<F>::type>
+do_mbind(basic_types, std::vector<T, A> const& v, F&& fun)
+{
+    typename std::decay<F>::type f(std::forward<F>(fun));
+    return list_bind(v, f);
+}
+
+template <typename T, typename A, typename F>
+list_bind_ret<std::vector<T, A>, typename std::decay<F>::type>
+do_mbind(basic_types, std::vector<T, A>&& v, F&& fun)
+{
+    typename std::decay<F>::type f(std::forward<F>(fun));
+    return list_bind(std::move(v), f);
+}
+} // namespace detail
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_LIST_HPP
@@ -0,0 +1,363 @@
+// Boost.Monads.Metrics
+//
+
+#ifndef BOOST_MONADS_METRICS_HPP
+#define BOOST_MONADS_METRICS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace boost { namespace monads {
+
+// Instrumentation of segment pipelines.  Queues and stages whose options
+// carry a pipeline_metrics register counters with it, and snapshot()
+// reads them while the pipeline runs:
+//   per queue: elements pushed and popped, current and peak depth, time
+//              producers were blocked or suspended on a full queue and
+//              time consumers waited or were suspended on an empty one
+//   per stage: elements taken and produced, time spent running
+//
+// The counters are only compiled in with BOOST_MONADS_ENABLE_METRICS
+// defined; otherwise pipeline_metrics, queue_options::metrics and the
+// probes are empty types and snapshot() returns no entries.  The define
+// changes the layout of queue_options, of every queue and of every
+// stage, so it must be the same in every translation unit of a program:
+// two that disagree break the one definition rule, and nothing reports
+// it.
+
+struct queue_stats {
+    std::size_t id;
+    std::uint64_t items_in, items_out;
+    std::uint64_t depth, peak_depth;
+    std::uint64_t producer_blocked_ns, consumer_waiting_ns;
+};
+
+struct stage_stats {
+    std::size_t id;
+    const char* kind;
+    // queue ids, 0 if the stage has no such queue
+    std::size_t input, output;
+    std::uint64_t items_in, items_out;
+    std::uint64_t busy_ns;
+};
+
+struct pipeline_snapshot {
+    std::vector<queue_stats> queues;
+    std::vector<stage_stats> stages;
+};
+
+namespace detail {
+typedef std::chrono::steady_clock metrics_clock;
+
+inline std::uint64_t elapsed_ns(metrics_clock::time_point since)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(metrics_clock::now() - since).count();
+}
+
+inline void raise_to(std::atomic<std::uint64_t>& peak, std::uint64_t value)
+{
+    std::uint64_t p = peak.load(std::memory_order_relaxed);
+    while (value > p && !peak.compare_exchange_weak(p, value, std::memory_order_relaxed))
+        ;
+}
+
+// the producer and the consumer side are kept on separate cache lines
+struct queue_counters {
+    std::size_t id = 0;
+    std::atomic<std::uint64_t> items_in{0}, peak_depth{0}, producer_blocked_ns{0};
+    char pad[64];
+    std::atomic<std::uint64_t> items_out{0}, consumer_waiting_ns{0};
+};
+
+struct stage_counters {
+    std::size_t id = 0;
+    const char* kind = "";
+    std::size_t input = 0, output = 0;
+    std::atomic<std::uint64_t> items_in{0}, items_out{0}, busy_ns{0};
+};
+} // namespace detail
+
+#if defined(BOOST_MONADS_ENABLE_METRICS)
+// The registry owns the counters, so that a snapshot taken after a
+// pipeline has ended still has them; prune() drops those of queues and
+// stages that are gone, for a registry that outlives many pipelines.
+class pipeline_metrics
+{
+    std::mutex mutex;
+    std::vector<std::shared_ptr<detail::queue_counters> > queues;
+    std::vector<std::shared_ptr<detail::stage_counters> > stages;
+    std::size_t queue_ids = 0, stage_ids = 0;
+
+    template <typename Counters>
+    static void drop_unused(std::vector<std::shared_ptr<Counters> >& v)
+    {
+        v.erase(std::remove_if(v.begin(), v.end(),
+                               [](std::shared_ptr<Counters> const& c) { return c.use_count() == 1; }),
+                v.end());
+    }
+public:
+    static const bool enabled = true;
+
+    std::shared_ptr<detail::queue_counters> add_queue()
+    {
+        auto c = std::make_shared<detail::queue_counters>();
+        std::lock_guard<std::mutex> lock(mutex);
+        queues.push_back(c);
+        c->id = ++queue_ids;
+        return c;
+    }
+    std::shared_ptr<detail::stage_counters> add_stage(const char* kind, std::size_t input,
+                                                      std::size_t output)
+    {
+        auto c = std::make_shared<detail::stage_counters>();
+        c->kind = kind;
+        c->input = input;
+        c->output = output;
+        std::lock_guard<std::mutex> lock(mutex);
+        stages.push_back(c);
+        c->id = ++stage_ids;
+        return c;
+    }
+
+    pipeline_snapshot snapshot()
+    {
+        pipeline_snapshot s;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto const& q : queues) {
+            const std::uint64_t out = q->items_out.load(std::memory_order_relaxed);
+            const std::uint64_t in = q->items_in.load(std::memory_order_relaxed);
+            s.queues.push_back(queue_stats{q->id, in, out, in > out ? in - out : 0,
+                                           q->peak_depth.load(std::memory_order_relaxed),
+                                           q->producer_blocked_ns.load(std::memory_order_relaxed),
+                                           q->consumer_waiting_ns.load(std::memory_order_relaxed)});
+        }
+        for (auto const& st : stages)
+            s.stages.push_back(stage_stats{st->id, st->kind, st->input, st->output,
+                                           st->items_in.load(std::memory_order_relaxed),
+                                           st->items_out.load(std::memory_order_relaxed),
+                                           st->busy_ns.load(std::memory_order_relaxed)});
+        return s;
+    }
+
+    // forgets the queues and stages that have been destroyed; ids are
+    // not reused
+    void prune()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        drop_unused(queues);
+        drop_unused(stages);
+    }
+};
+
+// queue_options::metrics
+typedef std::shared_ptr<pipeline_metrics> pipeline_metrics_ptr;
+#else
+// without BOOST_MONADS_ENABLE_METRICS there is nothing to register with
+class pipeline_metrics
+{
+public:
+    static const bool enabled = false;
+
+    pipeline_snapshot snapshot() const { return pipeline_snapshot(); }
+    void prune() {}
+};
+
+namespace detail {
+// queue_options::metrics: accepts a pipeline_metrics and keeps nothing,
+// so that options, queues and stages carry no pointer to it
+struct no_metrics {
+    no_metrics() {}
+    no_metrics(std::shared_ptr<pipeline_metrics> const&) {}
+
+    explicit operator bool() const { return false; }
+    pipeline_metrics* operator->() const
+    {
+        static pipeline_metrics none;
+        return &none;
+    }
+};
+} // namespace detail
+
+typedef detail::no_metrics pipeline_metrics_ptr;
+#endif
+
+inline std::ostream& operator<<(std::ostream& os, pipeline_snapshot const& s)
+{
+    os << "queue        in       out  depth   peak  blocked[us]  waiting[us]\n";
+    for (auto const& q : s.queues)
+        os << std::setw(5) << q.id << std::setw(10) << q.items_in << std::setw(10) << q.items_out
+           << std::setw(7) << q.depth << std::setw(7) << q.peak_depth
+           << std::setw(13) << q.producer_blocked_ns / 1000
+           << std::setw(13) << q.consumer_waiting_ns / 1000 << '\n';
+    os << "stage kind        in -> out        in       out     busy[us]\n";
+    for (auto const& st : s.stages)
+        os << std::setw(5) << st.id << ' ' << std::left << std::setw(9) << st.kind << std::right
+           << std::setw(5) << st.input << " -> " << std::setw(3) << st.output
+           << std::setw(10) << st.items_in << std::setw(10) << st.items_out
+           << std::setw(13) << st.busy_ns / 1000 << '\n';
+    return os;
+}
+
+namespace detail {
+#if defined(BOOST_MONADS_ENABLE_METRICS)
+// measures the time from its construction to elapsed()
+class probe_timer
+{
+    metrics_clock::time_point start;
+public:
+    probe_timer() : start(metrics_clock::now()) {}
+    std::uint64_t elapsed() const { return elapsed_ns(start); }
+};
+
+// wraps a resumption so that it adds the time since the wrapping to
+// one of the queue's counters
+template <typename F>
+struct timed_resume {
+    F f;
+    std::shared_ptr<queue_counters> c;
+    std::atomic<std::uint64_t> queue_counters::* total;
+    metrics_clock::time_point start;
+
+    void operator()()
+    {
+        if (c)
+            (c.get()->*total).fetch_add(elapsed_ns(start), std::memory_order_relaxed);
+        f();
+    }
+};
+
+// counters of one queue; depth and peak depth follow from pushes and
+// pops, a suspension is timed from notify_when_* to the resumption
+class queue_probe
+{
+    std::shared_ptr<queue_counters> c;
+
+    template <typename F>
+    timed_resume<typename std::decay<F>::type>
+    timed(F&& f, std::atomic<std::uint64_t> queue_counters::* total) const
+    {
+        return timed_resume<typename std::decay<F>::type>{
+            std::forward<F>(f), c, total, metrics_clock::now()};
+    }
+public:
+    void attach(pipeline_metrics_ptr const& m)
+    {
+        if (m && !c)
+            c = m->add_queue();
+    }
+    std::size_t id() const { return c ? c->id : 0; }
+
+    void pushed(std::size_t n)
+    {
+        if (!c || !n)
+            return;
+        const std::uint64_t in = c->items_in.fetch_add(n, std::memory_order_relaxed) + n;
+        const std::uint64_t out = c->items_out.load(std::memory_order_relaxed);
+        raise_to(c->peak_depth, in > out ? in - out : 0);
+    }
+    void popped(std::size_t n)
+    {
+        if (c && n)
+            c->items_out.fetch_add(n, std::memory_order_relaxed);
+    }
+    void producer_blocked(probe_timer const& t)
+    {
+        if (c)
+            c->producer_blocked_ns.fetch_add(t.elapsed(), std::memory_order_relaxed);
+    }
+    void consumer_waited(probe_timer const& t)
+    {
+        if (c)
+            c->consumer_waiting_ns.fetch_add(t.elapsed(), std::memory_order_relaxed);
+    }
+    template <typename F>
+    timed_resume<typename std::decay<F>::type> reader_wait(F&& resume) const
+    {
+        return timed(std::forward<F>(resume), &queue_counters::consumer_waiting_ns);
+    }
+    template <typename F>
+    timed_resume<typename std::decay<F>::type> writer_wait(F&& resume) const
+    {
+        return timed(std::forward<F>(resume), &queue_counters::producer_blocked_ns);
+    }
+};
+
+// counters of one stage; a busy timer spans one run()
+class stage_probe
+{
+    std::shared_ptr<stage_counters> c;
+public:
+    class busy_timer
+    {
+        stage_counters* c;
+        metrics_clock::time_point start;
+    public:
+        explicit busy_timer(stage_probe const& p) : c(p.c.get())
+        {
+            if (c)
+                start = metrics_clock::now();
+        }
+        ~busy_timer()
+        {
+            if (c)
+                c->busy_ns.fetch_add(elapsed_ns(start), std::memory_order_relaxed);
+        }
+    };
+
+    void attach(pipeline_metrics_ptr const& m, const char* kind,
+                std::size_t input, std::size_t output)
+    {
+        if (m && !c)
+            c = m->add_stage(kind, input, output);
+    }
+    void took(std::size_t n)
+    {
+        if (c && n)
+            c->items_in.fetch_add(n, std::memory_order_relaxed);
+    }
+    void produced(std::size_t n)
+    {
+        if (c && n)
+            c->items_out.fetch_add(n, std::memory_order_relaxed);
+    }
+};
+#else
+struct probe_timer {};
+
+struct queue_probe {
+    void attach(pipeline_metrics_ptr const&) {}
+    std::size_t id() const { return 0; }
+    void pushed(std::size_t) {}
+    void popped(std::size_t) {}
+    void producer_blocked(probe_timer const&) {}
+    void consumer_waited(probe_timer const&) {}
+    template <typename F>
+    F&& reader_wait(F&& resume) const { return std::forward<F>(resume); }
+    template <typename F>
+    F&& writer_wait(F&& resume) const { return std::forward<F>(resume); }
+};
+
+struct stage_probe {
+    struct busy_timer {
+        explicit busy_timer(stage_probe const&) {}
+    };
+    void attach(pipeline_metrics_ptr const&, const char*, std::size_t, std::size_t) {}
+    void took(std::size_t) {}
+    void produced(std::size_t) {}
+};
+#endif
+} // namespace detail
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_METRICS_HPP
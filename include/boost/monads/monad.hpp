@@ -4,6 +4,7 @@
 #ifndef BOOST_MONADS_MONAD_HPP
 #define BOOST_MONADS_MONAD_HPP
 
+#include <type_traits>
 #include <utility>
 
 namespace boost { namespace monads {
@@ -49,15 +50,35 @@ namespace boost { namespace monads {
 //   (1) mbind/mreturn member function
 //   (2) mbind/mreturn free functions found via adl
 //   (3) default definitions inside boost::monad
+//
+// Impure monads may in addition bind in place: mbind_inplace takes the
+// monad as an rvalue and is free to mutate it and take its state along
+// into the result, e.g. append to its log instead of copying the log.
+//
+// template <typename F>
+// auto monad_archetype<T>::mbind_inplace(F&& fun) &&
+//     -> monad_archetype<...>;
+//
+// template <typename T, typename F>
+// auto boost_mbind_inplace(monad_archetype<T>&& monad, F&& fun)
+//     -> monad_archetype<...>;
+//
+// mbind prefers them for rvalue monads, ahead of (1) to (3):
+//   (0a) mbind_inplace member function
+//   (0b) boost_mbind_inplace free function found via adl
 
 template <typename T> struct monad_type {};
 
+// the value of a monad that carries none, like Haskell's ()
+struct unit {};
+
 namespace detail {
 
-// support for basic types can be added in this namespace
-struct not_a_real_type{};
-void do_mbind(not_a_real_type);
-void do_mreturn(not_a_real_type);
+// support for basic types can be added in this namespace, as overloads
+// of do_mbind(basic_types, m, f) and do_mreturn(basic_types,
+// monad_type<M>, x); the tag makes them found via adl, so they may be
+// declared after this header
+struct basic_types {};
 
 template<int I> struct choice : choice<I-1> {};
 template<> struct choice<0> {};
@@ -67,6 +88,28 @@ using first_choice  = choice<2>;
 using second_choice = choice<1>;
 using third_choice  = choice<0>;
 
+// mbind ranks the in-place binds of rvalue monads first
+using make_bind_choice      = choice<5>;
+using inplace_member_choice = choice<5>;
+using inplace_adl_choice    = choice<4>;
+
+template <typename M>
+using if_rvalue = typename std::enable_if<!std::is_lvalue_reference<M>::value>::type;
+
+template <typename M, typename F, typename = if_rvalue<M> >
+auto mbind_(inplace_member_choice, M&& monad, F&& fun)
+    -> decltype(std::move(monad).mbind_inplace(std::forward<F>(fun)))
+{
+    return std::move(monad).mbind_inplace(std::forward<F>(fun));
+}
+
+template <typename M, typename F, typename = if_rvalue<M> >
+auto mbind_(inplace_adl_choice, M&& monad, F&& fun)
+    -> decltype(boost_mbind_inplace(std::move(monad), std::forward<F>(fun)))
+{
+    return boost_mbind_inplace(std::move(monad), std::forward<F>(fun));
+}
+
 template <typename M, typename F>
 auto mbind_(first_choice, M&& monad, F&& fun)
     -> decltype(std::forward<M>(monad).mbind(std::forward<F>(fun)))
@@ -83,9 +126,9 @@ auto mbind_(second_choice, M&& monad, F&& fun)
 
 template <typename M, typename F>
 auto mbind_(third_choice, M&& monad, F&& fun)
-  -> decltype(detail::do_mbind(std::forward<M>(monad), std::forward<F>(fun)))
+  -> decltype(do_mbind(basic_types{}, std::forward<M>(monad), std::forward<F>(fun)))
 {
-    return detail::do_mbind(std::forward<M>(monad), std::forward<F>(fun));
+    return do_mbind(basic_types{}, std::forward<M>(monad), std::forward<F>(fun));
 }
 
 template <typename M, typename T>
@@ -104,18 +147,18 @@ auto mreturn_(second_choice, monad_type<M>, T&& elem)
 
 template <typename M, typename T>
 auto mreturn_(third_choice, monad_type<M>, T&& elem)
-    -> decltype(detail::do_mreturn(monad_type<M>{}, std::forward<T>(elem)))
+    -> decltype(do_mreturn(basic_types{}, monad_type<M>{}, std::forward<T>(elem)))
 {
-    return detail::do_mreturn(monad_type<M>{}, std::forward<T>(elem));
+    return do_mreturn(basic_types{}, monad_type<M>{}, std::forward<T>(elem));
 }
 } // namespace detail
 
 
 template <typename M, typename F>
 auto mbind(M&& monad, F&& fun)
-    -> decltype(detail::mbind_(detail::make_choice{}, std::forward<M>(monad), std::forward<F>(fun)))
+    -> decltype(detail::mbind_(detail::make_bind_choice{}, std::forward<M>(monad), std::forward<F>(fun)))
 {
-    return detail::mbind_(detail::make_choice{}, std::forward<M>(monad), std::forward<F>(fun));
+    return detail::mbind_(detail::make_bind_choice{}, std::forward<M>(monad), std::forward<F>(fun));
 }
 
 template <typename M, typename T>
@@ -134,18 +177,21 @@ struct monad_piper {
     M unpipe() { return std::forward<M>(monad); }
 };
 
+// A piper holds a reference to an lvalue monad, which is left alone, and
+// owns an rvalue one, which is moved into mbind along with the function,
+// so a chain of temporaries binds without copying monads or functions.
 template <typename M, typename N>
 auto operator>>=(monad_piper<M>&& lhs, N&& rhs)
-    -> monad_piper<decltype(mbind(lhs.monad, rhs))>
+    -> monad_piper<decltype(mbind(std::forward<M>(lhs.monad), std::forward<N>(rhs)))>
 {
-    using Ret=monad_piper<decltype(mbind(lhs.monad, rhs))>;
-    return Ret(mbind(lhs.monad, rhs));
+    using Ret=monad_piper<decltype(mbind(std::forward<M>(lhs.monad), std::forward<N>(rhs)))>;
+    return Ret(mbind(std::forward<M>(lhs.monad), std::forward<N>(rhs)));
 }
 
 template <typename M>
 monad_piper<M> monad_pipe(M&& m)
 {
-    return monad_piper<M>(m);
+    return monad_piper<M>(std::forward<M>(m));
 }
 
 }} // namespace boost::monads
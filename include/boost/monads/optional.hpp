@@ -0,0 +1,92 @@
+// Boost.Monads.Optional
+//
+
+#ifndef BOOST_MONADS_OPTIONAL_HPP
+#define BOOST_MONADS_OPTIONAL_HPP
+
+#include "monad.hpp"
+
+#include <boost/optional.hpp>
+
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<optional>)
+#include <optional>
+#define BOOST_MONADS_HAS_STD_OPTIONAL
+#endif
+#endif
+
+// boost::optional and std::optional (with C++17) as Maybe monad:
+//   mbind(m, f)            -- f(*m), or an empty optional if m is empty;
+//                             f returns an optional itself
+//   mreturn<optional<T> >  -- an engaged optional
+// The value lives inside the optional, so unlike the unique_ptr version
+// of example/uniqueptr.cpp a chain of binds does not allocate, and an
+// empty optional skips the rest of the chain without calling f.
+//
+// For boost::optional, boost_mbind is found via adl and mreturn via
+// monad_type.  Nothing may be added to namespace std, so std::optional
+// is supported by the defaults in boost::monads::detail instead.
+
+namespace boost { namespace monads {
+
+namespace detail {
+template <typename M, typename F>
+using maybe_ret = typename std::decay<decltype(std::declval<F>()(*std::declval<M>()))>::type;
+
+template <typename M, typename F>
+maybe_ret<M, F> maybe_bind(M&& m, F&& fun)
+{
+    if (!m)
+        return maybe_ret<M, F>();
+    return std::forward<F>(fun)(*std::forward<M>(m));
+}
+} // namespace detail
+
+template <typename T, typename U>
+boost::optional<T> mreturn(monad_type<boost::optional<T> >, U&& x)
+{
+    return boost::optional<T>(std::forward<U>(x));
+}
+
+#if defined(BOOST_MONADS_HAS_STD_OPTIONAL)
+namespace detail {
+template <typename T, typename F>
+maybe_ret<std::optional<T> const&, F> do_mbind(basic_types, std::optional<T> const& m, F&& fun)
+{
+    return maybe_bind(m, std::forward<F>(fun));
+}
+
+template <typename T, typename F>
+maybe_ret<std::optional<T>, F> do_mbind(basic_types, std::optional<T>&& m, F&& fun)
+{
+    return maybe_bind(std::move(m), std::forward<F>(fun));
+}
+
+template <typename T, typename U>
+std::optional<T> do_mreturn(basic_types, monad_type<std::optional<T> >, U&& x)
+{
+    return std::optional<T>(std::forward<U>(x));
+}
+} // namespace detail
+#endif
+
+} // namespace monads
+
+template <typename T, typename F>
+monads::detail::maybe_ret<optional<T> const&, F> boost_mbind(optional<T> const& m, F&& fun)
+{
+    return monads::detail::maybe_bind(m, std::forward<F>(fun));
+}
+
+template <typename T, typename F>
+monads::detail::maybe_ret<optional<T>, F> boost_mbind(optional<T>&& m, F&& fun)
+{
+    return monads::detail::maybe_bind(std::move(m), std::forward<F>(fun));
+}
+
+} // namespace boost
+
+#endif // BOOST_MONADS_OPTIONAL_HPP
@@ -0,0 +1,249 @@
+// Boost.Monads.Pipeline
+//
+
+#ifndef BOOST_MONADS_PIPELINE_HPP
+#define BOOST_MONADS_PIPELINE_HPP
+
+#include "monad.hpp"
+#include "algorithm.hpp"
+
+#include <type_traits>
+#include <utility>
+
+namespace boost { namespace monads {
+
+// Pipelines after proposal n3534.
+//
+// n3534 hardcodes function<void(IN,OUT)>,
+//                 function<void(IN,queue_back<OUT>)>,
+//                 function<void(queue_front<IN>,OUT)> and
+//                 function<void(queue_front<IN>,queue_back<OUT>)>
+// for different interfaces.  As this cannot be done in general (what
+// if IN should be queue_front<int>?) and for any monad, I use
+// different operators for this: |, >>, << and ||.
+//
+// Notation: a := IN, b := OUT,
+//           M1 a := queue_front<IN>
+//           M2 b := queue_back<OUT>
+//           x -> y := void(x, y) (for any x and y)
+// Then we can pipeline using the following operators:
+//    pipeline | (a -> b)          Haskell: (|)  :: M a -> (a -> b) -> M b;   (|)  = flip fmap
+//    pipeline >> (a -> M b)       Haskell: (>>) :: M a -> (a -> M b) -> M b; (>>) = mbind)
+//    pipeline << (M a -> b)       Haskell: (<<) :: M a -> (M a -> b) -> M b; (<<) m f = return $ f m
+//    pipeline || (M a -> M b)     Haskell: (||) :: M a -> (M a -> M b) -> M b; (||) = flip ($)
+//
+// Note that "|" and "||" can be implemented more generally for
+// Functors, but this demo focusses on Monads.
+//
+// Runs of adjacent "|" stages are fused at compile time:
+//    fmap g . fmap f = fmap (g . f)
+// so `p | f | g' binds a single function and, for segment_monad, costs
+// one stage instead of two.  The composition is kept pending in the
+// pipeliner and bound by the next ">>", "<<", "||" or get().  Wrap a
+// function in own_stage() to keep it out of the fusion.
+//
+// p.metrics() returns the pipeline_metrics of monads that keep counters
+// per stage (see metrics.hpp); its snapshot() can be read while the
+// pipeline runs.
+//
+// `p | parallel(n, f)' is a "|" stage whose function runs on up to n
+// tasks at once, for monads that bind parallel_t (see algorithm.hpp).
+// Likewise `p >> concat_map(k, f)' and `p >> merge_map(k, f)' are ">>"
+// stages that evaluate up to k of the monads f returns at once.
+
+namespace detail {
+struct no_stage {};
+
+// g . f
+template <typename F, typename G>
+struct fused {
+    F f;
+    G g;
+    template <typename A>
+    auto operator()(A&& a) const
+        -> decltype(g(f(std::forward<A>(a))))
+    {
+        return g(f(std::forward<A>(a)));
+    }
+};
+
+template <typename G>
+typename std::decay<G>::type fuse(no_stage, G&& g)
+{
+    return std::forward<G>(g);
+}
+
+template <typename F, typename G>
+fused<F, typename std::decay<G>::type> fuse(F f, G&& g)
+{
+    return fused<F, typename std::decay<G>::type>{std::move(f), std::forward<G>(g)};
+}
+
+template <typename Monad, typename M_a>
+M_a bind_pending(M_a&& monad, no_stage)
+{
+    return std::move(monad);
+}
+
+template <typename Monad, typename M_a, typename F>
+auto bind_pending(M_a&& monad, F f)
+    -> decltype(liftm<Monad>(std::move(f))(std::move(monad)))
+{
+    return liftm<Monad>(std::move(f))(std::move(monad));
+}
+} // namespace detail
+
+template <typename F>
+struct own_stage_t {
+    F f;
+};
+
+namespace detail {
+// whether "|" composes T with the pending function; stages that bind
+// on their own are not fused
+template <typename T>
+struct is_fusable : std::true_type {};
+template <typename F>
+struct is_fusable<own_stage_t<F> > : std::false_type {};
+template <typename F>
+struct is_fusable<parallel_t<F> > : std::false_type {};
+template <typename F>
+struct is_fusable<merge_t<F> > : std::false_type {};
+
+template <typename F>
+struct bind_parallel {
+    parallel_t<F> stage;
+    template <typename M>
+    auto operator()(M&& m) const
+        -> decltype(mbind(std::forward<M>(m), stage))
+    {
+        return mbind(std::forward<M>(m), stage);
+    }
+};
+
+template <typename F>
+struct bind_merge {
+    merge_t<F> stage;
+    template <typename M>
+    auto operator()(M&& m) const
+        -> decltype(mbind(std::forward<M>(m), stage))
+    {
+        return mbind(std::forward<M>(m), stage);
+    }
+};
+} // namespace detail
+
+// a "|" stage that is not fused with its neighbours
+template <typename F>
+own_stage_t<typename std::decay<F>::type> own_stage(F&& f)
+{
+    return own_stage_t<typename std::decay<F>::type>{std::forward<F>(f)};
+}
+
+template <typename Monad, typename M_a, typename Pending = detail::no_stage> struct pipeliner;
+
+template <typename Monad, typename M_a>
+pipeliner<Monad, typename std::decay<M_a>::type> pipeline(M_a&& m);
+
+template <typename Monad, typename M_a, typename Pending>
+struct pipeliner
+{
+    M_a monad;
+    Pending pending;
+
+    auto get() &&
+        -> decltype(detail::bind_pending<Monad>(std::move(monad), std::move(pending)))
+    {
+        return detail::bind_pending<Monad>(std::move(monad), std::move(pending));
+    }
+
+    pipeliner(M_a monad, Pending pending = Pending())
+        : monad(std::move(monad)), pending(std::move(pending)) {}
+
+    // the counters of the pipeline's stages, for monads that keep them
+    // (Monad::metrics, e.g. segment_monad with queue_options::metrics)
+    template <typename M = Monad>
+    auto metrics() const
+        -> decltype(M::metrics(std::declval<M_a const&>()))
+    {
+        return M::metrics(monad);
+    }
+
+    template <typename MInToMOut>
+    auto operator||(MInToMOut&& m_in_to_m_out)
+        -> decltype(pipeline<Monad>(std::forward<MInToMOut>(m_in_to_m_out)(std::move(*this).get())))
+    {
+        return pipeline<Monad>(std::forward<MInToMOut>(m_in_to_m_out)(std::move(*this).get()));
+    }
+
+    template <typename InToOut,
+              typename = typename std::enable_if<
+                  detail::is_fusable<typename std::decay<InToOut>::type>::value>::type,
+              typename Fused = decltype(detail::fuse(std::declval<Pending>(), std::declval<InToOut>()))>
+    pipeliner<Monad, M_a, Fused> operator|(InToOut&& in_to_out)
+    {
+        return pipeliner<Monad, M_a, Fused>(
+            std::move(monad), detail::fuse(std::move(pending), std::forward<InToOut>(in_to_out)));
+    }
+
+    template <typename F>
+    auto operator|(own_stage_t<F> stage)
+        -> decltype(*this || liftm<Monad>(std::move(stage.f)))
+    {
+        return *this || liftm<Monad>(std::move(stage.f));
+    }
+
+    template <typename F>
+    auto operator|(parallel_t<F> stage)
+        -> decltype(*this || detail::bind_parallel<F>{std::move(stage)})
+    {
+        return *this || detail::bind_parallel<F>{std::move(stage)};
+    }
+
+    template <typename InToMOut>
+    auto operator>>(InToMOut&& in_to_m_out)
+        -> decltype(pipeline<Monad>(join(std::move(*this | std::forward<InToMOut>(in_to_m_out)).get())))
+    {
+        return pipeline<Monad>(join(std::move(*this | std::forward<InToMOut>(in_to_m_out)).get()));
+    }
+
+    template <typename F>
+    auto operator>>(merge_t<F> stage)
+        -> decltype(*this || detail::bind_merge<F>{std::move(stage)})
+    {
+        return *this || detail::bind_merge<F>{std::move(stage)};
+    }
+
+    template <typename MInToOut>
+    auto operator<<(MInToOut&& m_in_to_out)
+        -> decltype(pipeline<Monad>(mreturn<Monad>(std::move((*this || std::forward<MInToOut>(m_in_to_out)).monad))))
+    {
+        return pipeline<Monad>(mreturn<Monad>(std::move((*this || std::forward<MInToOut>(m_in_to_out)).monad)));
+    }
+};
+
+template <typename Monad, typename M_a>
+pipeliner<Monad, typename std::decay<M_a>::type> pipeline(M_a&& m)
+{
+    return pipeliner<Monad, typename std::decay<M_a>::type>(std::forward<M_a>(m));
+}
+
+// a pipeline whose stages run with the given options, applied to m by
+// Monad::configure; e.g. queue_options for segment_monad
+template <typename Monad, typename M_a, typename Options>
+pipeliner<Monad, typename std::decay<M_a>::type> pipeline(M_a&& m, Options const& options)
+{
+    Monad::configure(m, options);
+    return pipeline<Monad>(std::forward<M_a>(m));
+}
+
+template <typename Monad, typename T>
+auto pipeline_from(T&& x)
+    -> decltype(pipeline<Monad>(mreturn<Monad>(std::forward<T>(x))))
+{
+    return pipeline<Monad>(mreturn<Monad>(std::forward<T>(x)));
+}
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_PIPELINE_HPP
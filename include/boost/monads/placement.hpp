@@ -0,0 +1,237 @@
+// Boost.Monads.Placement
+//
+
+#ifndef BOOST_MONADS_PLACEMENT_HPP
+#define BOOST_MONADS_PLACEMENT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace boost { namespace monads {
+
+// Where the threads of a pipeline run and where its queues live (Linux;
+// elsewhere, and wherever the kernel refuses, everything is left to the
+// OS scheduler).
+//
+// cpu_topology::get() lists the cpus this process may run on, per NUMA
+// node, ordered so that SMT siblings and then the cores of a package are
+// next to each other.  A thread_pool built with a placement pins worker
+// i to the i-th of those cpus, on placement::node or on all nodes.  A
+// stage posts the stages it resumes to its own worker's deque and idle
+// workers steal from their neighbours first, so adjacent stages end up
+// on the same or on sibling cores.  queue_options::numa_node binds the
+// storage of the queues to a node, where the first touch by the threads
+// of another node would put it elsewhere.
+
+struct placement {
+    // NUMA node the workers run on and queue storage is bound to, -1
+    // for all of them; a node the machine does not have means all
+    int node = -1;
+    // one cpu per worker; otherwise the workers float over the node
+    bool pin_threads = true;
+};
+
+class cpu_topology
+{
+    // per node, in placement order
+    std::vector<std::vector<int> > nodes;
+
+    // "0-3,8,10-11"
+    static std::vector<int> parse_list(std::string const& s)
+    {
+        std::vector<int> ids;
+        std::size_t i = 0;
+        while (i < s.size()) {
+            std::size_t end = s.find(',', i);
+            if (end == std::string::npos)
+                end = s.size();
+            const std::string range = s.substr(i, end - i);
+            const std::size_t dash = range.find('-');
+            try {
+                const int first = std::stoi(range.substr(0, dash));
+                const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                for (int id = first; id <= last; ++id)
+                    ids.push_back(id);
+            } catch (...) {
+                // a line break or an empty list
+            }
+            i = end + 1;
+        }
+        return ids;
+    }
+
+    static std::string read_line(std::string const& path)
+    {
+        std::ifstream in(path.c_str());
+        std::string s;
+        std::getline(in, s);
+        return s;
+    }
+
+    static int read_int(std::string const& path, int otherwise)
+    {
+        std::vector<int> ids = parse_list(read_line(path));
+        return ids.empty() ? otherwise : ids.front();
+    }
+
+    // the cpus the process may run on
+    static std::vector<int> allowed()
+    {
+        std::vector<int> cpus;
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (::sched_getaffinity(0, sizeof(set), &set) == 0)
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &set))
+                    cpus.push_back(cpu);
+#endif
+        if (cpus.empty()) {
+            const int n = static_cast<int>(std::thread::hardware_concurrency());
+            for (int cpu = 0; cpu < (n ? n : 1); ++cpu)
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    cpu_topology()
+    {
+        const std::vector<int> usable = allowed();
+        const std::string sys = "/sys/devices/system/";
+        for (int node : parse_list(read_line(sys + "node/online"))) {
+            std::vector<int> cpus;
+            for (int cpu : parse_list(read_line(sys + "node/node" + std::to_string(node) + "/cpulist")))
+                if (std::binary_search(usable.begin(), usable.end(), cpu))
+                    cpus.push_back(cpu);
+            if (nodes.size() <= std::size_t(node))
+                nodes.resize(node + 1);
+            nodes[node] = std::move(cpus);
+        }
+        // no sysfs, or no usable cpu on any node: a single node
+        bool any = false;
+        for (auto const& on_node : nodes)
+            any = any || !on_node.empty();
+        if (!any)
+            nodes.assign(1, usable);
+        for (auto& on_node : nodes) {
+            std::vector<std::tuple<int, int, int> > keyed;
+            for (int cpu : on_node) {
+                const std::string dir = sys + "cpu/cpu" + std::to_string(cpu) + "/topology/";
+                keyed.emplace_back(read_int(dir + "physical_package_id", 0),
+                                   read_int(dir + "core_id", cpu), cpu);
+            }
+            std::sort(keyed.begin(), keyed.end());
+            for (std::size_t i = 0; i < on_node.size(); ++i)
+                on_node[i] = std::get<2>(keyed[i]);
+        }
+    }
+public:
+    static cpu_topology const& get()
+    {
+        static const cpu_topology topology;
+        return topology;
+    }
+
+    // node ids run from 0 to node_count() - 1; a node without usable
+    // cpus has an empty list
+    std::size_t node_count() const { return nodes.size(); }
+    bool numa() const
+    {
+        std::size_t used = 0;
+        for (auto const& on_node : nodes)
+            used += !on_node.empty();
+        return used > 1;
+    }
+
+    // the cpus of node, or of all nodes in order for -1 or a node the
+    // machine does not have
+    std::vector<int> cpus(int node = -1) const
+    {
+        if (node >= 0 && std::size_t(node) < nodes.size() && !nodes[node].empty())
+            return nodes[node];
+        std::vector<int> all;
+        for (auto const& on_node : nodes)
+            all.insert(all.end(), on_node.begin(), on_node.end());
+        return all;
+    }
+
+    // -1 if unknown
+    int node_of(int cpu) const
+    {
+        for (std::size_t node = 0; node < nodes.size(); ++node)
+            if (std::find(nodes[node].begin(), nodes[node].end(), cpu) != nodes[node].end())
+                return int(node);
+        return -1;
+    }
+};
+
+// restricts the calling thread to cpus; false if that is not possible
+inline bool run_this_thread_on(std::vector<int> const& cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    return CPU_COUNT(&set) && ::sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+// the node the calling thread runs on right now, -1 if unknown
+inline int current_numa_node()
+{
+#ifdef __linux__
+    const int cpu = ::sched_getcpu();
+    return cpu < 0 ? -1 : cpu_topology::get().node_of(cpu);
+#else
+    return -1;
+#endif
+}
+
+// Prefer node for the whole pages in [p, p + size), and move those that
+// are already elsewhere.  The pages at either end, which p shares with
+// other memory, are left alone.  False if nothing was bound: on a machine
+// with a single node, for a range without whole pages, or if the kernel
+// refuses.
+inline bool bind_to_numa_node(void* p, std::size_t size, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    if (node < 0 || std::size_t(node) >= cpu_topology::get().node_count() || !cpu_topology::get().numa())
+        return false;
+    const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    const std::size_t first = (reinterpret_cast<std::size_t>(p) + page - 1) / page * page;
+    const std::size_t last = (reinterpret_cast<std::size_t>(p) + size) / page * page;
+    if (first >= last)
+        return false;
+    // from <numaif.h>, which would need libnuma's headers
+    const int mpol_preferred = 1;
+    const unsigned mpol_mf_move = 1u << 1;
+    const std::size_t bits = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask(node / bits + 1);
+    mask[node / bits] = 1ul << (node % bits);
+    return ::syscall(SYS_mbind, first, last - first, mpol_preferred, mask.data(),
+                     mask.size() * bits + 1, mpol_mf_move) == 0;
+#else
+    (void)p, (void)size, (void)node;
+    return false;
+#endif
+}
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_PLACEMENT_HPP
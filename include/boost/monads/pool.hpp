@@ -0,0 +1,216 @@
+// Boost.Monads.Pool
+//
+
+#ifndef BOOST_MONADS_POOL_HPP
+#define BOOST_MONADS_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+
+namespace boost { namespace monads {
+
+namespace detail {
+// Thread-local free lists of small blocks, in size classes of 64 bytes
+// up to 2 KiB.  A block goes back to the free list of the thread that
+// frees it, and the next allocation of its class on that thread takes it
+// from there instead of the heap.  Queues often die on another thread
+// than the one that made them (a stage creates, the next one drains), so
+// a thread with a full list hands a batch of blocks to a shared depot,
+// and a thread with an empty one fetches a batch from there: one lock
+// per batch.  After a warm-up a pipeline runs without heap allocations.
+class block_pool
+{
+    static const std::size_t granularity = 64;
+    static const std::size_t classes = 32;
+    static const std::size_t batch = 32;
+    // per class: blocks on a thread's list, batches in the depot
+    static const std::size_t cached = 2 * batch;
+    static const std::size_t depot_batches = 64;
+
+    struct block {
+        block* next;
+        // the next batch in the depot, in a batch's first block
+        block* next_batch;
+    };
+
+    struct depot {
+        std::mutex mutex;
+        block* batches[classes];
+        std::size_t count[classes];
+
+        depot()
+        {
+            for (std::size_t c = 0; c < classes; ++c) {
+                batches[c] = nullptr;
+                count[c] = 0;
+            }
+        }
+    };
+
+    // never destroyed: threads may return blocks until the very end
+    static depot& shared()
+    {
+        static depot* d = new depot;
+        return *d;
+    }
+
+    // a batch off the depot, null if there is none
+    static block* fetch(std::size_t c)
+    {
+        depot& d = shared();
+        std::lock_guard<std::mutex> lock(d.mutex);
+        block* b = d.batches[c];
+        if (b) {
+            d.batches[c] = b->next_batch;
+            --d.count[c];
+        }
+        return b;
+    }
+
+    // false if the depot is full
+    static bool hand_over(std::size_t c, block* b)
+    {
+        depot& d = shared();
+        std::lock_guard<std::mutex> lock(d.mutex);
+        if (d.count[c] == depot_batches)
+            return false;
+        b->next_batch = d.batches[c];
+        d.batches[c] = b;
+        ++d.count[c];
+        return true;
+    }
+
+    struct cache {
+        block* free[classes];
+        std::size_t count[classes];
+
+        cache()
+        {
+            for (std::size_t c = 0; c < classes; ++c) {
+                free[c] = nullptr;
+                count[c] = 0;
+            }
+            state() = alive;
+        }
+        ~cache()
+        {
+            state() = gone;
+            for (std::size_t c = 0; c < classes; ++c)
+                while (block* b = free[c]) {
+                    free[c] = b->next;
+                    ::operator delete(b);
+                }
+        }
+    };
+
+    enum { unused, alive, gone };
+
+    // trivially destructible, so still readable while the thread's other
+    // thread_local objects are destroyed
+    static int& state()
+    {
+        static thread_local int s = unused;
+        return s;
+    }
+
+    // null once the thread's cache is gone
+    static cache* local()
+    {
+        if (state() == gone)
+            return nullptr;
+        static thread_local cache c;
+        return &c;
+    }
+public:
+    static void* allocate(std::size_t bytes)
+    {
+        const std::size_t c = bytes ? (bytes - 1) / granularity : 0;
+        if (c >= classes)
+            return ::operator new(bytes);
+        if (cache* p = local()) {
+            if (!p->free[c] && (p->free[c] = fetch(c)))
+                p->count[c] = batch;
+            if (block* b = p->free[c]) {
+                p->free[c] = b->next;
+                --p->count[c];
+                return b;
+            }
+        }
+        return ::operator new((c + 1) * granularity);
+    }
+
+    static void deallocate(void* q, std::size_t bytes)
+    {
+        const std::size_t c = bytes ? (bytes - 1) / granularity : 0;
+        cache* p = c < classes ? local() : nullptr;
+        if (!p) {
+            ::operator delete(q);
+            return;
+        }
+        if (p->count[c] == cached) {
+            // the first `batch' blocks of the list go to the depot
+            block* first = p->free[c];
+            block* last = first;
+            for (std::size_t i = 1; i < batch; ++i)
+                last = last->next;
+            block* rest = last->next;
+            last->next = nullptr;
+            if (hand_over(c, first)) {
+                p->free[c] = rest;
+                p->count[c] -= batch;
+            } else {
+                last->next = rest;
+                ::operator delete(q);
+                return;
+            }
+        }
+        block* b = static_cast<block*>(q);
+        b->next = p->free[c];
+        p->free[c] = b;
+        ++p->count[c];
+    }
+};
+} // namespace detail
+
+// Allocator on the thread-local block pool, for the queues of a pipeline
+// and their storage.  Over-aligned types go to std::allocator.
+template <typename T>
+struct pool_allocator {
+    typedef T value_type;
+
+    pool_allocator() {}
+    template <typename U>
+    pool_allocator(pool_allocator<U> const&) {}
+
+    T* allocate(std::size_t n)
+    {
+        if (alignof(T) > alignof(std::max_align_t))
+            return std::allocator<T>().allocate(n);
+        return static_cast<T*>(detail::block_pool::allocate(n * sizeof(T)));
+    }
+    void deallocate(T* p, std::size_t n)
+    {
+        if (alignof(T) > alignof(std::max_align_t))
+            std::allocator<T>().deallocate(p, n);
+        else
+            detail::block_pool::deallocate(p, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(pool_allocator<T> const&, pool_allocator<U> const&)
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(pool_allocator<T> const&, pool_allocator<U> const&)
+{
+    return false;
+}
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_POOL_HPP
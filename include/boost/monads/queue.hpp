@@ -0,0 +1,936 @@
+// Boost.Monads.Queue
+//
+
+#ifndef BOOST_MONADS_QUEUE_HPP
+#define BOOST_MONADS_QUEUE_HPP
+
+#include "executor.hpp"
+#include "metrics.hpp"
+#include "pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace boost { namespace monads {
+
+// Both queues share the same contract:
+//   push(x)            -- append x, called by the producer only
+//   push_n(first, n)   -- append n elements read from first
+//   pop(x)             -- block until an element is available or the queue
+//                         is closed and drained; returns false in the
+//                         latter case
+//   pop_batch(out, n)  -- like pop, but drain up to n > 0 elements into
+//                         out; returns the number of elements written,
+//                         0 once the queue is closed and drained
+//   close()            -- called by the producer after its last push
+//
+// Tasks running on an executor must not block, so there is a
+// non-blocking variant of each operation as well:
+//   try_push_n(first, n)         -- append as many of the n elements as fit
+//                                   now; returns how many were taken
+//   try_pop_batch(out, n)        -- drain up to n elements that are
+//                                   available now; returns how many
+//   drained()                    -- closed and empty
+//   notify_when_readable(resume) -- if there is nothing to pop and the
+//                                   queue is still open, call resume()
+//                                   once after the next push or close and
+//                                   return true; otherwise return false
+//   notify_when_writable(resume) -- same for the producer of a full queue
+//
+// Every queue also carries queue_options, which stages reading from it
+// pass on to the queues they produce.
+//
+// A consumer that has enough cancels its queue, and the cancellation
+// travels upstream, against the elements:
+//   cancel()          -- no more elements are wanted: pops find the queue
+//                        drained, pushes discard their elements (and report
+//                        them taken), and whoever waits on either side is
+//                        resumed; any thread may call it, more than once
+//   cancelled()       -- for the producer: stop producing
+//   on_cancel(f)      -- adds a hook of the producer, run once by cancel(),
+//                        or right away if the queue already is cancelled;
+//                        hooks added before run in the order they were
+//                        added.  Stages cancel their own input queues
+//                        with it
+// A queue destroyed before it was drained runs the hook as well, so a
+// consumer may also just drop its queue.
+//
+// Queues can be bounded in elements and in bytes.  push and push_n wait
+// while the queue is full, try_push_n takes what fits, so a fast producer
+// is held back by a slow consumer instead of growing the queue.  Bytes
+// are measured with queue_item_size(x), found by ADL, unless the queue
+// was given its own size function with set_item_size.
+//
+// Queue storage comes from the thread-local block pool (pool.hpp), and a
+// queue constructed with closed_queue is closed from the start and holds
+// at most one element, which is all that mreturn and mempty need; it is
+// built without locking or notifying anybody.
+//
+// With BOOST_MONADS_ENABLE_METRICS defined, a queue whose options carry
+// a pipeline_metrics counts its traffic, depth and waiting times there
+// (see metrics.hpp).
+
+// counters shared by the queues of a pipeline
+struct queue_gauges {
+    // pushes that found a queue full
+    std::atomic<std::size_t> throttled;
+
+    queue_gauges() : throttled(0) {}
+};
+
+struct queue_options {
+    // number of elements a stage moves per synchronization
+    std::size_t batch_size = 1;
+    // where stages reading from the queue run
+    executor_ref executor;
+    // maximum number of queued elements, 0 for the queue's default
+    // (unbounded for blocking_queue)
+    std::size_t capacity = 0;
+    // maximum number of queued bytes, 0 for no limit; an element larger
+    // than that still fits into an empty queue, and one pushed as another
+    // type is measured after its conversion, so it fits whenever the
+    // queue is below the limit
+    std::size_t capacity_bytes = 0;
+    // if set, every throttled push is counted here as well
+    std::shared_ptr<queue_gauges> gauges;
+    // if set, queues and stages register their counters here; an empty
+    // type without BOOST_MONADS_ENABLE_METRICS, which must be defined
+    // alike in the whole program (see metrics.hpp)
+    pipeline_metrics_ptr metrics;
+    // NUMA node a ring buffer's storage is bound to, -1 for wherever it
+    // is first touched (see placement.hpp)
+    int numa_node = -1;
+};
+
+// options whose stages run on pool and whose queues live on the node the
+// pool is placed on
+inline queue_options placed_on(thread_pool& pool, queue_options options = queue_options())
+{
+    options.executor = pool;
+    options.numa_node = pool.placed().node;
+    return options;
+}
+
+// tag of the constructors of closed queues
+struct closed_queue_t {};
+
+// memory held by a queued element
+template <typename T>
+std::size_t queue_item_size(T const&)
+{
+    return sizeof(T);
+}
+
+template <typename C, typename Traits, typename A>
+std::size_t queue_item_size(std::basic_string<C, Traits, A> const& s)
+{
+    return sizeof(s) + s.capacity() * sizeof(C);
+}
+
+template <typename T, typename A>
+std::size_t queue_item_size(std::vector<T, A> const& v)
+{
+    return sizeof(v) + v.capacity() * sizeof(T);
+}
+
+namespace detail {
+static const std::size_t cache_line_size = 64;
+
+// spin a little, then give up the time slice, then sleep
+struct backoff {
+    unsigned count = 0;
+    void operator()()
+    {
+        if (count < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        ++count;
+    }
+};
+
+inline std::size_t round_up_to_power_of_two(std::size_t n)
+{
+    std::size_t p = 1;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+// whether a U is queued as it is, without a conversion to T
+template <typename T, typename U>
+struct is_item : std::is_same<typename std::decay<U>::type, T> {};
+
+// the element to queue: a reference to it if it already is a T, a
+// temporary T converted from it otherwise
+template <typename T, typename U>
+typename std::enable_if<is_item<T, U>::value, U&&>::type
+as_item(U&& u)
+{
+    return std::forward<U>(u);
+}
+
+template <typename T, typename U>
+typename std::enable_if<!is_item<T, U>::value, T>::type
+as_item(U&& u)
+{
+    return T(std::forward<U>(u));
+}
+
+// iterator over just x, moving from it unless it was an lvalue
+template <typename U>
+U* single_item(U& x, std::true_type)
+{
+    return &x;
+}
+
+template <typename U>
+std::move_iterator<U*> single_item(U& x, std::false_type)
+{
+    return std::make_move_iterator(&x);
+}
+
+template <typename T>
+std::size_t item_size(std::function<std::size_t(T const&)> const& measure, T const& x)
+{
+    return measure ? measure(x) : queue_item_size(x);
+}
+
+inline void resume(std::function<void()>& waiter)
+{
+    if (waiter) {
+        std::function<void()> w;
+        w.swap(waiter);
+        w();
+    }
+}
+
+// first, then second
+inline std::function<void()> chained(std::function<void()> first, std::function<void()> second)
+{
+    return [first, second]() {
+        first();
+        second();
+    };
+}
+
+// Resumption slot for the lock-free queue.  The waiting side arms it and
+// then re-checks its condition, the notifying side publishes its update
+// and then checks whether the slot is armed; the fences make sure that at
+// least one of them sees the other.
+class waiter_slot
+{
+    std::atomic<bool> armed;
+    std::atomic_flag busy;
+    std::function<void()> waiter;
+
+    // with busy held: makes the waiter visible and releases busy; the
+    // waiter taken back if ready() became true meanwhile, null if it
+    // stays armed or the other side was faster and resumes it
+    template <typename Ready>
+    std::function<void()> publish(Ready ready)
+    {
+        armed.store(true, std::memory_order_relaxed);
+        busy.clear(std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready())
+            return nullptr;
+        return take();
+    }
+
+    std::function<void()> take()
+    {
+        std::function<void()> w;
+        while (busy.test_and_set(std::memory_order_acquire))
+            ;
+        if (armed.load(std::memory_order_relaxed)) {
+            armed.store(false, std::memory_order_relaxed);
+            w.swap(waiter);
+        }
+        busy.clear(std::memory_order_release);
+        return w;
+    }
+public:
+    waiter_slot() : armed(false) { busy.clear(); }
+
+    template <typename F, typename Ready>
+    bool arm(F&& resume, Ready ready)
+    {
+        while (busy.test_and_set(std::memory_order_acquire))
+            ;
+        waiter = std::forward<F>(resume);
+        return !publish(ready);
+    }
+    // like arm, but an armed waiter is kept and run before resume; if
+    // ready() is true already, they are run right here
+    template <typename Ready>
+    void chain(std::function<void()> resume, Ready ready)
+    {
+        while (busy.test_and_set(std::memory_order_acquire))
+            ;
+        if (armed.load(std::memory_order_relaxed))
+            waiter = chained(std::move(waiter), std::move(resume));
+        else
+            waiter = std::move(resume);
+        if (std::function<void()> w = publish(ready))
+            w();
+    }
+
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!armed.load(std::memory_order_relaxed))
+            return;
+        if (std::function<void()> w = take())
+            w();
+    }
+};
+} // namespace detail
+
+template <typename T>
+class blocking_queue
+{
+    std::deque<T, pool_allocator<T> > queue;
+    bool closed = false;
+    // written under the lock, read without it by cancelled()
+    std::atomic<bool> cancel_requested;
+    std::size_t bytes = 0;
+    // size of the element the producer waits to push
+    std::size_t wanted = 0;
+    std::size_t throttles = 0;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::condition_variable not_full;
+    std::function<void()> on_readable;
+    std::function<void()> on_writable;
+    std::function<void()> on_cancelled;
+    std::function<std::size_t(T const&)> measure;
+    queue_options opts;
+    detail::queue_probe stats;
+
+    bool bounded() const { return opts.capacity || opts.capacity_bytes; }
+    bool room_for(std::size_t size) const
+    {
+        if (opts.capacity && queue.size() >= opts.capacity)
+            return false;
+        return !opts.capacity_bytes || queue.empty() || bytes + size <= opts.capacity_bytes;
+    }
+    void throttled()
+    {
+        ++throttles;
+        if (opts.gauges)
+            opts.gauges->throttled.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // under the lock: append as many of the n elements as fit.  An
+    // element that has to be converted to a T may be moved from by the
+    // conversion, so the room for it is checked before, and it goes in
+    // whenever the queue is below its limits
+    template <typename InputIt>
+    std::size_t push_locked(InputIt& first, std::size_t n)
+    {
+        if (cancel_requested.load(std::memory_order_relaxed)) {
+            std::advance(first, n);
+            return n;
+        }
+        const bool converted = !detail::is_item<T, decltype(*first)>::value;
+        std::size_t k = 0;
+        for (; k < n; ++k, ++first) {
+            if (converted && bounded() && !room_for(1)) {
+                wanted = 1;
+                throttled();
+                break;
+            }
+            auto&& x = detail::as_item<T>(*first);
+            if (bounded()) {
+                const std::size_t size = opts.capacity_bytes ? detail::item_size(measure, x) : 0;
+                if (!converted && !room_for(size)) {
+                    wanted = size;
+                    throttled();
+                    break;
+                }
+                bytes += size;
+            }
+            queue.push_back(std::forward<decltype(x)>(x));
+        }
+        stats.pushed(k);
+        return k;
+    }
+    // under the lock: remove up to max elements; wake is set if that made
+    // room for a waiting producer
+    template <typename OutputIt>
+    std::size_t pop_locked(OutputIt out, std::size_t max, std::function<void()>& waiter, bool& wake)
+    {
+        std::size_t n = 0;
+        for (; n < max && !queue.empty(); ++n) {
+            if (opts.capacity_bytes) {
+                const std::size_t size = detail::item_size(measure, queue.front());
+                bytes = bytes > size ? bytes - size : 0;
+            }
+            *out++ = std::move(queue.front());
+            queue.pop_front();
+        }
+        stats.popped(n);
+        if (n && bounded() && room_for(wanted)) {
+            waiter.swap(on_writable);
+            wake = true;
+        }
+        return n;
+    }
+    void notify_producer(std::function<void()>& waiter, bool wake)
+    {
+        if (wake)
+            not_full.notify_one();
+        detail::resume(waiter);
+    }
+public:
+    typedef T value_type;
+
+    blocking_queue() : cancel_requested(false) {}
+    // closed and empty
+    explicit blocking_queue(closed_queue_t) : closed(true), cancel_requested(false) {}
+    // closed, holding just x
+    template <typename T2>
+    blocking_queue(closed_queue_t, T2&& x)
+        : closed(true), cancel_requested(false)
+    {
+        queue.push_back(detail::as_item<T>(std::forward<T2>(x)));
+    }
+    blocking_queue(blocking_queue const&) = delete;
+    blocking_queue& operator=(blocking_queue const&) = delete;
+    ~blocking_queue()
+    {
+        if (on_cancelled && !cancel_requested.load() && !(closed && queue.empty()))
+            on_cancelled();
+    }
+
+    queue_options const& options() const { return opts; }
+    void set_options(queue_options const& o)
+    {
+        std::function<void()> waiter;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            opts = o;
+            stats.attach(o.metrics);
+            if (room_for(wanted))
+                waiter.swap(on_writable);
+        }
+        notify_producer(waiter, true);
+    }
+    // measure bytes with f instead of queue_item_size
+    void set_item_size(std::function<std::size_t(T const&)> f)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        measure = std::move(f);
+    }
+    // number of pushes that found the queue full
+    std::size_t throttled_pushes()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return throttles;
+    }
+    detail::queue_probe const& probe() const { return stats; }
+
+    template <typename T2>
+    void push(T2&& value)
+    {
+        auto&& x = detail::as_item<T>(std::forward<T2>(value));
+        push_n(detail::single_item(x, std::is_lvalue_reference<decltype(x)>()), 1);
+    }
+    template <typename InputIt>
+    void push_n(InputIt first, std::size_t n)
+    {
+        while (n) {
+            std::function<void()> waiter;
+            std::size_t k;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!(k = push_locked(first, n))) {
+                    detail::probe_timer blocked;
+                    not_full.wait(lock, [this]() { return cancel_requested || room_for(wanted); });
+                    stats.producer_blocked(blocked);
+                }
+                waiter.swap(on_readable);
+            }
+            cond.notify_one();
+            detail::resume(waiter);
+            n -= k;
+        }
+    }
+    template <typename InputIt>
+    std::size_t try_push_n(InputIt first, std::size_t n)
+    {
+        std::function<void()> waiter;
+        std::size_t k;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!(k = push_locked(first, n)))
+                return 0;
+            waiter.swap(on_readable);
+        }
+        cond.notify_one();
+        detail::resume(waiter);
+        return k;
+    }
+    bool pop(T& elem)
+    {
+        return pop_batch(&elem, 1) != 0;
+    }
+    template <typename OutputIt>
+    std::size_t pop_batch(OutputIt out, std::size_t max)
+    {
+        std::function<void()> waiter;
+        bool wake = false;
+        std::size_t n;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!closed && queue.empty()) {
+                detail::probe_timer waiting;
+                cond.wait(lock, [this](){ return closed || cancel_requested || !queue.empty(); });
+                stats.consumer_waited(waiting);
+            }
+            n = pop_locked(out, max, waiter, wake);
+        }
+        notify_producer(waiter, wake);
+        return n;
+    }
+    template <typename OutputIt>
+    std::size_t try_pop_batch(OutputIt out, std::size_t max)
+    {
+        std::function<void()> waiter;
+        bool wake = false;
+        std::size_t n;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            n = pop_locked(out, max, waiter, wake);
+        }
+        notify_producer(waiter, wake);
+        return n;
+    }
+    bool drained()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (closed && queue.empty()) || cancel_requested;
+    }
+    template <typename F>
+    bool notify_when_readable(F&& resume)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed || cancel_requested || !queue.empty())
+            return false;
+        on_readable = stats.reader_wait(std::forward<F>(resume));
+        return true;
+    }
+    template <typename F>
+    bool notify_when_writable(F&& resume)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (cancel_requested || room_for(wanted))
+            return false;
+        on_writable = stats.writer_wait(std::forward<F>(resume));
+        return true;
+    }
+    void close()
+    {
+        std::function<void()> waiter;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+            waiter.swap(on_readable);
+        }
+        cond.notify_one();
+        detail::resume(waiter);
+    }
+    // the queued elements are dropped at once
+    void cancel()
+    {
+        std::function<void()> reader, writer, hook;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (cancel_requested.load(std::memory_order_relaxed))
+                return;
+            cancel_requested.store(true, std::memory_order_release);
+            queue.clear();
+            bytes = 0;
+            reader.swap(on_readable);
+            writer.swap(on_writable);
+            hook.swap(on_cancelled);
+        }
+        cond.notify_all();
+        not_full.notify_all();
+        detail::resume(writer);
+        detail::resume(reader);
+        detail::resume(hook);
+    }
+    bool cancelled() const { return cancel_requested.load(std::memory_order_acquire); }
+    template <typename F>
+    void on_cancel(F&& f)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!cancel_requested.load(std::memory_order_relaxed)) {
+                if (on_cancelled)
+                    on_cancelled = detail::chained(std::move(on_cancelled), std::forward<F>(f));
+                else
+                    on_cancelled = std::forward<F>(f);
+                return;
+            }
+        }
+        f();
+    }
+};
+
+// Bounded lock-free ring buffer for exactly one producer and one
+// consumer thread.  Head and tail live on separate cache lines and each
+// side keeps a private copy of the other side's index, so the shared
+// lines are only touched when the cached view runs out.
+template <typename T>
+class spsc_queue
+{
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type slot;
+
+    // read-mostly
+    std::size_t mask;
+    slot* slots;
+    const std::size_t byte_capacity;
+    std::function<std::size_t(T const&)> measure;
+    // set once, read by both sides
+    std::atomic<bool> cancel_requested;
+    detail::waiter_slot on_cancelled;
+    char pad0[detail::cache_line_size];
+    // consumer side
+    std::atomic<std::size_t> head;
+    std::size_t cached_tail;
+    detail::waiter_slot on_readable;
+    char pad1[detail::cache_line_size];
+    // producer side
+    std::atomic<std::size_t> tail;
+    std::size_t cached_head;
+    std::atomic<bool> closed;
+    detail::waiter_slot on_writable;
+    std::size_t wanted;
+    std::atomic<std::size_t> throttles;
+    char pad2[detail::cache_line_size];
+    // queued bytes, only maintained with a byte capacity
+    std::atomic<std::size_t> bytes;
+    char pad3[detail::cache_line_size];
+    queue_options opts;
+    std::shared_ptr<queue_gauges> gauges;
+    detail::queue_probe stats;
+
+    T* at(std::size_t i) { return reinterpret_cast<T*>(&slots[i & mask]); }
+
+    // consumer: wait until slot h is filled; false if closed and drained
+    bool wait_for_element(std::size_t h)
+    {
+        if (h == cached_tail)
+            cached_tail = tail.load(std::memory_order_acquire);
+        if (h != cached_tail)
+            return true;
+        detail::probe_timer waiting;
+        for (detail::backoff wait; h == cached_tail; wait()) {
+            // read closed before tail: all pushes happen before close()
+            const bool was_closed = closed.load(std::memory_order_acquire);
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (h == cached_tail && was_closed)
+                break;
+            if (cancel_requested.load(std::memory_order_relaxed))
+                return false;
+        }
+        stats.consumer_waited(waiting);
+        return h != cached_tail;
+    }
+    std::size_t take(std::size_t h, std::size_t max)
+    {
+        if (cached_tail - h < max)
+            cached_tail = tail.load(std::memory_order_acquire);
+        return cached_tail - h < max ? cached_tail - h : max;
+    }
+    std::size_t space(std::size_t t, std::size_t wanted)
+    {
+        if (capacity() - (t - cached_head) < wanted)
+            cached_head = head.load(std::memory_order_acquire);
+        return capacity() - (t - cached_head);
+    }
+    // producer: room for one more element of the given size at t
+    bool room_for(std::size_t t, std::size_t size)
+    {
+        if (!space(t, 1))
+            return false;
+        return !byte_capacity || bytes.load(std::memory_order_acquire) + size <= byte_capacity
+            || t == head.load(std::memory_order_acquire);
+    }
+    void throttled()
+    {
+        throttles.fetch_add(1, std::memory_order_relaxed);
+        if (std::shared_ptr<queue_gauges> g = std::atomic_load(&gauges))
+            g->throttled.fetch_add(1, std::memory_order_relaxed);
+    }
+public:
+    typedef T value_type;
+    static const std::size_t default_capacity = 1024;
+
+    // capacity is rounded up to a power of two; both limits are fixed
+    // for the lifetime of the queue
+    explicit spsc_queue(std::size_t capacity = default_capacity, std::size_t capacity_bytes = 0)
+        : mask(detail::round_up_to_power_of_two(capacity ? capacity : 1) - 1)
+        , slots(pool_allocator<slot>().allocate(mask + 1))
+        , byte_capacity(capacity_bytes)
+        , cancel_requested(false)
+        , head(0), cached_tail(0)
+        , tail(0), cached_head(0), closed(false), wanted(0), throttles(0)
+        , bytes(0)
+    {
+    }
+    // closed and empty
+    explicit spsc_queue(closed_queue_t)
+        : spsc_queue(1)
+    {
+        closed.store(true, std::memory_order_relaxed);
+    }
+    // closed, holding just x
+    template <typename T2>
+    spsc_queue(closed_queue_t, T2&& x)
+        : spsc_queue(1)
+    {
+        ::new (static_cast<void*>(at(0))) T(detail::as_item<T>(std::forward<T2>(x)));
+        tail.store(1, std::memory_order_relaxed);
+        closed.store(true, std::memory_order_relaxed);
+    }
+    spsc_queue(spsc_queue const&) = delete;
+    spsc_queue& operator=(spsc_queue const&) = delete;
+
+    ~spsc_queue()
+    {
+        if (!cancel_requested.load() && !(closed.load() && head.load() == tail.load()))
+            on_cancelled.notify();
+        for (std::size_t h = head.load(), t = tail.load(); h != t; ++h)
+            at(h)->~T();
+        pool_allocator<slot>().deallocate(slots, mask + 1);
+    }
+
+    std::size_t capacity() const { return mask + 1; }
+
+    queue_options const& options() const { return opts; }
+    // capacity and capacity_bytes are taken from the constructor, not
+    // from o; the other options must be set before either side starts
+    void set_options(queue_options const& o)
+    {
+        if (o.numa_node != opts.numa_node && o.numa_node >= 0)
+            bind_to_numa_node(slots, capacity() * sizeof(slot), o.numa_node);
+        opts = o;
+        std::atomic_store(&gauges, o.gauges);
+        stats.attach(o.metrics);
+    }
+    // measure bytes with f instead of queue_item_size; before the first push
+    void set_item_size(std::function<std::size_t(T const&)> f) { measure = std::move(f); }
+    // number of pushes that found the queue full
+    std::size_t throttled_pushes() const { return throttles.load(std::memory_order_relaxed); }
+    detail::queue_probe const& probe() const { return stats; }
+
+    template <typename T2>
+    void push(T2&& value)
+    {
+        if (cancel_requested.load(std::memory_order_relaxed))
+            return;
+        auto&& x = detail::as_item<T>(std::forward<T2>(value));
+        const std::size_t size = byte_capacity ? detail::item_size(measure, x) : 0;
+        const std::size_t t = tail.load(std::memory_order_relaxed);
+        if (!room_for(t, size)) {
+            throttled();
+            detail::probe_timer blocked;
+            for (detail::backoff wait; !room_for(t, size); wait())
+                if (cancel_requested.load(std::memory_order_relaxed))
+                    return;
+            stats.producer_blocked(blocked);
+        }
+        ::new (static_cast<void*>(at(t))) T(std::forward<decltype(x)>(x));
+        if (size)
+            bytes.fetch_add(size, std::memory_order_relaxed);
+        tail.store(t + 1, std::memory_order_release);
+        stats.pushed(1);
+        on_readable.notify();
+    }
+    template <typename InputIt>
+    std::size_t try_push_n(InputIt first, std::size_t n)
+    {
+        if (cancel_requested.load(std::memory_order_relaxed))
+            return n;
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        std::size_t k = space(t, n);
+        if (k > n)
+            k = n;
+        wanted = 0;
+        if (!byte_capacity) {
+            for (std::size_t i = 0; i < k; ++i, ++first)
+                ::new (static_cast<void*>(at(t + i))) T(*first);
+        } else {
+            // as in blocking_queue, an element to convert is checked
+            // before the conversion may move from it
+            const bool converted = !detail::is_item<T, decltype(*first)>::value;
+            const std::size_t used = bytes.load(std::memory_order_acquire);
+            std::size_t added = 0, i = 0;
+            for (; i < k; ++i, ++first) {
+                if (converted && used + added >= byte_capacity
+                    && (i || t != head.load(std::memory_order_acquire))) {
+                    wanted = 1;
+                    break;
+                }
+                auto&& x = detail::as_item<T>(*first);
+                const std::size_t size = detail::item_size(measure, x);
+                if (!converted && used + added + size > byte_capacity
+                    && (i || t != head.load(std::memory_order_acquire))) {
+                    wanted = size;
+                    break;
+                }
+                ::new (static_cast<void*>(at(t + i))) T(std::forward<decltype(x)>(x));
+                added += size;
+            }
+            k = i;
+            bytes.fetch_add(added, std::memory_order_relaxed);
+        }
+        if (k < n)
+            throttled();
+        if (!k)
+            return 0;
+        tail.store(t + k, std::memory_order_release);
+        stats.pushed(k);
+        on_readable.notify();
+        return k;
+    }
+    template <typename InputIt>
+    void push_n(InputIt first, std::size_t n)
+    {
+        for (detail::backoff wait; n;) {
+            const std::size_t k = try_push_n(first, n);
+            if (!k) {
+                detail::probe_timer blocked;
+                wait();
+                stats.producer_blocked(blocked);
+                continue;
+            }
+            std::advance(first, k);
+            n -= k;
+        }
+    }
+    bool pop(T& elem)
+    {
+        const std::size_t h = head.load(std::memory_order_relaxed);
+        if (cancel_requested.load(std::memory_order_relaxed) || !wait_for_element(h))
+            return false;
+        T* p = at(h);
+        if (byte_capacity)
+            bytes.fetch_sub(detail::item_size(measure, *p), std::memory_order_relaxed);
+        elem = std::move(*p);
+        p->~T();
+        // counted before the slots are released, so that a producer
+        // reusing them sees the pop
+        stats.popped(1);
+        head.store(h + 1, std::memory_order_release);
+        on_writable.notify();
+        return true;
+    }
+    template <typename OutputIt>
+    std::size_t try_pop_batch(OutputIt out, std::size_t max)
+    {
+        const std::size_t h = head.load(std::memory_order_relaxed);
+        const std::size_t n = cancel_requested.load(std::memory_order_relaxed) ? 0 : take(h, max);
+        if (!n)
+            return 0;
+        std::size_t size = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            T* p = at(h + i);
+            if (byte_capacity)
+                size += detail::item_size(measure, *p);
+            *out++ = std::move(*p);
+            p->~T();
+        }
+        if (size)
+            bytes.fetch_sub(size, std::memory_order_relaxed);
+        stats.popped(n);
+        head.store(h + n, std::memory_order_release);
+        on_writable.notify();
+        return n;
+    }
+    template <typename OutputIt>
+    std::size_t pop_batch(OutputIt out, std::size_t max)
+    {
+        if (!wait_for_element(head.load(std::memory_order_relaxed)))
+            return 0;
+        return try_pop_batch(out, max);
+    }
+    bool drained()
+    {
+        if (cancel_requested.load(std::memory_order_acquire))
+            return true;
+        const bool was_closed = closed.load(std::memory_order_acquire);
+        return was_closed && head.load(std::memory_order_relaxed)
+                             == tail.load(std::memory_order_acquire);
+    }
+    template <typename F>
+    bool notify_when_readable(F&& resume)
+    {
+        const std::size_t h = head.load(std::memory_order_relaxed);
+        return on_readable.arm(stats.reader_wait(std::forward<F>(resume)), [this, h]() {
+                return closed.load(std::memory_order_acquire)
+                    || cancel_requested.load(std::memory_order_acquire)
+                    || tail.load(std::memory_order_acquire) != h;
+            });
+    }
+    template <typename F>
+    bool notify_when_writable(F&& resume)
+    {
+        const std::size_t t = tail.load(std::memory_order_relaxed);
+        const std::size_t size = wanted;
+        return on_writable.arm(stats.writer_wait(std::forward<F>(resume)), [this, t, size]() {
+                if (cancel_requested.load(std::memory_order_acquire))
+                    return true;
+                const std::size_t h = head.load(std::memory_order_acquire);
+                return t - h <= mask
+                    && (!byte_capacity || t == h
+                        || bytes.load(std::memory_order_acquire) + size <= byte_capacity);
+            });
+    }
+    void close()
+    {
+        closed.store(true, std::memory_order_release);
+        on_readable.notify();
+    }
+    // the queued elements stay until the queue is destroyed, since only
+    // the consumer may touch them
+    void cancel()
+    {
+        if (cancel_requested.exchange(true, std::memory_order_acq_rel))
+            return;
+        on_writable.notify();
+        on_readable.notify();
+        on_cancelled.notify();
+    }
+    bool cancelled() const { return cancel_requested.load(std::memory_order_acquire); }
+    template <typename F>
+    void on_cancel(F&& f)
+    {
+        on_cancelled.chain(std::forward<F>(f),
+                           [this]() { return cancel_requested.load(std::memory_order_acquire); });
+    }
+};
+
+template <typename T>
+const std::size_t spsc_queue<T>::default_capacity;
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_QUEUE_HPP
@@ -0,0 +1,1073 @@
+// Boost.Monads.Segment
+//
+
+#ifndef BOOST_MONADS_SEGMENT_HPP
+#define BOOST_MONADS_SEGMENT_HPP
+
+#include "monad.hpp"
+#include "algorithm.hpp"
+#include "queue.hpp"
+
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+namespace boost { namespace monads {
+
+// A segment monad is a stream of elements flowing through a shared queue.
+// mbind starts a stage that feeds every element of the input queue to
+// the bound function and concatenates the resulting queues, draining
+// one before it asks for the next; mbind(q, concat_map(k, f)) and
+// mbind(q, merge_map(k, f)) keep up to k of them filling at once.  Each
+// stage has exactly one producer and one consumer, so any queue with
+// the contract of queue.hpp can be used as transport.  Stages are tasks on
+// the executor in the queue's options (default_executor() by default),
+// so the number of threads does not grow with the number of stages.
+// A stage's output queue gets the options of its input, including the
+// capacity, so bounding the source bounds every queue of the pipeline;
+// a stage whose output is full suspends until its consumer catches up.
+// Likewise options.metrics reaches every queue and stage, which register
+// their counters with it when metrics are compiled in.
+//
+// Cancelling a stage's output queue (see queue.hpp) cancels its input
+// queue, and so on up to the source, so the whole pipeline upstream of
+// a consumer that has enough stops; take(n), take_while(p) and first(p)
+// are "||" stages that do so once they are done.  A stage waiting for
+// its input is resumed by the cancellation, one waiting for an inner
+// queue notices it once that has more.
+
+template <typename T>
+using shared_blocking_queue = std::shared_ptr<blocking_queue<T> >;
+
+template <typename T>
+using shared_spsc_queue = std::shared_ptr<spsc_queue<T> >;
+
+namespace detail {
+// a queue bounded by options.capacity and options.capacity_bytes;
+// max_size > 0 overrides the element capacity.  Queues and their storage
+// come from the block pool.
+template <typename Q>
+struct segment_queue_factory {
+    static std::shared_ptr<Q> make(queue_options const&, std::size_t /*max_size*/)
+    {
+        return std::allocate_shared<Q>(pool_allocator<Q>());
+    }
+};
+
+template <typename T>
+struct segment_queue_factory<spsc_queue<T> > {
+    static std::shared_ptr<spsc_queue<T> > make(queue_options const& options, std::size_t max_size)
+    {
+        const std::size_t capacity = max_size ? max_size : options.capacity;
+        return std::allocate_shared<spsc_queue<T> >(pool_allocator<spsc_queue<T> >(),
+            capacity ? capacity : spsc_queue<T>::default_capacity, options.capacity_bytes);
+    }
+};
+
+template <typename Q>
+std::shared_ptr<Q> make_segment_queue(queue_options const& options = queue_options(),
+                                      std::size_t max_size = 0)
+{
+    std::shared_ptr<Q> q = segment_queue_factory<Q>::make(options, max_size);
+    q->set_options(options);
+    return q;
+}
+
+// the id a queue's counters have in the pipeline metrics, 0 for none
+template <typename Q>
+auto queue_id_(first_choice, Q const& q) -> decltype(q.probe().id())
+{
+    return q.probe().id();
+}
+
+template <typename Q>
+std::size_t queue_id_(second_choice, Q const&)
+{
+    return 0;
+}
+
+template <typename Q>
+std::size_t queue_id(Q const& q)
+{
+    return queue_id_(make_choice{}, q);
+}
+
+// on_cancel hook of a stage's output: cancels its input, without keeping
+// that alive
+template <typename Q>
+std::function<void()> cancel_input(std::shared_ptr<Q> const& in)
+{
+    std::weak_ptr<Q> w = in;
+    return [w]() {
+        if (std::shared_ptr<Q> q = w.lock())
+            q->cancel();
+    };
+}
+
+// ... and resumes the stage, for stages that tolerate spurious runs
+template <typename Q, typename Stage>
+std::function<void()> cancel_input(std::shared_ptr<Q> const& in, std::shared_ptr<Stage> const& stage)
+{
+    std::function<void()> cancel = cancel_input(in);
+    std::weak_ptr<Stage> w = stage;
+    return [cancel, w]() {
+        cancel();
+        if (std::shared_ptr<Stage> s = w.lock())
+            s->schedule();
+    };
+}
+
+template <typename F, typename T>
+using segment_ret = typename std::decay<decltype(std::declval<F>()(std::declval<T>()))>::type;
+
+template <typename F, typename T>
+using segment_ret_value = typename segment_ret<F, T>::element_type::value_type;
+
+// A stage is a resumable task: run() makes as much progress as the queues
+// allow and, instead of blocking, registers itself with the queue it
+// waits for and returns.  Exactly one run() of a stage is active at a
+// time, so the single-producer/single-consumer contract still holds.
+//
+// The waiters a stage registers own it, and it owns its input, but its
+// output belongs to the consumer: the stage keeps a weak_ptr and holds
+// the queue only while it runs.  A consumer that drops its queue thus
+// frees the stage waiting to push to it, and the queue's destructor
+// cancels the input of a stage waiting to pop, so no cycle of queue,
+// waiter and stage outlives the consumer.
+template <typename Stage>
+struct resumable : std::enable_shared_from_this<Stage> {
+    executor_ref executor;
+
+    std::function<void()> resumer()
+    {
+        std::shared_ptr<Stage> self = this->shared_from_this();
+        executor_ref ex = executor;
+        return [=]() { ex.post([=]() { self->run(); }); };
+    }
+    void start()
+    {
+        resumer()();
+    }
+};
+
+// a stage's output queue while run() is active; null once the consumer
+// has dropped it
+template <typename Q>
+struct held_output {
+    std::shared_ptr<Q>& out;
+
+    held_output(std::shared_ptr<Q>& out, std::weak_ptr<Q> const& output) : out(out)
+    {
+        out = output.lock();
+    }
+    ~held_output() { out.reset(); }
+};
+
+// Every element of in is fed to fun and the resulting queues are drained
+// into out.  Up to batch_size elements are moved per try_pop_batch and
+// try_push_n, so the synchronization cost is paid once per chunk.
+//
+// Cancelling out cancels the inner queue being drained as well, which
+// resumes the stage if it waits for a slow inner queue.
+template <template <typename> class Queue, typename U, typename T, typename F>
+struct bind_stage : resumable<bind_stage<Queue, U, T, F> > {
+    std::shared_ptr<Queue<T> > in;
+    std::weak_ptr<Queue<U> > output;
+    std::shared_ptr<Queue<U> > out;
+    F fun;
+    std::size_t batch;
+    std::vector<T> items;
+    std::size_t next = 0, count = 0;
+    // written by run() under inner_mutex, read by cancel_inner()
+    std::shared_ptr<Queue<U> > inner;
+    std::mutex inner_mutex;
+    std::vector<U> pending;
+    std::size_t pushed = 0;
+    stage_probe stats;
+
+    bind_stage(std::shared_ptr<Queue<T> > const& in, std::shared_ptr<Queue<U> > const& out, F&& fun)
+        : in(in), output(out), fun(std::move(fun))
+        , batch(in->options().batch_size ? in->options().batch_size : 1)
+        , items(batch)
+    {
+        this->executor = in->options().executor;
+        pending.reserve(batch);
+        stats.attach(in->options().metrics, "bind", queue_id(*in), queue_id(*out));
+    }
+
+    void set_inner(std::shared_ptr<Queue<U> > q)
+    {
+        std::lock_guard<std::mutex> lock(inner_mutex);
+        inner.swap(q);
+    }
+    // from the on_cancel hook of out, on any thread
+    void cancel_inner()
+    {
+        std::shared_ptr<Queue<U> > q;
+        {
+            std::lock_guard<std::mutex> lock(inner_mutex);
+            q = inner;
+        }
+        if (q)
+            q->cancel();
+    }
+
+    // false if suspended on a full output queue
+    bool flush()
+    {
+        while (pushed < pending.size()) {
+            const std::size_t k = out->try_push_n(std::make_move_iterator(pending.begin() + pushed),
+                                                  pending.size() - pushed);
+            stats.produced(k);
+            pushed += k;
+            if (pushed < pending.size() && out->notify_when_writable(this->resumer()))
+                return false;
+        }
+        pending.clear();
+        pushed = 0;
+        return true;
+    }
+
+    void run()
+    {
+        stage_probe::busy_timer busy(stats);
+        held_output<Queue<U> > hold(out, output);
+        for (;;) {
+            if (!out || out->cancelled()) {
+                if (inner)
+                    inner->cancel();
+                in->cancel();
+                return;
+            }
+            if (pending.size() >= batch && !flush())
+                return;
+            if (inner) {
+                if (inner->try_pop_batch(std::back_inserter(pending), batch))
+                    continue;
+                if (inner->drained()) {
+                    set_inner(nullptr);
+                    continue;
+                }
+                if (!flush())
+                    return;
+                if (inner->notify_when_readable(this->resumer()))
+                    return;
+                continue;
+            }
+            if (next < count) {
+                set_inner(fun(std::move(items[next++])));
+                continue;
+            }
+            next = 0;
+            if ((count = in->try_pop_batch(items.begin(), batch))) {
+                stats.took(count);
+                continue;
+            }
+            if (!flush())
+                return;
+            if (in->drained()) {
+                out->close();
+                return;
+            }
+            if (in->notify_when_readable(this->resumer()))
+                return;
+        }
+    }
+};
+
+template <template <typename> class Queue, typename U, typename T, typename F>
+std::shared_ptr<Queue<U> >
+segment_bind(std::shared_ptr<Queue<T> > const& q, F fun)
+{
+    auto out = make_segment_queue<Queue<U> >(q->options());
+    auto s = std::make_shared<bind_stage<Queue, U, T, F> >(q, out, std::move(fun));
+    std::function<void()> cancel = cancel_input(q);
+    std::weak_ptr<bind_stage<Queue, U, T, F> > w = s;
+    out->on_cancel([cancel, w]() {
+            cancel();
+            if (auto stage = w.lock())
+                stage->cancel_inner();
+        });
+    s->start();
+    return out;
+}
+
+// parallel(n, f): up to n worker tasks apply f to chunks of the input.
+// Every element gets a sequence number and its result a slot in a ring
+// of `window' slots; the stage moves finished slots to out in sequence
+// order and stops taking input while the window is full, so at most
+// `window' results wait for a slow predecessor.  The stage itself runs
+// whenever input arrives, a worker finishes or out has room; the signal
+// count makes sure only one run() is active at a time.
+template <template <typename> class Queue, typename U, typename T, typename F>
+struct parallel_stage : std::enable_shared_from_this<parallel_stage<Queue, U, T, F> > {
+    typedef typename std::aligned_storage<sizeof(U), alignof(U)>::type slot;
+
+    std::shared_ptr<Queue<T> > in;
+    std::weak_ptr<Queue<U> > output;
+    std::shared_ptr<Queue<U> > out;
+    F fun;
+    executor_ref executor;
+    std::size_t workers;
+    std::size_t batch;
+    std::size_t window;
+    std::unique_ptr<slot[]> slots;
+    std::unique_ptr<std::atomic<bool>[]> ready;
+    std::atomic<std::size_t> active;
+    std::atomic<std::size_t> signals;
+    std::size_t next_seq = 0, next_emit = 0;
+    bool input_done = false, closed = false;
+    std::vector<U> pending;
+    std::size_t pushed = 0;
+    stage_probe stats;
+
+    parallel_stage(std::shared_ptr<Queue<T> > const& in, std::shared_ptr<Queue<U> > const& out,
+                   parallel_t<F>&& stage)
+        : in(in), output(out), fun(std::move(stage.f))
+        , executor(in->options().executor)
+        , workers(stage.workers)
+        , batch(in->options().batch_size ? in->options().batch_size : 1)
+        , window(stage.window ? stage.window : 4 * workers * batch)
+        , slots(new slot[window])
+        , ready(new std::atomic<bool>[window])
+        , active(0), signals(0)
+    {
+        for (std::size_t i = 0; i < window; ++i)
+            ready[i].store(false, std::memory_order_relaxed);
+        pending.reserve(batch);
+        stats.attach(in->options().metrics, "parallel", queue_id(*in), queue_id(*out));
+    }
+    ~parallel_stage()
+    {
+        for (; next_emit != next_seq; ++next_emit)
+            if (ready[next_emit % window].load(std::memory_order_relaxed))
+                at(next_emit)->~U();
+    }
+
+    U* at(std::size_t seq) { return reinterpret_cast<U*>(&slots[seq % window]); }
+
+    void schedule()
+    {
+        if (signals.fetch_add(1, std::memory_order_acq_rel) == 0) {
+            std::shared_ptr<parallel_stage> self = this->shared_from_this();
+            executor.post([self]() { self->run(); });
+        }
+    }
+    std::function<void()> resumer()
+    {
+        std::shared_ptr<parallel_stage> self = this->shared_from_this();
+        return [self]() { self->schedule(); };
+    }
+
+    // busy time of the stage is that of the workers, summed; run(), which
+    // hands out chunks and reorders results, is not counted.  f is the
+    // task's own copy of fun
+    void work(F& f, std::vector<T>& chunk, std::size_t seq)
+    {
+        stage_probe::busy_timer busy(stats);
+        for (auto& x : chunk) {
+            ::new (static_cast<void*>(at(seq))) U(f(std::move(x)));
+            ready[seq++ % window].store(true, std::memory_order_release);
+        }
+        active.fetch_sub(1, std::memory_order_release);
+        schedule();
+    }
+    void dispatch(std::vector<T>&& chunk)
+    {
+        std::shared_ptr<parallel_stage> self = this->shared_from_this();
+        const std::size_t seq = next_seq;
+        next_seq += chunk.size();
+        active.fetch_add(1, std::memory_order_relaxed);
+        auto c = std::make_shared<std::vector<T> >(std::move(chunk));
+        F f = fun;
+        executor.post([self, c, seq, f]() mutable { self->work(f, *c, seq); });
+    }
+
+    // false if suspended on a full output queue
+    bool flush()
+    {
+        while (pushed < pending.size()) {
+            const std::size_t k = out->try_push_n(std::make_move_iterator(pending.begin() + pushed),
+                                                  pending.size() - pushed);
+            stats.produced(k);
+            pushed += k;
+            if (pushed < pending.size() && out->notify_when_writable(resumer()))
+                return false;
+        }
+        pending.clear();
+        pushed = 0;
+        return true;
+    }
+
+    void step()
+    {
+        while (!closed) {
+            if (!out || out->cancelled()) {
+                in->cancel();
+                closed = true;
+                return;
+            }
+            // finished results, in order
+            while (pending.size() < batch && next_emit != next_seq
+                   && ready[next_emit % window].load(std::memory_order_acquire)) {
+                U* p = at(next_emit);
+                pending.push_back(std::move(*p));
+                p->~U();
+                ready[next_emit++ % window].store(false, std::memory_order_relaxed);
+            }
+            if (pending.size() >= batch) {
+                if (!flush())
+                    return;
+                continue;
+            }
+            // more input while the window and the workers allow
+            const std::size_t room = window - (next_seq - next_emit);
+            if (!input_done && room && active.load(std::memory_order_acquire) < workers) {
+                // reserve may give more capacity than asked for
+                const std::size_t take = room < batch ? room : batch;
+                std::vector<T> chunk;
+                chunk.reserve(take);
+                if (in->try_pop_batch(std::back_inserter(chunk), take)) {
+                    stats.took(chunk.size());
+                    dispatch(std::move(chunk));
+                    continue;
+                }
+                if (in->drained())
+                    input_done = true;
+                else if (!in->notify_when_readable(resumer()))
+                    continue;
+            }
+            if (!flush())
+                return;
+            if (input_done && next_emit == next_seq) {
+                out->close();
+                closed = true;
+            }
+            return;
+        }
+    }
+
+    void run()
+    {
+        held_output<Queue<U> > hold(out, output);
+        for (;;) {
+            const std::size_t seen = signals.load(std::memory_order_acquire);
+            step();
+            if (signals.fetch_sub(seen, std::memory_order_acq_rel) == seen)
+                return;
+        }
+    }
+};
+
+template <template <typename> class Queue, typename U, typename T, typename F>
+std::shared_ptr<Queue<U> >
+segment_bind_parallel(std::shared_ptr<Queue<T> > const& q, parallel_t<F> stage)
+{
+    auto out = make_segment_queue<Queue<U> >(q->options());
+    auto s = std::make_shared<parallel_stage<Queue, U, T, F> >(q, out, std::move(stage));
+    out->on_cancel(cancel_input(q, s));
+    s->schedule();
+    return out;
+}
+
+template <typename F, typename T>
+using parallel_ret = typename std::decay<decltype(std::declval<F&>()(std::declval<T>()))>::type;
+
+// concat_map(k, f), merge_map(k, f): keeps up to k of the inner queues
+// f returns open at once, so that their producers run concurrently
+// instead of one after the other.  Ordered, the stage drains the oldest
+// inner queue and the others fill up meanwhile, as far as their capacity
+// lets them; unordered, it takes from whichever has elements and starts
+// the next inner queue as soon as one is drained.  It waits for the
+// input and for several inner queues at once, so as in parallel_stage
+// the signal count keeps a single run() active.
+template <template <typename> class Queue, typename U, typename T, typename F>
+struct merge_stage : std::enable_shared_from_this<merge_stage<Queue, U, T, F> > {
+    std::shared_ptr<Queue<T> > in;
+    std::weak_ptr<Queue<U> > output;
+    std::shared_ptr<Queue<U> > out;
+    F fun;
+    executor_ref executor;
+    std::size_t width;
+    bool ordered;
+    std::size_t batch;
+    std::vector<T> items;
+    std::size_t next = 0, count = 0;
+    bool input_done = false, closed = false;
+    // oldest first
+    std::vector<std::shared_ptr<Queue<U> > > inners;
+    std::size_t turn = 0;
+    std::atomic<std::size_t> signals;
+    std::vector<U> pending;
+    std::size_t pushed = 0;
+    stage_probe stats;
+
+    merge_stage(std::shared_ptr<Queue<T> > const& in, std::shared_ptr<Queue<U> > const& out,
+                merge_t<F>&& stage)
+        : in(in), output(out), fun(std::move(stage.f))
+        , executor(in->options().executor)
+        , width(stage.width), ordered(stage.ordered)
+        , batch(in->options().batch_size ? in->options().batch_size : 1)
+        , items(batch)
+        , signals(0)
+    {
+        inners.reserve(width);
+        pending.reserve(batch);
+        stats.attach(in->options().metrics, ordered ? "concat_map" : "merge_map",
+                     queue_id(*in), queue_id(*out));
+    }
+
+    void schedule()
+    {
+        if (signals.fetch_add(1, std::memory_order_acq_rel) == 0) {
+            std::shared_ptr<merge_stage> self = this->shared_from_this();
+            executor.post([self]() { self->run(); });
+        }
+    }
+    std::function<void()> resumer()
+    {
+        std::shared_ptr<merge_stage> self = this->shared_from_this();
+        return [self]() { self->schedule(); };
+    }
+
+    // false if suspended on a full output queue
+    bool flush()
+    {
+        while (pushed < pending.size()) {
+            const std::size_t k = out->try_push_n(std::make_move_iterator(pending.begin() + pushed),
+                                                  pending.size() - pushed);
+            stats.produced(k);
+            pushed += k;
+            if (pushed < pending.size() && out->notify_when_writable(resumer()))
+                return false;
+        }
+        pending.clear();
+        pushed = 0;
+        return true;
+    }
+
+    // opens inner queues while there is room and input; false if the
+    // input has nothing now
+    bool open_inners()
+    {
+        while (inners.size() < width) {
+            if (next < count) {
+                inners.push_back(fun(std::move(items[next++])));
+                continue;
+            }
+            if (input_done)
+                return true;
+            next = 0;
+            if ((count = in->try_pop_batch(items.begin(), batch))) {
+                stats.took(count);
+                continue;
+            }
+            if (in->drained())
+                input_done = true;
+            else
+                return false;
+        }
+        return true;
+    }
+
+    // moves what inner queue i has to pending; true on progress
+    bool take(std::size_t i)
+    {
+        if (inners[i]->try_pop_batch(std::back_inserter(pending), batch - pending.size()))
+            return true;
+        if (!inners[i]->drained())
+            return false;
+        if (ordered) {
+            inners.erase(inners.begin());
+        } else {
+            inners[i] = std::move(inners.back());
+            inners.pop_back();
+        }
+        return true;
+    }
+
+    void step()
+    {
+        while (!closed) {
+            if (!out || out->cancelled()) {
+                for (auto& q : inners)
+                    q->cancel();
+                inners.clear();
+                in->cancel();
+                closed = true;
+                return;
+            }
+            if (pending.size() >= batch) {
+                if (!flush())
+                    return;
+                continue;
+            }
+            const bool waiting_for_input = !open_inners();
+            bool progress = false;
+            if (ordered) {
+                progress = !inners.empty() && take(0);
+            } else {
+                for (std::size_t k = 0; k < inners.size() && pending.size() < batch; ++k) {
+                    const std::size_t i = turn++ % inners.size();
+                    if (take(i))
+                        progress = true;
+                }
+            }
+            if (progress)
+                continue;
+            if (!flush())
+                return;
+            if (input_done && next == count && inners.empty()) {
+                out->close();
+                closed = true;
+                return;
+            }
+            // nothing to do until the input or an inner queue has more
+            bool ready = waiting_for_input && !in->notify_when_readable(resumer());
+            const std::size_t watched = ordered && !inners.empty() ? 1 : inners.size();
+            for (std::size_t i = 0; i < watched; ++i)
+                if (!inners[i]->notify_when_readable(resumer()))
+                    ready = true;
+            if (!ready)
+                return;
+        }
+    }
+
+    void run()
+    {
+        held_output<Queue<U> > hold(out, output);
+        for (;;) {
+            const std::size_t seen = signals.load(std::memory_order_acquire);
+            step();
+            if (signals.fetch_sub(seen, std::memory_order_acq_rel) == seen)
+                return;
+        }
+    }
+};
+
+template <template <typename> class Queue, typename U, typename T, typename F>
+std::shared_ptr<Queue<U> >
+segment_bind_merge(std::shared_ptr<Queue<T> > const& q, merge_t<F> stage)
+{
+    auto out = make_segment_queue<Queue<U> >(q->options());
+    auto s = std::make_shared<merge_stage<Queue, U, T, F> >(q, out, std::move(stage));
+    out->on_cancel(cancel_input(q, s));
+    s->schedule();
+    return out;
+}
+
+// pushes [from, to) in chunks of batch_size.  A single-pass range is
+// read once, element by element, into a chunk that waits for room in out.
+template <typename Queue, typename Iter>
+struct range_source : resumable<range_source<Queue, Iter> > {
+    typedef typename std::iterator_traits<Iter>::iterator_category category;
+    typedef std::is_base_of<std::forward_iterator_tag, category> multi_pass;
+
+    std::weak_ptr<Queue> output;
+    std::shared_ptr<Queue> out;
+    Iter from;
+    Iter to;
+    std::size_t left;
+    std::size_t batch;
+    // single-pass ranges: read, but not yet pushed from chunk[pushed]
+    std::vector<typename Queue::value_type> chunk;
+    std::size_t pushed;
+    stage_probe stats;
+
+    static std::size_t length(Iter from, Iter to, std::true_type) { return std::distance(from, to); }
+    static std::size_t length(Iter, Iter, std::false_type) { return 0; }
+
+    range_source(std::shared_ptr<Queue> const& out, Iter from, Iter to)
+        : output(out), from(from), to(to), left(length(from, to, multi_pass()))
+        , batch(out->options().batch_size ? out->options().batch_size : 1)
+        , pushed(0)
+    {
+        this->executor = out->options().executor;
+        stats.attach(out->options().metrics, "source", 0, queue_id(*out));
+    }
+
+    bool more(std::true_type) const { return left; }
+    bool more(std::false_type) const { return pushed < chunk.size() || from != to; }
+
+    std::size_t push_some(std::true_type)
+    {
+        const std::size_t n = out->try_push_n(from, left < batch ? left : batch);
+        std::advance(from, n);
+        left -= n;
+        return n;
+    }
+    std::size_t push_some(std::false_type)
+    {
+        if (pushed == chunk.size()) {
+            chunk.clear();
+            pushed = 0;
+            for (; chunk.size() < batch && from != to; ++from)
+                chunk.push_back(*from);
+        }
+        const std::size_t n = out->try_push_n(std::make_move_iterator(chunk.begin() + pushed),
+                                              chunk.size() - pushed);
+        pushed += n;
+        return n;
+    }
+
+    void run()
+    {
+        stage_probe::busy_timer busy(stats);
+        held_output<Queue> hold(out, output);
+        while (more(multi_pass())) {
+            if (!out || out->cancelled())
+                return;
+            const std::size_t n = push_some(multi_pass());
+            stats.produced(n);
+            if (!n && out->notify_when_writable(this->resumer()))
+                return;
+        }
+        if (out)
+            out->close();
+    }
+};
+
+// calls on_element for each element of in and on_close at the end
+template <typename Queue, typename OnElement, typename OnClose>
+struct consume_stage : resumable<consume_stage<Queue, OnElement, OnClose> > {
+    std::shared_ptr<Queue> in;
+    OnElement on_element;
+    OnClose on_close;
+    std::vector<typename Queue::value_type> items;
+    stage_probe stats;
+
+    consume_stage(std::shared_ptr<Queue> const& in, OnElement&& on_element, OnClose&& on_close)
+        : in(in), on_element(std::move(on_element)), on_close(std::move(on_close))
+    {
+        this->executor = in->options().executor;
+        items.reserve(in->options().batch_size ? in->options().batch_size : 1);
+        stats.attach(in->options().metrics, "consume", queue_id(*in), 0);
+    }
+
+    void run()
+    {
+        stage_probe::busy_timer busy(stats);
+        for (;;) {
+            if (in->try_pop_batch(std::back_inserter(items), items.capacity())) {
+                stats.took(items.size());
+                for (auto& x : items)
+                    on_element(std::move(x));
+                items.clear();
+                continue;
+            }
+            if (in->drained()) {
+                on_close();
+                return;
+            }
+            if (in->notify_when_readable(this->resumer()))
+                return;
+        }
+    }
+};
+
+// what a take stage does with an element
+enum class take_step { keep, skip, stop };
+
+struct take_count {
+    std::size_t left;
+    template <typename T>
+    take_step operator()(T const&)
+    {
+        --left;
+        return take_step::keep;
+    }
+    bool done() const { return !left; }
+};
+
+template <typename P>
+struct take_while_true {
+    P p;
+    template <typename T>
+    take_step operator()(T const& x)
+    {
+        return p(x) ? take_step::keep : take_step::stop;
+    }
+    bool done() const { return false; }
+};
+
+template <typename P>
+struct take_first {
+    P p;
+    bool found;
+    template <typename T>
+    take_step operator()(T const& x)
+    {
+        if (!p(x))
+            return take_step::skip;
+        found = true;
+        return take_step::keep;
+    }
+    bool done() const { return found; }
+};
+
+struct any_element {
+    template <typename T>
+    bool operator()(T const&) const { return true; }
+};
+
+// passes on the elements of in until limit is done or says stop, then
+// closes out and cancels in
+template <typename Queue, typename Limit>
+struct take_stage : resumable<take_stage<Queue, Limit> > {
+    typedef typename Queue::value_type T;
+
+    std::shared_ptr<Queue> in;
+    std::weak_ptr<Queue> output;
+    std::shared_ptr<Queue> out;
+    Limit limit;
+    std::size_t batch;
+    std::vector<T> items;
+    std::size_t next = 0, count = 0;
+    bool done = false;
+    std::vector<T> pending;
+    std::size_t pushed = 0;
+    stage_probe stats;
+
+    take_stage(std::shared_ptr<Queue> const& in, std::shared_ptr<Queue> const& out, Limit&& limit)
+        : in(in), output(out), limit(std::move(limit))
+        , batch(in->options().batch_size ? in->options().batch_size : 1)
+        , items(batch)
+    {
+        this->executor = in->options().executor;
+        pending.reserve(batch);
+        stats.attach(in->options().metrics, "take", queue_id(*in), queue_id(*out));
+    }
+
+    // false if suspended on a full output queue
+    bool flush()
+    {
+        while (pushed < pending.size()) {
+            const std::size_t k = out->try_push_n(std::make_move_iterator(pending.begin() + pushed),
+                                                  pending.size() - pushed);
+            stats.produced(k);
+            pushed += k;
+            if (pushed < pending.size() && out->notify_when_writable(this->resumer()))
+                return false;
+        }
+        pending.clear();
+        pushed = 0;
+        return true;
+    }
+
+    void finish()
+    {
+        done = true;
+        in->cancel();
+    }
+
+    void run()
+    {
+        stage_probe::busy_timer busy(stats);
+        held_output<Queue> hold(out, output);
+        for (;;) {
+            if (!out || out->cancelled()) {
+                in->cancel();
+                return;
+            }
+            if (pending.size() >= batch || done) {
+                if (!flush())
+                    return;
+                if (done) {
+                    out->close();
+                    return;
+                }
+            }
+            if (limit.done()) {
+                finish();
+                continue;
+            }
+            if (next < count) {
+                T& x = items[next++];
+                const take_step step = limit(x);
+                if (step == take_step::keep)
+                    pending.push_back(std::move(x));
+                else if (step == take_step::stop)
+                    finish();
+                continue;
+            }
+            next = 0;
+            if ((count = in->try_pop_batch(items.begin(), batch))) {
+                stats.took(count);
+                continue;
+            }
+            if (!flush())
+                return;
+            if (in->drained()) {
+                out->close();
+                return;
+            }
+            if (in->notify_when_readable(this->resumer()))
+                return;
+        }
+    }
+};
+} // namespace detail
+
+template <template <typename> class Queue>
+struct basic_segment_monad {
+    template <typename T>
+    using queue_type = Queue<T>;
+
+    // One per element in a >> stage, so these are as cheap as a queue
+    // gets: pooled, born closed, with default options and nothing to
+    // lock or notify.
+    template <typename T>
+    static std::shared_ptr<Queue<T> > mempty()
+    {
+        return std::allocate_shared<Queue<T> >(pool_allocator<Queue<T> >(), closed_queue_t());
+    }
+
+    template <typename T>
+    static std::shared_ptr<Queue<typename std::decay<T>::type> > mreturn(T x)
+    {
+        return std::allocate_shared<Queue<T> >(pool_allocator<Queue<T> >(), closed_queue_t(),
+                                               std::forward<T>(x));
+    }
+
+    // the range is pushed in chunks of options.batch_size elements by a
+    // task on options.executor; the task is suspended while the queue is
+    // full
+    template <typename Iter,
+              typename T=typename std::iterator_traits<Iter>::value_type>
+    static std::shared_ptr<Queue<T> >
+    from_range(Iter from, Iter to, queue_options const& options = queue_options())
+    {
+        auto out = detail::make_segment_queue<Queue<T> >(options);
+        std::make_shared<detail::range_source<Queue<T>, Iter> >(out, from, to)->start();
+        return out;
+    }
+
+    // pipeline<...>(q, options): the stages bound to q from now on run
+    // with options and bound their output queues accordingly.  q itself
+    // is only bounded afresh if it is a blocking_queue, since a ring
+    // buffer's capacity is fixed when it is created.
+    template <typename T>
+    static void configure(std::shared_ptr<Queue<T> > const& q, queue_options const& options)
+    {
+        q->set_options(options);
+    }
+
+    // the metrics the stages bound to q register with, null if none
+    template <typename T>
+    static pipeline_metrics_ptr metrics(std::shared_ptr<Queue<T> > const& q)
+    {
+        return q->options().metrics;
+    }
+};
+
+typedef basic_segment_monad<blocking_queue> segment_monad;
+typedef basic_segment_monad<spsc_queue> spsc_segment_monad;
+
+template <typename T, typename F,
+          typename U = detail::segment_ret_value<F, T> >
+shared_blocking_queue<U>
+boost_mbind(shared_blocking_queue<T> const& q, F fun)
+{
+    return detail::segment_bind<blocking_queue, U>(q, std::move(fun));
+}
+
+template <typename T, typename F,
+          typename U = detail::segment_ret_value<F, T> >
+shared_spsc_queue<U>
+boost_mbind(shared_spsc_queue<T> const& q, F fun)
+{
+    return detail::segment_bind<spsc_queue, U>(q, std::move(fun));
+}
+
+template <typename T, typename F,
+          typename U = detail::parallel_ret<F, T> >
+shared_blocking_queue<U>
+boost_mbind(shared_blocking_queue<T> const& q, parallel_t<F> stage)
+{
+    return detail::segment_bind_parallel<blocking_queue, U>(q, std::move(stage));
+}
+
+template <typename T, typename F,
+          typename U = detail::parallel_ret<F, T> >
+shared_spsc_queue<U>
+boost_mbind(shared_spsc_queue<T> const& q, parallel_t<F> stage)
+{
+    return detail::segment_bind_parallel<spsc_queue, U>(q, std::move(stage));
+}
+
+template <typename T, typename F,
+          typename U = detail::segment_ret_value<F, T> >
+shared_blocking_queue<U>
+boost_mbind(shared_blocking_queue<T> const& q, merge_t<F> stage)
+{
+    return detail::segment_bind_merge<blocking_queue, U>(q, std::move(stage));
+}
+
+template <typename T, typename F,
+          typename U = detail::segment_ret_value<F, T> >
+shared_spsc_queue<U>
+boost_mbind(shared_spsc_queue<T> const& q, merge_t<F> stage)
+{
+    return detail::segment_bind_merge<spsc_queue, U>(q, std::move(stage));
+}
+
+// Hand-written stages: run on_element(x) for every element of q, then
+// on_close(), as a task on q's executor.  The callbacks must not block.
+template <typename Queue, typename OnElement, typename OnClose>
+void consume(std::shared_ptr<Queue> const& q, OnElement on_element, OnClose on_close)
+{
+    typedef detail::consume_stage<Queue, OnElement, OnClose> stage;
+    std::make_shared<stage>(q, std::move(on_element), std::move(on_close))->start();
+}
+
+// A "||" stage, `p || take(n)', that passes on a prefix of its input and
+// then cancels it, which stops the stages upstream.
+template <typename Limit>
+struct take_t {
+    Limit limit;
+
+    template <typename Queue>
+    std::shared_ptr<Queue> operator()(std::shared_ptr<Queue> const& q) const
+    {
+        auto out = detail::make_segment_queue<Queue>(q->options());
+        out->on_cancel(detail::cancel_input(q));
+        std::make_shared<detail::take_stage<Queue, Limit> >(q, out, Limit(limit))->start();
+        return out;
+    }
+};
+
+// the first n elements
+inline take_t<detail::take_count> take(std::size_t n)
+{
+    return take_t<detail::take_count>{detail::take_count{n}};
+}
+
+// the elements up to the first one that fails p
+template <typename P>
+take_t<detail::take_while_true<typename std::decay<P>::type> > take_while(P&& p)
+{
+    typedef detail::take_while_true<typename std::decay<P>::type> limit;
+    return take_t<limit>{limit{std::forward<P>(p)}};
+}
+
+// the first element that satisfies p, if any
+template <typename P>
+take_t<detail::take_first<typename std::decay<P>::type> > first(P&& p)
+{
+    typedef detail::take_first<typename std::decay<P>::type> limit;
+    return take_t<limit>{limit{std::forward<P>(p), false}};
+}
+
+// the first element, if any
+inline take_t<detail::take_first<detail::any_element> > first()
+{
+    return first(detail::any_element());
+}
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_SEGMENT_HPP
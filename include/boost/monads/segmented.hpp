@@ -0,0 +1,334 @@
+// Boost.Monads.Segmented
+//
+
+#ifndef BOOST_MONADS_SEGMENTED_HPP
+#define BOOST_MONADS_SEGMENTED_HPP
+
+#include "monad.hpp"
+#include "queue.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace boost { namespace monads {
+
+// Segmented iteration: many containers store their elements in
+// contiguous chunks (std::deque's nodes, the batches of a queue, ...).
+// Iterating them with a single iterator pays for a chunk boundary check
+// on every increment; handing out one [first, last) range per chunk lets
+// the inner loop run over plain pointers instead.
+//
+//   for_each_segment(c, k)  -- calls k(first, last) for every chunk of c,
+//                              in order
+//
+// The overloading priorities are the same as for mbind:
+//   (1) member function c.for_each_segment(k)
+//   (2) free function boost_for_each_segment(c, k) found via adl
+//   (3) default definitions inside boost::monads::detail: std::deque
+//       (node by node with libstdc++, in one piece elsewhere),
+//       std::vector, the queues of queue.hpp (consumed batch by batch)
+//       and, as fallback, any range as a single segment
+//
+// foreacher(c) turns this into a continuation for run_cont, and the
+// segmented_* algorithms below are the standard algorithms on top of it.
+//
+// span_foreacher(c) is a continuation of a different shape: k receives
+// each segment as a span (pointer and length) instead of each element,
+// so a kernel over the span is one call per segment and can be
+// vectorized even when k is reached through type erasure.  The spans
+// are read-only, span<T const> for every container: a segment that is
+// not contiguous in memory is handed out as a copy.
+
+namespace detail {
+
+template <typename It, typename K>
+void range_as_segment(It first, It last, K& k)
+{
+    k(first, last);
+}
+
+#if defined(__GLIBCXX__)
+// libstdc++'s deque iterator knows the end of the node it points into
+template <typename It, typename K>
+void deque_segments(It first, It last, K& k)
+{
+    for (typename It::difference_type len = last - first; len > 0;) {
+        typename It::difference_type n = first._M_last - first._M_cur;
+        if (n > len)
+            n = len;
+        typename It::pointer p = first._M_cur;
+        k(p, p + n);
+        first += n;
+        len -= n;
+    }
+}
+#else
+template <typename It, typename K>
+void deque_segments(It first, It last, K& k)
+{
+    range_as_segment(first, last, k);
+}
+#endif
+
+template <typename T, typename A, typename K>
+void do_for_each_segment(std::deque<T, A>& d, K& k)
+{
+    deque_segments(d.begin(), d.end(), k);
+}
+
+template <typename T, typename A, typename K>
+void do_for_each_segment(std::deque<T, A> const& d, K& k)
+{
+    deque_segments(d.begin(), d.end(), k);
+}
+
+// a vector is one contiguous segment
+template <typename T, typename A, typename K>
+typename std::enable_if<!std::is_same<T, bool>::value>::type
+do_for_each_segment(std::vector<T, A>& v, K& k)
+{
+    k(v.data(), v.data() + v.size());
+}
+
+template <typename T, typename A, typename K>
+typename std::enable_if<!std::is_same<T, bool>::value>::type
+do_for_each_segment(std::vector<T, A> const& v, K& k)
+{
+    k(v.data(), v.data() + v.size());
+}
+
+// pops the queue until it is closed and drained, one batch per segment
+template <typename Queue, typename K>
+void queue_segments(Queue& q, K& k)
+{
+    const std::size_t batch = q.options().batch_size > 256 ? q.options().batch_size : 256;
+    std::vector<typename Queue::value_type> buf(batch);
+    while (std::size_t n = q.pop_batch(buf.begin(), batch))
+        k(buf.data(), buf.data() + n);
+}
+
+template <typename T, typename K>
+void do_for_each_segment(blocking_queue<T>& q, K& k)
+{
+    queue_segments(q, k);
+}
+
+template <typename T, typename K>
+void do_for_each_segment(spsc_queue<T>& q, K& k)
+{
+    queue_segments(q, k);
+}
+
+template <typename T, typename K>
+void do_for_each_segment(std::shared_ptr<blocking_queue<T> > const& q, K& k)
+{
+    queue_segments(*q, k);
+}
+
+template <typename T, typename K>
+void do_for_each_segment(std::shared_ptr<spsc_queue<T> > const& q, K& k)
+{
+    queue_segments(*q, k);
+}
+
+template <typename R, typename K>
+auto do_for_each_segment(R& r, K& k)
+    -> decltype(range_as_segment(std::begin(r), std::end(r), k))
+{
+    range_as_segment(std::begin(r), std::end(r), k);
+}
+
+template <typename C, typename K>
+auto for_each_segment_(first_choice, C& c, K& k)
+    -> decltype(c.for_each_segment(k))
+{
+    return c.for_each_segment(k);
+}
+
+template <typename C, typename K>
+auto for_each_segment_(second_choice, C& c, K& k)
+    -> decltype(boost_for_each_segment(c, k))
+{
+    return boost_for_each_segment(c, k);
+}
+
+template <typename C, typename K>
+auto for_each_segment_(third_choice, C& c, K& k)
+    -> decltype(detail::do_for_each_segment(c, k))
+{
+    return detail::do_for_each_segment(c, k);
+}
+} // namespace detail
+
+template <typename C, typename K>
+void for_each_segment(C& c, K&& k)
+{
+    detail::for_each_segment_(detail::make_choice{}, c, k);
+}
+
+// contiguous elements handed to span continuations
+template <typename T>
+struct span {
+    T* ptr;
+    std::size_t len;
+
+    T* data() const { return ptr; }
+    std::size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    T* begin() const { return ptr; }
+    T* end() const { return ptr + len; }
+    T& operator[](std::size_t i) const { return ptr[i]; }
+};
+
+namespace detail {
+template <typename K>
+struct each_span {
+    K& k;
+    template <typename T>
+    void operator()(T* first, T* last) const
+    {
+        k(span<T const>{first, static_cast<std::size_t>(last - first)});
+    }
+    // segments that are not contiguous in memory are copied in chunks
+    template <typename It>
+    void operator()(It first, It last) const
+    {
+        typedef typename std::iterator_traits<It>::value_type V;
+        std::vector<V> buf;
+        buf.reserve(256);
+        while (first != last) {
+            for (buf.clear(); first != last && buf.size() < buf.capacity(); ++first)
+                buf.push_back(*first);
+            k(span<V const>{buf.data(), buf.size()});
+        }
+    }
+};
+
+template <typename K>
+struct each_element {
+    K& k;
+    template <typename It>
+    void operator()(It first, It last) const
+    {
+        for (; first != last; ++first)
+            k(*first);
+    }
+};
+
+template <typename T, typename Op>
+struct accumulate_segment {
+    T& acc;
+    Op& op;
+    template <typename It>
+    void operator()(It first, It last) const
+    {
+        acc = std::accumulate(first, last, std::move(acc), op);
+    }
+};
+
+template <typename Pred>
+struct count_segment {
+    std::size_t& n;
+    Pred& pred;
+    template <typename It>
+    void operator()(It first, It last) const
+    {
+        n += std::count_if(first, last, pred);
+    }
+};
+
+template <typename OutputIt>
+struct copy_segment {
+    OutputIt& out;
+    template <typename It>
+    void operator()(It first, It last) const
+    {
+        out = std::copy(first, last, out);
+    }
+};
+} // namespace detail
+
+// a continuation that feeds every element of c to k, segment by segment:
+//   run_cont(foreacher(d), [&](int i) { sum += i; });
+template <typename C>
+struct segmented_foreacher {
+    C& c;
+
+    template <typename K>
+    void operator()(K&& k) const
+    {
+        for_each_segment(c, detail::each_element<typename std::remove_reference<K>::type>{k});
+    }
+};
+
+template <typename C>
+segmented_foreacher<C> foreacher(C& c)
+{
+    return segmented_foreacher<C>{c};
+}
+
+// a continuation that feeds c to k one span<T const> per segment:
+//   run_cont(span_foreacher(d), [&](span<int const> s) { sum += kernel(s); });
+template <typename C>
+struct segmented_span_foreacher {
+    C& c;
+
+    template <typename K>
+    void operator()(K&& k) const
+    {
+        for_each_segment(c, detail::each_span<typename std::remove_reference<K>::type>{k});
+    }
+};
+
+template <typename C>
+segmented_span_foreacher<C> span_foreacher(C& c)
+{
+    return segmented_span_foreacher<C>{c};
+}
+
+template <typename C, typename F>
+F segmented_for_each(C& c, F f)
+{
+    for_each_segment(c, detail::each_element<F>{f});
+    return f;
+}
+
+template <typename C, typename T, typename Op>
+T segmented_accumulate(C& c, T init, Op op)
+{
+    for_each_segment(c, detail::accumulate_segment<T, Op>{init, op});
+    return init;
+}
+
+template <typename C, typename T>
+T segmented_accumulate(C& c, T init)
+{
+    return segmented_accumulate(c, std::move(init), std::plus<T>());
+}
+
+template <typename C, typename Pred>
+std::size_t segmented_count_if(C& c, Pred pred)
+{
+    std::size_t n = 0;
+    for_each_segment(c, detail::count_segment<Pred>{n, pred});
+    return n;
+}
+
+template <typename C, typename OutputIt>
+OutputIt segmented_copy(C& c, OutputIt out)
+{
+    for_each_segment(c, detail::copy_segment<OutputIt>{out});
+    return out;
+}
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_SEGMENTED_HPP
@@ -0,0 +1,152 @@
+// Boost.Monads.State
+//
+
+#ifndef BOOST_MONADS_STATE_HPP
+#define BOOST_MONADS_STATE_HPP
+
+#include "monad.hpp"
+
+#include <type_traits>
+#include <utility>
+
+namespace boost { namespace monads {
+
+// The State monad: an action that yields a value from a state S and may
+// change it.  A pure action would take the state and return it along
+// with the value, handing a fresh S from step to step; these actions
+// change the state in place, through an S&, so running a chain does not
+// copy the state at all.
+//   mbind(m, f)                  -- runs m, then the action f returns
+//                                   for its value
+//   mreturn<state_monad<S> >(a)  -- yields a and leaves the state alone
+//   get_state<S>(), put_state(s), modify_state<S>(f)
+//   run_state(m, s)              -- runs m on s and returns the value
+// A bind composes statically, like cont_monad::mbind.  An lvalue action
+// is copied into the composed one; a temporary is bound in place (see
+// monad.hpp), moving its action along with whatever it captured.
+
+template <typename S, typename F> class state;
+
+namespace detail {
+template <typename S, typename F>
+using state_ret = typename std::decay<decltype(std::declval<F const&>()(std::declval<S&>()))>::type;
+
+template <typename F, typename G>
+struct state_bind {
+    F first;
+    G then;
+
+    template <typename S>
+    auto operator()(S& s) const -> decltype(then(first(s))(s))
+    {
+        return then(first(s))(s);
+    }
+};
+
+template <typename A>
+struct state_yield {
+    A value;
+
+    template <typename S>
+    A operator()(S&) const { return value; }
+};
+
+template <typename S>
+struct state_get {
+    S operator()(S& s) const { return s; }
+};
+
+template <typename S>
+struct state_put {
+    S value;
+
+    unit operator()(S& s) const
+    {
+        s = value;
+        return unit();
+    }
+};
+
+template <typename F>
+struct state_modify {
+    F f;
+
+    template <typename S>
+    unit operator()(S& s) const
+    {
+        f(s);
+        return unit();
+    }
+};
+} // namespace detail
+
+template <typename S, typename F>
+class state
+{
+    F action;
+public:
+    typedef S state_type;
+    typedef detail::state_ret<S, F> value_type;
+
+    explicit state(F action) : action(std::move(action)) {}
+
+    value_type operator()(S& s) const
+    {
+        return action(s);
+    }
+
+    template <typename G>
+    state<S, detail::state_bind<F, typename std::decay<G>::type> > mbind(G&& fun) const&
+    {
+        typedef detail::state_bind<F, typename std::decay<G>::type> bound;
+        return state<S, bound>(bound{action, std::forward<G>(fun)});
+    }
+
+    template <typename G>
+    state<S, detail::state_bind<F, typename std::decay<G>::type> > mbind_inplace(G&& fun) &&
+    {
+        typedef detail::state_bind<F, typename std::decay<G>::type> bound;
+        return state<S, bound>(bound{std::move(action), std::forward<G>(fun)});
+    }
+};
+
+template <typename S>
+struct state_monad {
+    template <typename A>
+    static state<S, detail::state_yield<typename std::decay<A>::type> > mreturn(A&& a)
+    {
+        typedef detail::state_yield<typename std::decay<A>::type> yield;
+        return state<S, yield>(yield{std::forward<A>(a)});
+    }
+};
+
+template <typename S>
+state<S, detail::state_get<S> > get_state()
+{
+    return state<S, detail::state_get<S> >(detail::state_get<S>());
+}
+
+template <typename S>
+state<typename std::decay<S>::type, detail::state_put<typename std::decay<S>::type> > put_state(S&& s)
+{
+    typedef typename std::decay<S>::type state_type;
+    return state<state_type, detail::state_put<state_type> >(detail::state_put<state_type>{std::forward<S>(s)});
+}
+
+// f(s) changes the state in place
+template <typename S, typename F>
+state<S, detail::state_modify<typename std::decay<F>::type> > modify_state(F&& f)
+{
+    typedef detail::state_modify<typename std::decay<F>::type> modify;
+    return state<S, modify>(modify{std::forward<F>(f)});
+}
+
+template <typename S, typename F>
+typename state<S, F>::value_type run_state(state<S, F> const& m, S& s)
+{
+    return m(s);
+}
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_STATE_HPP
@@ -0,0 +1,275 @@
+// Boost.Monads.Trampoline
+//
+
+#ifndef BOOST_MONADS_TRAMPOLINE_HPP
+#define BOOST_MONADS_TRAMPOLINE_HPP
+
+#include "controlmonad.hpp"
+
+#include <boost/optional.hpp>
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace boost { namespace monads {
+
+// Running a chain of cont_monad binds calls one continuation from inside
+// the other, so the native stack grows with the length of the chain.
+// That is fine for chains fixed at compile time, but a loop built at
+// runtime (e.g. through type_erased_cont_monad) of a few hundred
+// thousand binds overflows it.
+//
+// trampolined_cont_monad<A> runs in constant stack instead: a bind and
+// the continuation it installs return the next step to a driver loop
+// rather than taking it.  Computations and continuations are lists of
+// heap nodes, each pointing to the next, which are also released
+// iteratively.  The price is an allocation and a few indirect calls per
+// bind (see bench/monads.cpp).
+//
+//   trampolined_cps::mreturn(x)  -- the monad of x
+//   trampolined<A>(m)            -- runs the cont_monad m on a trampoline;
+//                                   m must return the result of its
+//                                   continuation
+//   mbind(m, f)                  -- f: A -> trampolined_cont_monad<B>
+//   run_cont(m, k)               -- drives m to completion and returns k's
+//                                   result
+
+template <typename A> class trampolined_cont_monad;
+
+namespace detail {
+struct trampoline_node {
+    virtual ~trampoline_node() {}
+    // hands over the node this one refers to, if any
+    virtual std::shared_ptr<trampoline_node> release() { return std::shared_ptr<trampoline_node>(); }
+};
+
+// a long list of nodes is taken apart link by link instead of recursively
+inline void release_list(std::shared_ptr<trampoline_node> p)
+{
+    while (p && p.use_count() == 1)
+        p = p->release();
+}
+
+template <typename A> struct trampoline_comp;
+template <typename A> struct trampoline_cont;
+
+// The rest of a computation: done, or the next step, which is to run a
+// computation with a continuation.  Steps are plain pairs of pointers,
+// so bouncing does not allocate.
+class trampoline
+{
+    std::shared_ptr<trampoline_node const> comp;
+    std::shared_ptr<trampoline_node const> k;
+    trampoline (*resume)(trampoline_node const&, std::shared_ptr<trampoline_node const> const&);
+
+    template <typename A>
+    static trampoline resume_(trampoline_node const& comp, std::shared_ptr<trampoline_node const> const& k)
+    {
+        return static_cast<trampoline_comp<A> const&>(comp).run(
+            std::static_pointer_cast<trampoline_cont<A> const>(k));
+    }
+public:
+    trampoline() : resume(nullptr) {}
+
+    template <typename A>
+    static trampoline step(std::shared_ptr<trampoline_comp<A> const> comp,
+                           std::shared_ptr<trampoline_cont<A> const> k)
+    {
+        trampoline t;
+        t.comp = std::move(comp);
+        t.k = std::move(k);
+        t.resume = &resume_<A>;
+        return t;
+    }
+
+    bool done() const { return !resume; }
+
+    void run() &&
+    {
+        while (resume) {
+            trampoline next = resume(*comp, k);
+            *this = std::move(next);
+        }
+    }
+};
+
+// a computation of an A, run with a continuation
+template <typename A>
+struct trampoline_comp : trampoline_node {
+    typedef std::shared_ptr<trampoline_cont<A> const> continuation;
+    virtual trampoline run(continuation const& k) const = 0;
+};
+
+// what to do with an A
+template <typename A>
+struct trampoline_cont : trampoline_node {
+    virtual trampoline operator()(A a) const = 0;
+};
+
+template <typename A>
+struct pure_node : trampoline_comp<A> {
+    A value;
+    explicit pure_node(A value) : value(std::move(value)) {}
+
+    trampoline run(typename trampoline_comp<A>::continuation const& k) const
+    {
+        return (*k)(value);
+    }
+};
+
+// runs a cont_monad whose continuation returns a trampoline
+template <typename A, typename M>
+struct lift_node : trampoline_comp<A> {
+    M m;
+    explicit lift_node(M m) : m(std::move(m)) {}
+
+    trampoline run(typename trampoline_comp<A>::continuation const& k) const
+    {
+        return m([&k](A a) { return (*k)(std::move(a)); });
+    }
+};
+
+// the continuation of m in m >>= f: runs f(a) with the continuation k
+// of the bind, as the next step
+template <typename A, typename B, typename F>
+struct bind_cont : trampoline_cont<A> {
+    F f;
+    std::shared_ptr<trampoline_cont<B> const> k;
+
+    bind_cont(F const& f, std::shared_ptr<trampoline_cont<B> const> const& k) : f(f), k(k) {}
+    ~bind_cont() { release_list(release()); }
+    std::shared_ptr<trampoline_node> release()
+    {
+        std::shared_ptr<trampoline_node> p = std::const_pointer_cast<trampoline_cont<B> >(k);
+        k.reset();
+        return p;
+    }
+
+    trampoline operator()(A a) const
+    {
+        return trampoline::step(f(std::move(a)).node, k);
+    }
+};
+
+// m >>= f: the next step runs m with bind_cont
+template <typename A, typename B, typename F>
+struct bind_node : trampoline_comp<B> {
+    std::shared_ptr<trampoline_comp<A> const> prev;
+    F f;
+
+    bind_node(std::shared_ptr<trampoline_comp<A> const> prev, F f)
+        : prev(std::move(prev)), f(std::move(f)) {}
+    ~bind_node() { release_list(release()); }
+    std::shared_ptr<trampoline_node> release()
+    {
+        std::shared_ptr<trampoline_node> p = std::const_pointer_cast<trampoline_comp<A> >(prev);
+        prev.reset();
+        return p;
+    }
+
+    trampoline run(typename trampoline_comp<B>::continuation const& k) const
+    {
+        typedef bind_cont<A, B, F> then;
+        return trampoline::step(prev, std::shared_ptr<trampoline_cont<A> const>(std::make_shared<then>(f, k)));
+    }
+};
+
+// the result of the continuation given to run_cont, stored in place;
+// a reference is kept as a pointer to what it refers to
+template <typename R, bool = std::is_reference<R>::value>
+struct trampoline_result {
+    boost::optional<R> value;
+    template <typename K, typename A>
+    void set(K& k, A&& a) { value.emplace(k(std::forward<A>(a))); }
+    R get() { return std::move(*value); }
+};
+
+template <typename R>
+struct trampoline_result<R, true> {
+    typename std::remove_reference<R>::type* value;
+    template <typename K, typename A>
+    void set(K& k, A&& a)
+    {
+        R&& r = k(std::forward<A>(a));
+        value = &r;
+    }
+    R get() { return static_cast<R>(*value); }
+};
+
+template <>
+struct trampoline_result<void, false> {
+    template <typename K, typename A>
+    void set(K& k, A&& a) { k(std::forward<A>(a)); }
+    void get() {}
+};
+
+template <typename A, typename K, typename R>
+struct last_cont : trampoline_cont<A> {
+    K& k;
+    trampoline_result<R>& result;
+    last_cont(K& k, trampoline_result<R>& result) : k(k), result(result) {}
+
+    trampoline operator()(A a) const
+    {
+        result.set(k, std::move(a));
+        return trampoline();
+    }
+};
+} // namespace detail
+
+template <typename A>
+class trampolined_cont_monad
+{
+    template <typename, typename, typename> friend struct detail::bind_cont;
+
+    std::shared_ptr<detail::trampoline_comp<A> const> node;
+public:
+    typedef A value_type;
+
+    explicit trampolined_cont_monad(std::shared_ptr<detail::trampoline_comp<A> const> node)
+        : node(std::move(node)) {}
+
+    template <typename K>
+    auto operator()(K&& k) const
+        -> decltype(k(std::declval<A>()))
+    {
+        typedef decltype(k(std::declval<A>())) R;
+        typedef detail::last_cont<A, typename std::remove_reference<K>::type, R> last;
+        detail::trampoline_result<R> result;
+        std::shared_ptr<detail::trampoline_cont<A> const> done = std::make_shared<last>(k, result);
+        node->run(done).run();
+        return result.get();
+    }
+
+    // first argument  s :: trampolined_cont_monad a
+    // second argument f :: a -> trampolined_cont_monad b
+    // return type       :: trampolined_cont_monad b
+    template <typename F,
+              typename MB = typename std::decay<decltype(std::declval<F&>()(std::declval<A>()))>::type,
+              typename B = typename MB::value_type>
+    trampolined_cont_monad<B> mbind(F f) const
+    {
+        typedef detail::bind_node<A, B, F> bind;
+        return trampolined_cont_monad<B>(std::make_shared<bind>(node, std::move(f)));
+    }
+};
+
+struct trampolined_cps {
+    template <typename T>
+    static trampolined_cont_monad<typename std::decay<T>::type> mreturn(T&& x)
+    {
+        typedef typename std::decay<T>::type A;
+        return trampolined_cont_monad<A>(std::make_shared<detail::pure_node<A> >(std::forward<T>(x)));
+    }
+};
+
+template <typename A, typename M>
+trampolined_cont_monad<A> trampolined(M m)
+{
+    return trampolined_cont_monad<A>(std::make_shared<detail::lift_node<A, M> >(std::move(m)));
+}
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_TRAMPOLINE_HPP
@@ -0,0 +1,92 @@
+// Boost.Monads.Writer
+//
+
+#ifndef BOOST_MONADS_WRITER_HPP
+#define BOOST_MONADS_WRITER_HPP
+
+#include "monad.hpp"
+
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+namespace boost { namespace monads {
+
+// The Writer monad: a value and a log W that every bind appends to.
+//   mbind(m, f)                -- f(value), its log appended to m's
+//   mreturn<writer<W, A> >(a)  -- a with an empty log
+//   tell(w)                    -- no value and the log w
+// A bind on an lvalue writer has to leave it alone and copies its log
+// into the result, so a chain of n binds copies the entries n times
+// over.  The in-place bind (see monad.hpp) of a temporary appends to the
+// log it already has and moves it on instead, which makes a chain of
+// tells linear.  W is a string or a sequence container: anything with
+// += or with insert(end(), first, last).
+
+namespace detail {
+template <typename W>
+auto log_append(first_choice, W& log, W&& more) -> decltype(log += std::move(more), void())
+{
+    log += std::move(more);
+}
+
+template <typename W>
+auto log_append(second_choice, W& log, W&& more)
+    -> decltype(log.insert(log.end(), std::make_move_iterator(more.begin()),
+                           std::make_move_iterator(more.end())), void())
+{
+    log.insert(log.end(), std::make_move_iterator(more.begin()), std::make_move_iterator(more.end()));
+}
+
+template <typename F, typename A>
+using writer_ret = typename std::decay<decltype(std::declval<F>()(std::declval<A>()))>::type;
+} // namespace detail
+
+template <typename W, typename A>
+struct writer {
+    typedef A value_type;
+    typedef W log_type;
+
+    A value;
+    W log;
+
+    explicit writer(A value, W log = W())
+        : value(std::move(value)), log(std::move(log))
+    {
+    }
+
+    template <typename U>
+    static writer mreturn(U&& value)
+    {
+        return writer(A(std::forward<U>(value)));
+    }
+
+    template <typename F, typename R = detail::writer_ret<F, A const&> >
+    R mbind(F&& fun) const&
+    {
+        R r = std::forward<F>(fun)(value);
+        W joined = log;
+        detail::log_append(detail::make_choice{}, joined, std::move(r.log));
+        r.log = std::move(joined);
+        return r;
+    }
+
+    template <typename F, typename R = detail::writer_ret<F, A&&> >
+    R mbind_inplace(F&& fun) &&
+    {
+        R r = std::forward<F>(fun)(std::move(value));
+        detail::log_append(detail::make_choice{}, log, std::move(r.log));
+        r.log = std::move(log);
+        return r;
+    }
+};
+
+template <typename W>
+writer<typename std::decay<W>::type, unit> tell(W&& log)
+{
+    return writer<typename std::decay<W>::type, unit>(unit(), std::forward<W>(log));
+}
+
+}} // namespace boost::monads
+
+#endif // BOOST_MONADS_WRITER_HPP